@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""Benchmark reconstructN on synthetic wire scans made by wireScanSim.
+
+For each detector size and number of wire steps a wire scan is simulated from
+point sources at known depths, then reconstructed at each depth resolution.
+The wall time of every run is reported, with the time of its phases from the
+<outfile>metrics.json that reconstructN writes, and the depth profile in the
+reconstruction summary is checked against the sources: the centroid of each
+peak must be within the depth tolerance of its source, and the share of the
+total intensity in each peak must match the source within the intensity
+tolerance.  Exits non-zero if any reconstruction fails the check.
+
+Example:
+    python3 bench_recon.py --sim ../bin/wireScanSim --recon ../bin/reconstructN \\
+        --geo geoN.xml --sizes 64,256 --steps 101,201 --resolutions 1,0.5
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def int_list(text):
+    return [int(v) for v in text.split(',') if v]
+
+
+def float_list(text):
+    return [float(v) for v in text.split(',') if v]
+
+
+def parse_sources(text):
+    """'depth:intensity,...' -> [(depth, intensity), ...]"""
+    sources = []
+    for item in text.split(','):
+        depth, _, intensity = item.partition(':')
+        sources.append((float(depth), float(intensity) if intensity else 1000.))
+    return sources
+
+
+def read_summary(path):
+    """Return the $tag values and the depth profile [(depth, intensity), ...] of a reconstruction summary."""
+    tags, profile = {}, []
+    in_array = False
+    with open(path) as f:
+        for line in f:
+            if line.startswith('$array0\t'):
+                in_array = True
+                continue
+            if in_array:
+                parts = line.split()
+                if len(parts) == 3:
+                    profile.append((float(parts[1]), float(parts[2])))
+                continue
+            if line.startswith('$'):
+                parts = line[1:].split(None, 1)
+                if len(parts) == 2:
+                    tags[parts[0]] = parts[1].split('//')[0].strip()
+    return tags, profile
+
+
+def check_profile(profile, sources, depth_tol, intensity_tol):
+    """Compare the peaks of profile with the sources, returns (worst depth error, worst intensity share error, ok)."""
+    depths = sorted(d for d, _ in sources)
+    total_source = sum(i for _, i in sources)
+    peaks = []
+    for depth, intensity in sources:
+        others = [abs(depth - d) for d in depths if d != depth]
+        half = min(others) / 2. if others else float('inf')
+        window = [(z, max(v, 0.)) for z, v in profile if abs(z - depth) < half]
+        area = sum(v for _, v in window)
+        centroid = sum(z * v for z, v in window) / area if area > 0 else float('nan')
+        peaks.append((depth, intensity, centroid, area))
+    total_area = sum(p[3] for p in peaks)
+    depth_err = intensity_err = 0.
+    ok = total_area > 0
+    for depth, intensity, centroid, area in peaks:
+        d_err = abs(centroid - depth)
+        i_err = abs(area / total_area - intensity / total_source) / (intensity / total_source) if total_area > 0 else float('inf')
+        if not (d_err <= depth_tol and i_err <= intensity_tol):
+            ok = False
+        depth_err = max(depth_err, d_err) if d_err == d_err else float('inf')
+        intensity_err = max(intensity_err, i_err)
+    return depth_err, intensity_err, ok
+
+
+def run(cmd, log):
+    start = time.perf_counter()
+    with open(log, 'w') as f:
+        status = subprocess.call(cmd, stdout=f, stderr=subprocess.STDOUT)
+    return status, time.perf_counter() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--sim', required=True, help='wireScanSim executable')
+    parser.add_argument('--recon', required=True, help='reconstructN executable')
+    parser.add_argument('--geo', required=True, help='geoN geometry file')
+    parser.add_argument('--detector', type=int, default=0, help='detector number in the geometry file')
+    parser.add_argument('--sizes', type=int_list, default=[64, 128, 256], help='binned ROI sizes (square), comma separated')
+    parser.add_argument('--bin', type=int, default=1, help='detector binning')
+    parser.add_argument('--steps', type=int_list, default=[101, 201], help='wire steps, comma separated')
+    parser.add_argument('--resolutions', type=float_list, default=[1., 0.5], help='depth resolutions (micron), comma separated')
+    parser.add_argument('--sources', type=parse_sources, default=parse_sources('10:3000,40:1500,95:2500'),
+                        help='point sources as depth:intensity, comma separated')
+    parser.add_argument('--depth-range', type=float_list, default=[-50., 150.], help='reconstructed depth range (micron)')
+    parser.add_argument('--wire-first', default='0,600,-350', help='raw wire position X,Y,Z of the first step (micron)')
+    parser.add_argument('--wire-last', default='0,600,450', help='raw wire position X,Y,Z of the last step (micron)')
+    parser.add_argument('--threads', type=int, default=1, help='reconstructN threads, -N')
+    parser.add_argument('--recon-args', default='', help='more arguments for reconstructN, e.g. "-w b -P"')
+    parser.add_argument('--depth-tol', type=float, default=0., help='allowed peak depth error (micron), 0 is 2 x resolution')
+    parser.add_argument('--intensity-tol', type=float, default=0.1, help='allowed relative error of the intensity in each peak')
+    parser.add_argument('--workdir', default='', help='directory for the images and results, default is a temporary one')
+    parser.add_argument('--keep', action='store_true', help='keep the images and results')
+    parser.add_argument('--json', default='', help='also write the results to this file')
+    args = parser.parse_args()
+
+    workdir = args.workdir or tempfile.mkdtemp(prefix='bench_recon_')
+    os.makedirs(workdir, exist_ok=True)
+    results = []
+    failed = 0
+    print(f"{'size':>6} {'steps':>6} {'res':>6} {'sim(s)':>8} {'recon(s)':>9} {'read':>7} {'diff':>7} {'resolve':>7} {'write':>7} "
+          f"{'Mpix*step/s':>12} {'depth err':>10} {'I err':>7}  result")
+    try:
+        for size in args.sizes:
+            for steps in args.steps:
+                images = os.path.join(workdir, f'sim_{size}_{steps}')
+                os.makedirs(images, exist_ok=True)
+                cmd = [args.sim, '-o', os.path.join(images, 'img_'), '-g', args.geo, '-D', str(args.detector),
+                       '-w', args.wire_first, '-W', args.wire_last, '-n', str(steps),
+                       '-x', str(size), '-y', str(size), '-b', str(args.bin)]
+                for depth, intensity in args.sources:
+                    cmd += ['-s', f'{depth:g}:{intensity:g}']
+                status, sim_seconds = run(cmd, os.path.join(images, 'sim.log'))
+                if status:
+                    print(f'wireScanSim failed, see {images}/sim.log')
+                    return 1
+                for resolution in args.resolutions:
+                    out = os.path.join(workdir, f'recon_{size}_{steps}_{resolution:g}')
+                    shutil.rmtree(out, ignore_errors=True)
+                    os.makedirs(out)
+                    cmd = [args.recon, '-i', os.path.join(images, 'img_'), '-o', os.path.join(out, 'd_'), '-g', args.geo,
+                           '-s', f'{args.depth_range[0]:g}', '-e', f'{args.depth_range[1]:g}', '-r', f'{resolution:g}',
+                           '-f', '0', '-l', str(steps - 1), '-D', str(args.detector), '-N', str(args.threads)]
+                    cmd += args.recon_args.split()
+                    status, seconds = run(cmd, os.path.join(out, 'recon.log'))
+                    entry = {'size': size, 'steps': steps, 'resolution': resolution,
+                             'sim_seconds': sim_seconds, 'recon_seconds': seconds, 'status': status}
+                    if status == 0:
+                        tags, profile = read_summary(os.path.join(out, 'd_summary.txt'))
+                        depth_tol = args.depth_tol if args.depth_tol > 0 else 2. * resolution
+                        depth_err, intensity_err, ok = check_profile(profile, args.sources, depth_tol, args.intensity_tol)
+                        entry.update(depth_err=depth_err, intensity_err=intensity_err, ok=ok,
+                                     stripes=int(tags.get('ws_stripes', 0)))
+                        with open(os.path.join(out, 'd_metrics.json')) as f:
+                            metrics = json.load(f)
+                        entry['metrics'] = {k: metrics[k] for k in ('seconds', 'pixels', 'layout', 'bytes_read',
+                                                                     'bytes_written', 'deposits', 'process_max_rss_MiB')}
+                    else:
+                        depth_err = intensity_err = float('nan')
+                        ok = False
+                        entry['ok'] = False
+                    failed += not ok
+                    rate = size * size * steps / seconds / 1e6
+                    phases = entry.get('metrics', {}).get('seconds', {})
+                    phases = ' '.join(f"{phases.get(k, float('nan')):7.2f}" for k in ('read', 'difference', 'resolve', 'write'))
+                    print(f'{size:6d} {steps:6d} {resolution:6g} {sim_seconds:8.2f} {seconds:9.2f} {phases} {rate:12.2f} '
+                          f'{depth_err:10.3f} {intensity_err:7.3f}  {"ok" if ok else "FAIL"}', flush=True)
+                    results.append(entry)
+                if not args.keep:
+                    shutil.rmtree(images, ignore_errors=True)
+    finally:
+        if args.json:
+            with open(args.json, 'w') as f:
+                json.dump(results, f, indent=1)
+        if not args.keep and not args.workdir:
+            shutil.rmtree(workdir, ignore_errors=True)
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
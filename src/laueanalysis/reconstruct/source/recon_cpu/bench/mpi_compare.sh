@@ -0,0 +1,42 @@
+#!/bin/bash
+# Reconstruct one synthetic wire scan with the serial reconstructN and with the MPI build on NP ranks,
+# once writing one file per depth and once writing a single file (-S), the images must be identical.
+#
+#	mpi_compare.sh <wireScanSim> <reconstructN> <reconstructN_mpi> <outputCompare> <geoN file> [NP]
+#
+# set MPIRUN to change how the MPI build is started, e.g. MPIRUN="mpirun --oversubscribe"
+# set KEEP=1 to keep the images and the outputs
+
+if [ $# -lt 5 ]; then
+	sed -n '2,8p' "$0"
+	exit 1
+fi
+SIM=$1; SERIAL=$2; MPI=$3; COMPARE=$4; GEO=$5; NP=${6:-4}
+MPIRUN=${MPIRUN:-mpirun}
+WORK=$(mktemp -d)
+STEPS=101
+RECON_ARGS="-g $GEO -D 0 -s -50 -e 150 -r 1 -f 0 -l $((STEPS-1))"
+
+finish() {
+	if [ -z "$KEEP" ]; then rm -rf "$WORK"; else echo "images and outputs are in $WORK"; fi
+	exit $1
+}
+
+mkdir -p "$WORK/in"
+if ! "$SIM" -o "$WORK/in/img_" -g "$GEO" -D 0 -w 0,600,-350 -W 0,600,450 -n $STEPS -x 64 -y 64 -s 10:3000 -s 40:1500 -s 95:2500 > "$WORK/sim.log" 2>&1; then
+	echo "FAILED making the synthetic scan, see $WORK/sim.log"; KEEP=1; finish 1
+fi
+
+failed=0
+for mode in files single; do
+	if [ $mode = single ]; then MODE_ARGS="-S"; SUFFIX=".h5"; else MODE_ARGS=""; SUFFIX=""; fi
+	mkdir -p "$WORK/serial_$mode" "$WORK/mpi_$mode"
+	"$SERIAL" -i "$WORK/in/img_" -o "$WORK/serial_$mode/d_" $RECON_ARGS $MODE_ARGS > "$WORK/serial_$mode/log.txt" 2>&1 \
+		|| { echo "$mode: serial reconstructN FAILED, see $WORK/serial_$mode/log.txt"; failed=1; KEEP=1; continue; }
+	$MPIRUN -np $NP "$MPI" -i "$WORK/in/img_" -o "$WORK/mpi_$mode/d_" $RECON_ARGS $MODE_ARGS > "$WORK/mpi_$mode/log.txt" 2>&1 \
+		|| { echo "$mode: $MPIRUN -np $NP reconstructN_mpi FAILED, see $WORK/mpi_$mode/log.txt"; failed=1; KEEP=1; continue; }
+	echo -n "$mode, serial against $NP ranks:  "
+	"$COMPARE" "$WORK/serial_$mode/d_$SUFFIX" "$WORK/mpi_$mode/d_$SUFFIX" 0 || { echo "$mode: the outputs DIFFER"; failed=1; KEEP=1; }
+done
+[ $failed = 0 ] && echo "MPI output is the same as serial"
+finish $failed
@@ -0,0 +1,164 @@
+/*
+ *  outputCompare.c
+ *  reconstruct
+ *
+ *  Compare the depth resolved images of two reconstructions, e.g. an MPI run against a serial one.
+ *  Each output is either the base name of the per-depth files <base>N.h5, or the one file <outfile>.h5 written with -S.
+ *  The depths in entry1/depth and the images in entry1/data/data must agree to within tol.
+ *  Prints the largest difference, and exits with 1 if the outputs differ.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hdf5.h"
+#include "hdf5_hl.h"
+
+typedef struct {						/* one reconstruction, opened by openOutput() */
+	char	base[FILENAME_MAX];			/* as given on the command line */
+	int		stack;						/* true for one file from -S, with all of the depths */
+	hid_t	file_id;					/* the stack file, or the per-depth file last read */
+	size_t	Ndepths;
+	size_t	pixels;						/* in one image */
+	double	*depths;					/* depth of each image (micron) */
+} recon_output;
+
+int main (int argc, const char **argv);
+int openOutput(const char *base, recon_output *out);
+int readImage(recon_output *out, size_t m, double *image);
+void closeOutput(recon_output *out);
+
+
+int main (int argc, const char **argv)
+{
+	recon_output a, b;
+	double	*imageA=NULL, *imageB=NULL;
+	double	tol, diff, maxDiff=0, maxValue=0, depthDiff=0;
+	size_t	m, i;
+	int		bad=0;
+
+	if (argc<3) {
+		printf("\nUsage: outputCompare <output A> <output B> [tol]\n");
+		printf("\toutputs are the base name of the per-depth files <base>N.h5, or the file <outfile>.h5 written with -S\n\n");
+		return 1;
+	}
+	tol = argc>3 ? atof(argv[3]) : 0.;
+	H5Eset_auto2(H5E_DEFAULT,NULL,NULL);				/* a missing per-depth file is not an HDF5 error here */
+	if (openOutput(argv[1],&a) || openOutput(argv[2],&b)) return 1;
+	if (a.Ndepths != b.Ndepths || a.pixels != b.pixels) {
+		fprintf(stderr,"ERROR -- '%s' has %lu images of %lu pixels, '%s' has %lu of %lu\n",a.base,(unsigned long)a.Ndepths,(unsigned long)a.pixels,b.base,(unsigned long)b.Ndepths,(unsigned long)b.pixels);
+		return 1;
+	}
+	imageA = calloc(a.pixels,sizeof(double));
+	imageB = calloc(b.pixels,sizeof(double));
+	if (!imageA || !imageB) { fprintf(stderr,"ERROR -- cannot allocate two images of %lu pixels\n",(unsigned long)a.pixels); return 1; }
+
+	for (m=0; m<a.Ndepths && !bad; m++) {
+		depthDiff = fmax(depthDiff,fabs(a.depths[m]-b.depths[m]));
+		if (readImage(&a,m,imageA) || readImage(&b,m,imageB)) bad = 1;
+		for (i=0; i<a.pixels && !bad; i++) {
+			diff = fabs(imageA[i]-imageB[i]);
+			maxDiff = fmax(maxDiff,diff);
+			maxValue = fmax(maxValue,fabs(imageA[i]));
+		}
+	}
+	if (!bad) printf("%lu images, max abs diff %g (max value %g), max depth diff %g\n",(unsigned long)a.Ndepths,maxDiff,maxValue,depthDiff);
+	bad = bad || maxDiff>tol || depthDiff>1e-9;
+
+	closeOutput(&a);
+	closeOutput(&b);
+	free(imageA);
+	free(imageB);
+	return bad;
+}
+
+
+/* find the depths and image size of one reconstruction, returns 0 if OK */
+int openOutput(
+const char *base,						/* base name of per-depth files, or a file ending in .h5 */
+recon_output *out)
+{
+	char	fname[FILENAME_MAX+16];
+	hsize_t	dims[3];
+	H5T_class_t	class;
+	size_t	size, len=strlen(base);
+	int		rank;
+
+	memset(out,0,sizeof(recon_output));
+	strncpy(out->base,base,FILENAME_MAX-1);
+	out->stack = (len>3 && !strcmp(base+len-3,".h5"));
+	if (out->stack) {
+		if ((out->file_id=H5Fopen(base,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- cannot open '%s'\n",base); return 1; }
+		if (H5LTget_dataset_ndims(out->file_id,"entry1/data/data",&rank)<0 || rank!=3) { fprintf(stderr,"ERROR -- '%s' has no 3D entry1/data/data\n",base); return 1; }
+		H5LTget_dataset_info(out->file_id,"entry1/data/data",dims,&class,&size);
+		out->Ndepths = (size_t)dims[0];
+		out->pixels = (size_t)(dims[1]*dims[2]);
+		if (!(out->depths=calloc(out->Ndepths,sizeof(double)))) return 1;
+		if (H5LTread_dataset_double(out->file_id,"entry1/depth",out->depths)<0) { fprintf(stderr,"ERROR -- cannot read entry1/depth in '%s'\n",base); return 1; }
+		return 0;
+	}
+
+	for (out->Ndepths=0; ; out->Ndepths++) {			/* the per-depth files are numbered from 0 */
+		hid_t	file_id;
+		sprintf(fname,"%s%lu.h5",base,(unsigned long)out->Ndepths);
+		if ((file_id=H5Fopen(fname,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) break;
+		if (!(out->depths=realloc(out->depths,(out->Ndepths+1)*sizeof(double)))) return 1;
+		if (H5LTread_dataset_double(file_id,"entry1/depth",out->depths+out->Ndepths)<0) { fprintf(stderr,"ERROR -- cannot read entry1/depth in '%s'\n",fname); return 1; }
+		if (out->Ndepths==0) {
+			if (H5LTget_dataset_ndims(file_id,"entry1/data/data",&rank)<0 || rank!=2) { fprintf(stderr,"ERROR -- '%s' has no 2D entry1/data/data\n",fname); return 1; }
+			H5LTget_dataset_info(file_id,"entry1/data/data",dims,&class,&size);
+			out->pixels = (size_t)(dims[0]*dims[1]);
+		}
+		H5Fclose(file_id);
+	}
+	if (out->Ndepths<1) { fprintf(stderr,"ERROR -- no output files '%s0.h5', ...\n",base); return 1; }
+	return 0;
+}
+
+
+/* read image m of a reconstruction into image, returns 0 if OK */
+int readImage(
+recon_output *out,
+size_t	m,								/* index of the depth */
+double	*image)							/* space for out->pixels values */
+{
+	char	fname[FILENAME_MAX+16];
+	hid_t	data_id=0, space=0, memspace=0;
+	hsize_t	offset[3]={0,0,0}, count[3]={1,1,1}, dims[3];
+	herr_t	err=0;
+
+	if (!out->stack) {
+		sprintf(fname,"%s%lu.h5",out->base,(unsigned long)m);
+		if ((out->file_id=H5Fopen(fname,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- cannot open '%s'\n",fname); return 1; }
+		err = H5LTread_dataset_double(out->file_id,"entry1/data/data",image);
+		H5Fclose(out->file_id);
+		out->file_id = 0;
+		if (err<0) fprintf(stderr,"ERROR -- cannot read entry1/data/data in '%s'\n",fname);
+		return (err<0);
+	}
+
+	if ((data_id=H5Dopen(out->file_id,"entry1/data/data",H5P_DEFAULT))<=0) return 1;
+	space = H5Dget_space(data_id);
+	H5Sget_simple_extent_dims(space,dims,NULL);
+	offset[0] = m;	count[1] = dims[1];	count[2] = dims[2];
+	H5Sselect_hyperslab(space,H5S_SELECT_SET,offset,NULL,count,NULL);
+	memspace = H5Screate_simple(3,count,NULL);
+	err = H5Dread(data_id,H5T_NATIVE_DOUBLE,memspace,space,H5P_DEFAULT,image);
+	if (err<0) fprintf(stderr,"ERROR -- cannot read image %lu of '%s'\n",(unsigned long)m,out->base);
+	H5Sclose(memspace);
+	H5Sclose(space);
+	H5Dclose(data_id);
+	return (err<0);
+}
+
+
+void closeOutput(
+recon_output *out)
+{
+	if (out->stack && out->file_id>0) H5Fclose(out->file_id);
+	free(out->depths);
+	out->depths = NULL;
+	out->file_id = 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Check that an interrupted reconstruction continued with -R gives the same images as an uninterrupted one,
+# and that -R never trusts a progress journal left over from before the output was re-made by a run without -c.
+#
+#	resume_compare.sh <wireScanSim> <reconstructN> <outputCompare> <geoN file>
+#
+# set KEEP=1 to keep the images and the outputs
+
+if [ $# -lt 4 ]; then
+	sed -n '2,7p' "$0"
+	exit 1
+fi
+SIM=$1; RECON=$2; COMPARE=$3; GEO=$4
+WORK=$(mktemp -d)
+STEPS=101
+RECON_ARGS="-i $WORK/in/img_ -g $GEO -D 0 -s -50 -e 150 -r 1 -f 0 -l $((STEPS-1)) -m 1"	# -m 1 gives many stripes
+
+finish() {
+	if [ -z "$KEEP" ]; then rm -rf "$WORK"; else echo "images and outputs are in $WORK"; fi
+	exit $1
+}
+
+mkdir -p "$WORK/in" "$WORK/ref" "$WORK/out"
+if ! "$SIM" -o "$WORK/in/img_" -g "$GEO" -D 0 -w 0,600,-350 -W 0,600,450 -n $STEPS -x 64 -y 64 -s 10:3000 -s 40:1500 -s 95:2500 > "$WORK/sim.log" 2>&1; then
+	echo "FAILED making the synthetic scan, see $WORK/sim.log"; KEEP=1; finish 1
+fi
+"$RECON" $RECON_ARGS -o "$WORK/ref/d_" > "$WORK/ref/log.txt" 2>&1 || { echo "reference reconstructN FAILED"; KEEP=1; finish 1; }
+
+failed=0
+# an interrupted run with -c, then -R
+timeout -s KILL 0.3 "$RECON" $RECON_ARGS -o "$WORK/out/d_" -c > "$WORK/out/log1.txt" 2>&1
+"$RECON" $RECON_ARGS -o "$WORK/out/d_" -R > "$WORK/out/log2.txt" 2>&1 || { echo "interrupted: -R FAILED"; failed=1; }
+echo -n "interrupted, then -R:  "
+"$COMPARE" "$WORK/ref/d_" "$WORK/out/d_" 0 || { echo "interrupted: the outputs DIFFER"; failed=1; }
+
+# a complete run with -c, the same run without -c interrupted (the output is blank), then -R
+"$RECON" $RECON_ARGS -o "$WORK/out/d_" -c > "$WORK/out/log3.txt" 2>&1
+timeout -s KILL 0.3 "$RECON" $RECON_ARGS -o "$WORK/out/d_" > "$WORK/out/log4.txt" 2>&1
+"$RECON" $RECON_ARGS -o "$WORK/out/d_" -R > "$WORK/out/log5.txt" 2>&1 || { echo "stale journal: -R FAILED"; failed=1; }
+echo -n "stale journal, then -R:  "
+"$COMPARE" "$WORK/ref/d_" "$WORK/out/d_" 0 || { echo "stale journal: the outputs DIFFER"; failed=1; }
+
+[ $failed = 0 ] && echo "resumed output is the same as uninterrupted" || KEEP=1
+finish $failed
@@ -0,0 +1,74 @@
+/*
+ *  selectTest.c
+ *  reconstruct
+ *
+ *  Check select_kth_double() in mathUtil.c against qsort().  Random arrays of random length, some drawn from only a few
+ *  values so there are many duplicates, plus sorted, reverse sorted, and constant arrays.  Every array is checked for
+ *  k=0, k=n-1 and a random k.  Prints the number of failures and exits with 1 if there were any.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mathUtil.h"
+
+#define N_ARRAYS	20000				/* number of random arrays to check */
+#define MAX_LEN		257					/* longest random array */
+
+int main (int argc, const char **argv);
+int checkOne(const double *a, size_t n, size_t k, double *work, double *sorted);
+
+
+int main (int argc, const char **argv)
+{
+	double	a[MAX_LEN], work[MAX_LEN], sorted[MAX_LEN];
+	size_t	n, k, i;
+	long	m, checks=0, failures=0;
+	int		Nvalues;						/* number of distinct values to draw from, 0 is any double */
+
+	srand(argc>1 ? (unsigned)atoi(argv[1]) : 1u);
+	for (m=0; m<N_ARRAYS; m++) {
+		n = 1 + (size_t)(rand() % MAX_LEN);
+		Nvalues = (m%3==0) ? 0 : ((m%3==1) ? 1+rand()%8 : 1+rand()%(int)n);
+		for (i=0;i<n;i++) a[i] = Nvalues ? (double)(rand()%Nvalues) : (double)rand()/RAND_MAX - 0.5;
+		if (m%50==1) for (i=0;i<n;i++) a[i] = (double)i;				/* already sorted */
+		if (m%50==2) for (i=0;i<n;i++) a[i] = (double)(n-i);			/* reverse sorted */
+		if (m%50==3) for (i=0;i<n;i++) a[i] = 7.;						/* all the same */
+
+		k = (size_t)rand() % n;
+		failures += checkOne(a,n,0,work,sorted);
+		failures += checkOne(a,n,n-1,work,sorted);
+		failures += checkOne(a,n,k,work,sorted);
+		checks += 3;
+	}
+	printf("select_kth_double(): %ld failures in %ld checks of %d arrays\n",failures,checks,N_ARRAYS);
+	return (failures ? 1 : 0);
+}
+
+
+/* returns 1 if select_kth_double() does not give the k-th value of the sorted a[n], or it lost or added a value */
+int checkOne(
+const double *a,						/* the array to test, not changed */
+size_t	n,								/* length of a */
+size_t	k,								/* zero based index of the value wanted */
+double	*work,							/* scratch space of length n */
+double	*sorted)						/* scratch space of length n */
+{
+	double	value;
+
+	memcpy(sorted,a,n*sizeof(double));
+	qsort(sorted,n,sizeof(double),(int (*)(const void *, const void *))compare_double);
+	memcpy(work,a,n*sizeof(double));
+	value = select_kth_double(work,n,k);
+	if (value != sorted[k]) {
+		fprintf(stderr,"ERROR -- n=%lu, k=%lu, select_kth_double() gave %g, sorted value is %g\n",(unsigned long)n,(unsigned long)k,value,sorted[k]);
+		return 1;
+	}
+	qsort(work,n,sizeof(double),(int (*)(const void *, const void *))compare_double);
+	if (memcmp(work,sorted,n*sizeof(double))) {	/* select must only re-order a */
+		fprintf(stderr,"ERROR -- n=%lu, k=%lu, select_kth_double() changed the values in the array\n",(unsigned long)n,(unsigned long)k);
+		return 1;
+	}
+	return 0;
+}
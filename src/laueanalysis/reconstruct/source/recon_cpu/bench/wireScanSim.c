@@ -0,0 +1,391 @@
+/*
+ *  wireScanSim.c
+ *  reconstruct
+ *
+ *  Make a synthetic wire scan, a series of HDF5 images as they would be measured from point sources at known depths along the incident beam.
+ *  Each pixel sees a source unless the wire shadows it, and the shadow is taken from the same geometry used by the reconstruction:
+ *  the depths of the rays tangent to the leading and trailing edges of the wire, pixel_xyz_to_depth() in wireGeometry.c.
+ *  The images are written in the layout that readSingleImage() expects, <outfile><N>.h5, or as frames of one file with -F.
+ *
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mathUtil.h"
+#include "microHDF5.h"
+#include "WireScanDataTypesN.h"
+#include "readGeoN.h"
+#include "WireScan.h"
+#include "wireGeometry.h"
+#include "misc.h"
+
+#define MAX_SOURCES		64				/* most point sources along the beam */
+#define SIM_FILE_TIME	"2023-04-06 03:07:11-0500"	/* default file_time, selects the positioner correction used by wirePosition2beamLine() */
+
+typedef struct {						/* one point source on the incident beam */
+	double	depth;						/* depth along the incident beam (micron) */
+	double	intensity;					/* counts in a pixel when the wire is not shadowing the source */
+} sim_source;
+
+int main (int argc, const char **argv);
+void printHelpText(void);
+int parseTriple(const char *str, point_xyz *v);
+void simulateImage(point_xyz wire, const sim_source *src, int Nsrc, int sub, double background, unsigned short *image);
+hid_t createSimFile(const char *fileName, const char *fileTime, size_t Nframes, hid_t *data_id);
+void writeSimScalars(hid_t file_id, point_xyz wire_raw, double current);
+void writeSimVector(hid_t file_id, const char *dataName, const double *v, size_t N);
+
+
+
+int main (int argc, const char *argv[]) {
+	int		c;
+	char	outfile[FILENAME_MAX];
+	char	geofile[FILENAME_MAX];
+	char	fileTime[MAX_micro_STRING_LEN+1];
+	char	fileName[FILENAME_MAX];
+	sim_source src[MAX_SOURCES];		/* the point sources */
+	int		Nsrc=0;
+	point_xyz wire_first, wire_last;	/* raw positioner wire positions at the first and last step */
+	int		Nsteps=0;					/* number of images in the wire scan */
+	int		nx=64, ny=64;				/* binned pixels in the ROI, along i (slow index) and j (fast index) of an image */
+	int		bin=1;						/* binning, the same along x and y */
+	int		sub=4;						/* each pixel is sampled sub x sub times */
+	double	background=100.;			/* counts added to every pixel */
+	double	current=102.;				/* ring current (mA), written for normalization by -n mA */
+	int		frames=0;					/* true writes all images as frames of one file */
+	unsigned long required=0, requiredFlags=((1<<5)-1);
+
+	outfile[0] = geofile[0] = '\0';
+	strncpy(fileTime,SIM_FILE_TIME,MAX_micro_STRING_LEN);
+	geoIn.wire.axis[0]=1; geoIn.wire.axis[1]=geoIn.wire.axis[2]=0;	/* default wire.axis is {1,0,0} */
+	geoIn.wire.R[0] = geoIn.wire.R[1] = geoIn.wire.R[2] = 0;		/* default PM500 rotation of wire is 0 */
+	verbose = 0;
+	detNum = 0;
+
+	while (1)
+	{
+		static struct option long_options[] =
+		{
+			{"outfile",				required_argument,		0,	'o'},
+			{"geofile",				required_argument,		0,	'g'},
+			{"wire-first",			required_argument,		0,	'w'},
+			{"wire-last",			required_argument,		0,	'W'},
+			{"steps",				required_argument,		0,	'n'},
+			{"source",				required_argument,		0,	's'},
+			{"nx",					required_argument,		0,	'x'},
+			{"ny",					required_argument,		0,	'y'},
+			{"bin",					required_argument,		0,	'b'},
+			{"subsample",			required_argument,		0,	'u'},
+			{"background",			required_argument,		0,	'B'},
+			{"current",				required_argument,		0,	'c'},
+			{"file-time",			required_argument,		0,	'T'},
+			{"detector_number",		required_argument,		0,	'D'},
+			{"frames",				no_argument,			0,	'F'},
+			{"verbose",				required_argument,		0,	'v'},
+			{"help",				no_argument,			0,	'h'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long (argc, (char * const *)argv, "o:g:w:W:n:s:x:y:b:u:B:c:T:D:Fv:h", long_options, &option_index);
+		if (c == -1) break;
+
+		switch (c)
+		{
+			case 'o':
+				strncpy(outfile,optarg,FILENAME_MAX-2);
+				outfile[FILENAME_MAX-1] = '\0';
+				required = required | (1<<0);
+				break;
+			case 'g':
+				strncpy(geofile,optarg,FILENAME_MAX-2);
+				geofile[FILENAME_MAX-1] = '\0';
+				required = required | (1<<1);
+				break;
+			case 'w':
+				if (parseTriple(optarg,&wire_first)) { error("-w needs the wire position as X,Y,Z"); exit(1); }
+				required = required | (1<<2);
+				break;
+			case 'W':
+				if (parseTriple(optarg,&wire_last)) { error("-W needs the wire position as X,Y,Z"); exit(1); }
+				required = required | (1<<3);
+				break;
+			case 'n':
+				Nsteps = atoi(optarg);
+				required = required | (1<<4);
+				break;
+			case 's':
+				if (Nsrc>=MAX_SOURCES) { error("too many sources"); exit(1); }
+				src[Nsrc].intensity = 1000.;
+				if (sscanf(optarg,"%lg:%lg",&src[Nsrc].depth,&src[Nsrc].intensity)<1) { error("-s needs depth[:intensity]"); exit(1); }
+				Nsrc++;
+				break;
+			case 'x':	nx = atoi(optarg);				break;
+			case 'y':	ny = atoi(optarg);				break;
+			case 'b':	bin = atoi(optarg);				break;
+			case 'u':	sub = atoi(optarg);				break;
+			case 'B':	background = atof(optarg);		break;
+			case 'c':	current = atof(optarg);			break;
+			case 'D':	detNum = atoi(optarg);			break;
+			case 'F':	frames = 1;						break;
+			case 'v':	verbose = atoi(optarg);			break;
+			case 'T':
+				strncpy(fileTime,optarg,MAX_micro_STRING_LEN);
+				fileTime[MAX_micro_STRING_LEN] = '\0';
+				break;
+			case 'h':
+			case '?':
+			default:
+				printHelpText();
+				exit(1);
+		}
+	}
+	if ((required & requiredFlags) != requiredFlags || Nsrc<1) {
+		error("some required arguments not supplied, need -o, -g, -w, -W, -n, and at least one -s");
+		printHelpText();
+		exit(1);
+	}
+	if (Nsteps<2 || nx<1 || ny<1 || bin<1 || sub<1) { error("need at least 2 steps, and positive ROI size, binning and sub-sampling"); exit(1); }
+	if (detNum<0 || detNum>=MAX_Ndetectors) { error("detector number out of range"); exit(1); }
+
+	if (readGeoFromFile(geofile, &geoIn)) { error("Could not load geometry from a file"); exit(1); }
+	geo2calibration(&geoIn, detNum);
+	if (verbose > 0) printCalibration(verbose);
+
+	/* the ROI is centered on the detector, i is along detector y and j along x, as pixel_to_point_xyz() assumes */
+	imaging_parameters.nROI_i = nx;
+	imaging_parameters.nROI_j = ny;
+	imaging_parameters.bini = imaging_parameters.binj = bin;
+	imaging_parameters.starti = (int)(calibration.ccd_pixels_i/2) - ny*bin/2;
+	imaging_parameters.startj = (int)(calibration.ccd_pixels_j/2) - nx*bin/2;
+	imaging_parameters.endi = imaging_parameters.starti + ny*bin - 1;
+	imaging_parameters.endj = imaging_parameters.startj + nx*bin - 1;
+	if (imaging_parameters.starti<0 || imaging_parameters.startj<0) { error("ROI is larger than the detector"); exit(1); }
+	positionerType = positionerTypeFromFileTime(fileTime);		/* the same correction the reconstruction will pick from file_time */
+
+	unsigned short *image = calloc((size_t)nx*ny, sizeof(unsigned short));
+	double	*wx = calloc(Nsteps, sizeof(double));
+	double	*wy = calloc(Nsteps, sizeof(double));
+	double	*wz = calloc(Nsteps, sizeof(double));
+	double	*mA = calloc(Nsteps, sizeof(double));
+	if (!image || !wx || !wy || !wz || !mA) { error("could not allocate space for the images"); exit(1); }
+
+	hid_t	file_id=0, data_id=0;
+	if (frames && (file_id=createSimFile(outfile, fileTime, Nsteps, &data_id))<=0) { error("could not create the output file"); exit(1); }
+
+	int		m;
+	for (m=0; m<Nsteps; m++) {
+		double f = (double)m / (Nsteps-1);
+		point_xyz wire_raw, wire;
+		wire_raw.x = wire_first.x + f*(wire_last.x - wire_first.x);
+		wire_raw.y = wire_first.y + f*(wire_last.y - wire_first.y);
+		wire_raw.z = wire_first.z + f*(wire_last.z - wire_first.z);
+		wx[m] = wire_raw.x;  wy[m] = wire_raw.y;  wz[m] = wire_raw.z;  mA[m] = current;
+		wire = wirePosition2beamLine(wire_raw);		/* same correction the reconstruction applies to the wire positions it reads */
+
+		simulateImage(wire, src, Nsrc, sub, background, image);
+
+		if (frames) {								/* write frame m of [Nsteps][x][y] */
+			hsize_t	offset[3]={m,0,0}, count[3]={1,0,0};
+			hid_t	fspace, mspace;
+			hsize_t	dims2[2];
+#ifdef RECONSTRUCT_BACKWARDS
+			count[1] = dims2[0] = nx;  count[2] = dims2[1] = ny;
+#else
+			count[1] = dims2[0] = ny;  count[2] = dims2[1] = nx;
+#endif
+			fspace = H5Dget_space(data_id);
+			mspace = H5Screate_simple(2,dims2,NULL);
+			H5Sselect_hyperslab(fspace,H5S_SELECT_SET,offset,NULL,count,NULL);
+			if (H5Dwrite(data_id,H5T_NATIVE_USHORT,mspace,fspace,H5P_DEFAULT,image)<0) { error("could not write a frame"); exit(1); }
+			H5Sclose(mspace);
+			H5Sclose(fspace);
+		}
+		else {										/* one file per image */
+			hid_t	one_id;
+			sprintf(fileName,"%s%d.h5",outfile,m);
+			if ((one_id=createSimFile(fileName, fileTime, 0, &data_id))<=0) { error("could not create an output file"); exit(1); }
+			if (H5Dwrite(data_id,H5T_NATIVE_USHORT,H5S_ALL,H5S_ALL,H5P_DEFAULT,image)<0) { error("could not write an image"); exit(1); }
+			writeSimScalars(one_id, wire_raw, current);
+			H5Dclose(data_id);
+			H5Fclose(one_id);
+		}
+		if (verbose > 0) { printf("\rimage %d of %d",m+1,Nsteps); fflush(stdout); }
+	}
+
+	if (frames) {									/* the wire positions and current are vectors, one value for each frame */
+		writeSimVector(file_id, "entry1/wireX", wx, Nsteps);
+		writeSimVector(file_id, "entry1/wireY", wy, Nsteps);
+		writeSimVector(file_id, "entry1/wireZ", wz, Nsteps);
+		writeSimVector(file_id, "entry1/microDiffraction/source/current", mA, Nsteps);
+		H5Dclose(data_id);
+		H5Fclose(file_id);
+	}
+	if (verbose > 0) printf("\n");
+
+	free(image); free(wx); free(wy); free(wz); free(mA);
+	return 0;
+}
+
+
+void printHelpText(void)
+{
+	printf("\nUsage: wireScanSim -o <file> -g <file> -w <X,Y,Z> -W <X,Y,Z> -n <\x23> -s <depth[:intensity]> [-s ...] [-x <\x23>] [-y <\x23>] [-b <\x23>] [-u <\x23>] [-B <\x23>] [-c <\x23>] [-T <time>] [-D <\x23>] [-F]\n\n");
+	printf("\n-o <file>,\t --outfile=<file>\t\tleading section of the image file names to create, or the one file with -F");
+	printf("\n-g <file>,\t --geofile=<file>\t\tgeometry file, geoN");
+	printf("\n-w <X,Y,Z>,\t --wire-first=<X,Y,Z>\t\traw positioner wire position of the first image (micron)");
+	printf("\n-W <X,Y,Z>,\t --wire-last=<X,Y,Z>\t\traw positioner wire position of the last image (micron)");
+	printf("\n-n <\x23>,\t\t --steps=<\x23>\t\t\tnumber of images in the wire scan");
+	printf("\n-s <d[:I]>,\t --source=<d[:I]>\t\ta point source at depth d (micron) along the beam, with I counts/pixel (default 1000), repeat for more sources");
+	printf("\n-x <\x23>,\t\t --nx=<\x23>\t\t\tbinned pixels along i of the ROI (default 64)");
+	printf("\n-y <\x23>,\t\t --ny=<\x23>\t\t\tbinned pixels along j of the ROI (default 64)");
+	printf("\n-b <\x23>,\t\t --bin=<\x23>\t\t\tbinning of the detector (default 1)");
+	printf("\n-u <\x23>,\t\t --subsample=<\x23>\t\tsample each pixel u x u times for the partial shadow of the wire (default 4)");
+	printf("\n-B <\x23>,\t\t --background=<\x23>\t\tcounts added to every pixel (default 100)");
+	printf("\n-c <\x23>,\t\t --current=<\x23>\t\tring current written with each image (mA) (default 102)");
+	printf("\n-T <time>,\t --file-time=<time>\t\tfile_time written with each image, selects the positioner correction (default '%s')",SIM_FILE_TIME);
+	printf("\n-D <\x23>,\t\t --detector_number=<\x23>\t\tdetector in the geometry file (default 0)");
+	printf("\n-F,\t\t --frames\t\t\twrite one file with all of the images as frames [step][x][y]");
+	printf("\n-v <\x23>,\t\t --verbose=<\x23>\t\t\tprint progress");
+	printf("\n-h,\t\t --help\t\t\t\tdisplay this help");
+	printf("\n\n");
+	printf("Example: wireScanSim -o /tmp/sim/img_ -g geoN.xml -w 0,600,-300 -W 0,600,400 -n 201 -s 10:3000 -s 40:1500 -s 95:2500\n\n");
+	return;
+}
+
+
+/* read "X,Y,Z" into v, returns 0 if OK */
+int parseTriple(
+	const char *str,
+	point_xyz *v)
+{
+	return (sscanf(str,"%lg,%lg,%lg",&(v->x),&(v->y),&(v->z)) == 3) ? 0 : 1;
+}
+
+
+/* Fill one image for the wire at 'wire' (beam line coordinates, as from wirePosition2beamLine).
+ * A source is hidden from a point on a pixel when its depth lies between the depths of the rays from that point tangent to the
+ * leading and trailing edges of the wire.  Each pixel is sampled sub x sub times, so the partial shadow at the wire edges is smooth. */
+void simulateImage(
+	point_xyz wire,						/* wire center, beam line coordinates rotated by rho */
+	const sim_source *src,				/* the point sources */
+	int		Nsrc,
+	int		sub,						/* sub-samples along each direction of a pixel */
+	double	background,					/* counts added to every pixel */
+	unsigned short *image)				/* result, [nROI_i][nROI_j] (or [nROI_j][nROI_i] when not RECONSTRUCT_BACKWARDS) */
+{
+	int		nROI_i = imaging_parameters.nROI_i;
+	int		nROI_j = imaging_parameters.nROI_j;
+	int		i;
+
+	#pragma omp parallel for schedule(dynamic)
+	for (i=0; i<nROI_i; i++) {
+		int		j, a, b, k;
+		for (j=0; j<nROI_j; j++) {
+			double	counts=0;
+			point_ccd pixel;
+			for (a=0; a<sub; a++) {
+				pixel.i = i + (a+0.5)/sub - 0.5;
+				for (b=0; b<sub; b++) {
+					point_xyz xyz;
+					double	lead, trail, lo, hi;
+					pixel.j = j + (b+0.5)/sub - 0.5;
+					xyz = pixel_to_point_xyz(pixel);
+					lead = pixel_xyz_to_depth(xyz, wire, 1);
+					trail = pixel_xyz_to_depth(xyz, wire, 0);
+					lo = MIN(lead,trail);
+					hi = MAX(lead,trail);
+					for (k=0; k<Nsrc; k++) {
+						if (!(lo < src[k].depth && src[k].depth < hi)) counts += src[k].intensity;	/* NaN (wire on the ray) is not a shadow */
+					}
+				}
+			}
+			counts = counts/(sub*sub) + background;
+			counts = MIN(MAX(round(counts),0),65535);
+#ifdef RECONSTRUCT_BACKWARDS
+			image[(size_t)i*nROI_j + j] = (unsigned short)counts;
+#else
+			image[(size_t)j*nROI_i + i] = (unsigned short)counts;
+#endif
+		}
+	}
+}
+
+
+/* Create an image file with the groups and header values that readHDF5header() looks for, and an empty entry1/data/data.
+ * The data is one image, or Nframes images [Nframes][x][y] when Nframes>0.  Returns the open file, and the open data in data_id. */
+hid_t createSimFile(
+	const char *fileName,
+	const char *fileTime,				/* value of the file_time attribute */
+	size_t	Nframes,					/* 0 for a single image */
+	hid_t	*data_id)					/* returned, the open data set entry1/data/data */
+{
+	hid_t	file_id, space_id;
+	hsize_t	dims[3], one[1]={1};
+	int		rank=0, v;
+
+	if ((file_id=H5Fcreate(fileName,H5F_ACC_TRUNC,H5P_DEFAULT,H5P_DEFAULT))<0) return -1;
+	H5LTset_attribute_string(file_id,"/","file_time",fileTime);
+	H5LTset_attribute_string(file_id,"/","file_name",fileName);
+	H5Gclose(H5Gcreate(file_id,"entry1",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT));
+	H5Gclose(H5Gcreate(file_id,"entry1/data",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT));
+	H5Gclose(H5Gcreate(file_id,"entry1/detector",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT));
+	H5Gclose(H5Gcreate(file_id,"entry1/microDiffraction",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT));
+	H5Gclose(H5Gcreate(file_id,"entry1/microDiffraction/source",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT));
+
+	v = calibration.ccd_pixels_i;		H5LTmake_dataset_int(file_id,"entry1/detector/Nx",1,one,&v);
+	v = calibration.ccd_pixels_j;		H5LTmake_dataset_int(file_id,"entry1/detector/Ny",1,one,&v);
+	v = imaging_parameters.starti;		H5LTmake_dataset_int(file_id,"entry1/detector/startx",1,one,&v);
+	v = imaging_parameters.endi;		H5LTmake_dataset_int(file_id,"entry1/detector/endx",1,one,&v);
+	v = imaging_parameters.bini;		H5LTmake_dataset_int(file_id,"entry1/detector/binx",1,one,&v);
+	v = imaging_parameters.startj;		H5LTmake_dataset_int(file_id,"entry1/detector/starty",1,one,&v);
+	v = imaging_parameters.endj;		H5LTmake_dataset_int(file_id,"entry1/detector/endy",1,one,&v);
+	v = imaging_parameters.binj;		H5LTmake_dataset_int(file_id,"entry1/detector/biny",1,one,&v);
+
+	if (Nframes>0) dims[rank++] = Nframes;
+#ifdef RECONSTRUCT_BACKWARDS
+	dims[rank++] = imaging_parameters.nROI_i;
+	dims[rank++] = imaging_parameters.nROI_j;
+#else
+	dims[rank++] = imaging_parameters.nROI_j;
+	dims[rank++] = imaging_parameters.nROI_i;
+#endif
+	space_id = H5Screate_simple(rank,dims,NULL);
+	*data_id = H5Dcreate(file_id,"entry1/data/data",H5T_NATIVE_USHORT,space_id,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+	H5Sclose(space_id);
+	if (*data_id<0) { H5Fclose(file_id); return -1; }
+	return file_id;
+}
+
+
+/* write the scalar header values of one image */
+void writeSimScalars(
+	hid_t	file_id,
+	point_xyz wire_raw,					/* raw positioner wire position (micron) */
+	double	current)					/* ring current (mA) */
+{
+	hsize_t	one[1]={1};
+	H5LTmake_dataset_double(file_id,"entry1/wireX",1,one,&(wire_raw.x));
+	H5LTmake_dataset_double(file_id,"entry1/wireY",1,one,&(wire_raw.y));
+	H5LTmake_dataset_double(file_id,"entry1/wireZ",1,one,&(wire_raw.z));
+	H5LTmake_dataset_double(file_id,"entry1/microDiffraction/source/current",1,one,&current);
+}
+
+
+/* write a vector with one value for each frame */
+void writeSimVector(
+	hid_t	file_id,
+	const char *dataName,
+	const double *v,
+	size_t	N)
+{
+	hsize_t	dims[1];
+	dims[0] = N;
+	H5LTmake_dataset_double(file_id,dataName,1,dims,v);
+}
@@ -21,6 +21,9 @@ ws_calibration calibration;
 ws_imaging_parameters imaging_parameters;
 ws_image_set image_set;
 ws_user_preferences user_preferences;
+ws_pixel_edges pixel_edges;
+ws_active_pixels active_pixels;
+ws_run_metrics run_metrics;
 
 gsl_matrix * intensity_map;
 
@@ -32,9 +35,19 @@ struct geoStructure geoIn;
 int		verbose;							/* default to 0 */
 float	percent;							/* default to 100 */
 int		cutoff;								/* default to 0 */
-int		AVAILABLE_RAM_MiB;					/* default to 128 */
+int		AVAILABLE_RAM_MiB;					/* 0 means choose it from the free memory and cgroup limit, default to 0 */
+int		NUM_THREADS;						/* number of threads used for depth resolving, default to 1 */
+int		PIPELINE_IO;						/* true to read & write stripes in separate threads while depth resolving, default to 0 */
+int		SINGLE_OUTPUT_FILE;					/* true to write all depths into one 3D data set in one file, default to 0 */
+int		COMPRESS_LEVEL;						/* deflate level (with shuffle) of the output images, 0 is no compression, default to 1 */
+int		CHECKPOINT;							/* true to keep the progress journal <outfile>progress.txt as stripes are written, default to 0 */
+int		RESUME;								/* true to skip the stripes already done according to the progress journal, default to 0 */
+int		MULTI_FRAME_FILE;					/* true when the input is one file holding all of the images as frames [frame][x][y], default to 0 */
 int		detNum;								/* detector number, default to 0 */
+int		RANK;								/* MPI rank of this process, always 0 without USE_MPI */
+int		NRANKS;								/* number of MPI ranks sharing the rows of the scan, always 1 without USE_MPI */
 char	distortionPath[FILENAME_MAX];		/* full path to the distortion map */
 char	depthCorrectStr[FILENAME_MAX];		/* full path to the depth correction map */
+char	edgeCachePath[FILENAME_MAX];		/* optional file to save/load pixel_edges, empty means always compute it */
 
 #endif
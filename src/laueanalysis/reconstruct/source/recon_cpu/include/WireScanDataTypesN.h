@@ -36,20 +36,107 @@ typedef struct		/* a generic void vector, be careful with this one */
 } vvector;
 
 
+#ifdef STRIPE_FLOAT		/* stripes hold float32, half the memory of double so twice as many rows fit in one stripe */
+typedef float stripe_real;
+#define H5T_STRIPE_REAL H5T_NATIVE_FLOAT	/* HDF5 memory type of stripe_real */
+#else
+typedef double stripe_real;
+#define H5T_STRIPE_REAL H5T_NATIVE_DOUBLE
+#endif
+
+typedef struct		/* one stripe of a stack of images (wire steps or depths), all of the images of one pixel are contiguous */
+{
+	size_t	size;			/* number of images used (e.g. wire steps read so far) */
+	size_t	alloc;			/* number of images there is room for */
+	size_t	rows;			/* number of rows in the stripe, imaging_parameters.rows_at_one_time */
+	size_t	cols;			/* number of columns, imaging_parameters.nROI_j */
+	size_t	capacity;		/* number of values there is room for in v (and c), a smaller stripe can re-use the space */
+	stripe_real *v;			/* value of pixel [i][j] (relative to the stripe) in image m is v[(i*cols + j)*alloc + m] */
+	stripe_real *c;			/* Kahan compensation for each value in v, only for depth stripes with STRIPE_KAHAN, otherwise NULL */
+} stepstripe;
+#define STEP_PTR(S,i,j) ((S).v + ((i)*(S).cols + (j))*(S).alloc)	/* pointer to all of the wire steps of pixel [i][j] of the stripe S */
+
+
 /*typedef struct {
  *	HDF5_Header image_header;
  *	point_xyz wire_position;
  *} wire_scan_data; */
 
 typedef struct {
-	vvector	wire_scanned;				/* a vector of gsl_matrix raw wire scanned images (maybe cropped) */
+	stepstripe wire_scanned;			/* stripe of the raw wire scanned images (maybe cropped), stored as [row][col][step] */
 	xyzvector wire_positions;			/* wire location in a wire scan - same size as wire_scanned for each wire_scanned */
-	vvector	depth_resolved;				/* a vector of gsl_matrix depth-resolved images */
+	dvector	normalVector;				/* normalization of each input image, the image is multiplied by this */
+	stepstripe depth_resolved;			/* stripe of the depth-resolved images, stored as [row][col][depth] */
+	dvector	depth_image;				/* one depth of the stripe taken out of depth_resolved for writing, [row][col] */
 	dvector	depth_intensity;			/* sum of the intensity at each depth */
 } ws_image_set;
 
 
 
+typedef struct {						/* the pixels that will be depth resolved (intensity >= cutoff), made by get_intensity_map() */
+	size_t	size;						/* number of active pixels */
+	size_t	Ni;							/* number of rows, imaging_parameters.nROI_i */
+	int		*j;							/* column of each active pixel, sorted by row and then by column */
+	size_t	*row_start;					/* active pixels of row i are j[row_start[i]] thru j[row_start[i+1]-1], Ni+1 values */
+	int		*step_lo;					/* only the differenced wire steps [step_lo,step_hi] of each active pixel can reach the */
+	int		*step_hi;					/*   output depths, set by cull_active_pixels(), NULL means all steps */
+} ws_active_pixels;
+
+
+
+typedef struct {						/* rho-rotated (y,z) of every pixel edge along j for the whole ROI, built once in make_pixel_edges() */
+	size_t	Ni;							/* number of rows, imaging_parameters.nROI_i */
+	size_t	Nj;							/* number of edges in one row, imaging_parameters.nROI_j + 1 */
+	double	*y;							/* edge k of row i is y[i*Nj+k], it is at pixel j=k-0.5, so pixel j lies between edges j and j+1 */
+	double	*z;							/* the x component is not stored, pixel_xyz_to_depth() never uses it */
+	unsigned long long key;				/* pixel_edges_key() when they were made, the scans of a batch with the same key re-use them */
+} ws_pixel_edges;
+
+
+typedef struct {						/* where the time went for one stripe, times are from a monotonic clock (seconds) */
+	int		ilo, ihi;					/* rows of the stripe */
+	int		jlo, jhi;					/* columns of the stripe that were read */
+	double	read;						/* readImageSet() */
+	double	difference;					/* get_difference_images() */
+	double	resolve;					/* the rest of depth_resolve() */
+	double	write;						/* write_depth_data() */
+	size_t	bytes_read;					/* bytes of image data read (uncompressed) */
+	size_t	bytes_written;				/* bytes of depth resolved data written (uncompressed) */
+	size_t	pixels;						/* active pixels depth resolved */
+	size_t	differences;				/* non-zero differences depth resolved */
+	size_t	deposits;					/* intensities added to a depth bin */
+} ws_stripe_metrics;
+
+typedef struct {						/* where the time went in processAll(), written as <outfile>metrics.json */
+	double	image_info;					/* getImageInfo() (seconds) */
+	double	intensity_map;				/* get_intensity_map(), reads the first image and finds the cutoff */
+	double	pixel_edges;				/* make_pixel_edges() */
+	double	metadata;					/* readScanMetadata() and cull_active_pixels() */
+	double	create_output;				/* writeAllHeaders() or writeStackFile() */
+	double	stripes;					/* the loop over all of the stripes */
+	double	total;						/* all of processAll() */
+	size_t	pixels_total;				/* pixels in the ROI */
+	size_t	pixels_above_cutoff;		/* pixels not skipped by the cutoff */
+	size_t	pixels_active;				/* pixels above the cutoff that can reach the output depths */
+	size_t	bytes_read;					/* totals of all stripes, and the intensity map */
+	size_t	bytes_written;
+	const char *kernel;					/* version of the wire depth kernel used */
+	int		Nstripes;
+	int		Nresumed;					/* first stripes that were already done by an earlier run, skipped with --resume */
+	ws_stripe_metrics *stripe;			/* Nstripes of them */
+} ws_run_metrics;
+
+typedef struct {						/* the progress journal <outfile>progress.txt, for --checkpoint and --resume */
+	unsigned long long key;				/* from progress_key(), identifies the input images, geometry, and settings */
+	size_t	chunk_rows;					/* rows in one band of the output images, this sets the stripes */
+	int		Ndone;						/* number of stripes written, they always finish in order */
+	int		*lo, *hi;					/* first and last row of each stripe done, Ndone of them */
+	long	Ndepths;					/* length of depth_intensity */
+	double	*depth_intensity;			/* image_set.depth_intensity summed over the stripes done */
+} ws_progress;
+
+
+
 typedef struct {
 	point_xyz centre_at_si_xyz;			/* PM500 coords that put wire center on the Si position (micron) */
 	double rotation[3][3];				/* rotation matrix for wire PM500 (from R00 through R22) */
@@ -99,6 +186,10 @@ typedef struct {
 	int current_selection_start;		/* i - indicates which section of the selection is being processed. */
 	int current_selection_end;
 	size_t rows_at_one_time;			/* number of rows that can be processed at one time, the maximum width of one stripe */
+	size_t memory_budget;				/* bytes of RAM the stripes were sized for, either from -m or automatic */
+	size_t stripe_bytes;				/* bytes allocated for the stripes */
+	int Nstripes;						/* number of stripes actually processed */
+	size_t chunk_rows;					/* rows in one chunk of the output images, a stripe never spans two bands of chunks */
 
 	int NinputImages;					/* number of input images taken during a single wire scan */
 
@@ -15,6 +15,7 @@
 
 double distance(point_xyz a, point_xyz b);
 int compare_double(double *a, double *b);
+double select_kth_double(double *a, size_t n, size_t k);
 int rotationMatFromAxis(point_xyz axis, double angle, double mat[3][3]);
 double determinant33(double a[3][3]);
 point_xyz MatrixMultiply31(double a[3][3], point_xyz v);
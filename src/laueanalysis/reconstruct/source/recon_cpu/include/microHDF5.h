@@ -22,6 +22,10 @@
 #ifndef MIN
 #define MIN(X,Y) ( ((X)>(Y)) ? (Y) : (X) )
 #endif
+#define HDF5_CACHE_MAX 512				/* max number of input files kept open by HDF5cacheSetSize() */
+#ifdef H5_HAVE_PARALLEL
+#define HDF5_PARALLEL_DEFLATE H5_VERSION_GE(1,14,0)	/* true if compressed chunks can be written collectively, older parallel HDF5 can not */
+#endif
 #ifndef ERROR_PATH
 #define ERROR_PATH(A) { err=(A); goto error_path; }
 #endif
@@ -53,6 +57,7 @@ struct HDF5_Header {
 /*	int		geo_rotate;		// geometric effect applied, rotate */
 /*	int		geo_reverse;	// geometric effect applied, reverse */
 /*	int		geo_flip;		// geometric effect applied, flipped */
+	size_t	Nimages;		/* number of images stored together, data is [Nimages][xdim][ydim] when more than 1 */
 	double	gain;			/* actually capacitance (pF) */
 	double	exposure;		/* exposure time (seconds) */
 	char	bkgFile[MAX_micro_STRING_LEN+1];	/* name of possible background file */
@@ -106,13 +111,24 @@ int HDF5WriteROI(const char *fileName, const char *dataName, void *vbuf, size_t
 //int HDF5WriteROI(const char *fileName, const char *dataName, void *vbuf, size_t xlo, size_t xhi, size_t ylo, size_t yhi, struct HDF5_Header *head);
 int HDF5ReadROI(const char *fileName, const char *dataName, void **vbuf, size_t xlo, size_t xhi, size_t ylo, size_t yhi, struct HDF5_Header *head);
 int HDF5ReadROIdouble(const char *fileName, const char *dataName, double **vbuf, size_t xlo, size_t xhi, size_t ylo, size_t yhi, struct HDF5_Header *head);
-int createNewData(const char *fileName, const char *dataName, int rank, int *dims, int dataType);
+int HDF5ReadROIstep(const char *fileName, const char *dataName, void *vbuf, hid_t memType, size_t memX, size_t memY, size_t Nsteps, size_t step, size_t xlo, size_t xhi, size_t ylo, size_t yhi, struct HDF5_Header *head);
+int HDF5ReadROIframes(const char *fileName, const char *dataName, void *vbuf, hid_t memType, size_t memX, size_t memY, size_t Nsteps, size_t step, size_t frame, size_t Nframes, size_t xlo, size_t xhi, size_t ylo, size_t yhi, struct HDF5_Header *head);
+int readHDF5frameVector(const char *fileName, const char *dataName, double *v, size_t frame, size_t N);
+int createNewData(const char *fileName, const char *dataName, int rank, int *dims, hid_t dataType, int *chunk, int deflate);
+hid_t createNewStack(hid_t file_id, const char *dataName, size_t Nslices, size_t xdim, size_t ydim, hid_t dataType, size_t chunk_rows, int deflate);
+int HDF5WriteSlice(hid_t data_id, size_t slice, void *vbuf, size_t xlo, size_t xhi, size_t ylo, size_t yhi, hid_t memType);
+#ifdef H5_HAVE_PARALLEL
+int HDF5WriteSliceCollective(hid_t data_id, size_t slice, void *vbuf, size_t xlo, size_t xhi, size_t ylo, size_t yhi, hid_t memType);
+#endif
 int readHDF5header(const char *fileName, struct HDF5_Header *head);
 int printHeader(struct HDF5_Header *h);
 double readHDF5oneValue(const char *fileName, const char *dataName);
 double readHDF5oneHeaderValue(struct HDF5_Header *head, char *name);
 herr_t writeDepthInFile(const char *fileName, double depth);
 herr_t deleteDataFromFile(hid_t file_id, char *groupName, char *dataName);
+int copyHDF5metadata(const char *source, const char *dest, const char **skip, size_t Nframes);
+void HDF5cacheSetSize(int N);
+void HDF5cacheForget(const char *fileName);
 
 char *getFileTypeString(int itype, char *stype);
 hid_t getHDFtype(int itype);
@@ -15,5 +15,10 @@ void geo2calibration(struct geoStructure *geo, int detector);
 void writeSummaryHead(FILE *f, char *infile, char *outfile, char *geofile, double depth_start, double depth_end, double resolution, \
 	int first_image, int last_image, int out_pixel_type, int wireEdge, char *normalization, char *depthCorrectStr);
 void writeSummaryTail(FILE *f, double seconds);
+double monotonicSeconds(void);
+void cpuSeconds(double cpu[2]);
+int writeMetricsFile(char *fileName, char *infile, char *outfile, char *geofile, double seconds, double cpu0[2]);
 int getParentPath(char *path);
+size_t autoMemoryBudget(void);
+int threadCount(int n);
 
@@ -0,0 +1,14 @@
+/*
+ *  wireGeometry.h
+ *  reconstruct
+ *
+ *  the geometry of the wire scan, pixel and wire positions in beam line coordinates, and depth of the ray tangent to the wire
+ *
+ */
+
+#include "WireScan.h"				/* BOOLEAN */
+
+point_xyz pixel_to_point_xyz(point_ccd pixel);
+double pixel_xyz_to_depth(point_xyz point_on_ccd_xyz, point_xyz wire_position, BOOLEAN use_leading_wire_edge);
+double edge_yz_to_depth(double pixel_y, double pixel_z, point_xyz wire_position, BOOLEAN use_leading_wire_edge);
+point_xyz wirePosition2beamLine(point_xyz wire_pos);
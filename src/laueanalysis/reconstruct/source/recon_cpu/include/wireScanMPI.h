@@ -0,0 +1,27 @@
+/*
+ *  wireScanMPI.h
+ *  reconstruct
+ *
+ *  sharing the rows of one wire scan among MPI ranks, only used when built with -DUSE_MPI
+ *
+ */
+
+#ifndef wireScanMPIHeader
+#define wireScanMPIHeader
+
+#ifdef USE_MPI
+#include <mpi.h>
+
+void mpiStartup(int *argc, char ***argv);
+void mpiShutdown(void);
+int mpiRanksOnNode(void);
+void mpiAssignStripes(int Nstripes, int *lo, int *hi, size_t *row_start, int *kfirst, int *klast);
+int mpiMaxInt(int n);
+void mpiBarrier(void);
+void mpiWriteTurnBegin(void);
+void mpiWriteTurnEnd(void);
+void mpiWriteTurnsDone(void);
+void mpiSumDepthIntensity(double *v, int N);
+#endif
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ *  wire_depth_kernel.h
+ *  reconstruct
+ *
+ *  depth of the ray tangent to the wire, for one pixel edge and all of the wire positions of a scan
+ *
+ */
+
+#include "WireScanDataTypesN.h"
+
+void edge_depths_all_steps(double pixel_y, double pixel_z, const double *wire_y, const double *wire_z, size_t N, double radius, point_xyz ki, int use_leading_wire_edge, double *depth);
+void edge_depths_both_all_steps(double pixel_y, double pixel_z, const double *wire_y, const double *wire_z, size_t N, double radius, point_xyz ki, double *lead, double *trail);
+const char *edge_depths_init(void);
@@ -4,19 +4,28 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "mathUtil.h"
 #include "microHDF5.h"
 #include "WireScanDataTypesN.h"
 #include "WireScan.h"
+#include "wire_depth_kernel.h"
+#include "wireGeometry.h"
 #include "readGeoN.h"
 #include "misc.h"
 #include "depth_correction.h"
+#include "wireScanMPI.h"
 
 #define TYPICAL_mA		102.		/* average current, used with normalization */
 #define TYPICAL_cnt3	88100.		/* average value of cnt3, used with normalization */
+#define FRAME_BLOCK_MiB	64			/* most temporary memory used to read a block of frames from a stack of images (MiB) */
 
 const long MiB = (1<<20);					/* 2^20, one mega byte */
 /* const int REVERSE_X_AXIS = 0;			// set to non-zero value to flip x axis - double-check */
@@ -28,25 +37,44 @@ const long MiB = (1<<20);					/* 2^20, one mega byte */
 int main (int argc, const char **argv);
 int start(char* infile, char* outfile, char* geofile, double depth_start, double depth_end, double resolution, int first_image, int last_image, \
 	int out_pixel_type, int wireEdge, char* normalization, char* depthCorrectStr);
+int startBatch(char* manifest, char* geofile, double resolution, int out_pixel_type, int wireEdge, char* normalization, char* depthCorrectStr);
+gsl_matrix_float *setupGeometry(char* geofile, char* depthCorrectStr);
+int processScan(char* infile, char* outfile, char* geofile, double depth_start, double depth_end, double resolution, int first_image, int last_image, \
+	int out_pixel_type, int wireEdge, char* normalization, char* depthCorrectStr, gsl_matrix_float *depthCorrectMap);
+void finishScans(void);
 void printHelpText(void);
 void processAll( int file_num_start, int file_num_end, char* fn_base, char* fn_out_base, char* normalization, gsl_matrix_float * depthCorrectMap);
-void readSingleImage(char* filename, int imageIndex, int ilow, int ihi, int jlow, int jhi, char* normalization);
-int find_first_valid_i(int i1, int i2, int jlo, int jhi, point_xyz wire, BOOLEAN use_leading_wire_edge);
-int find_last_valid_i(int i1, int i2, int jlo, int jhi, point_xyz wire, BOOLEAN use_leading_wire_edge);
-point_xyz wirePosition2beamLine(point_xyz wire_pos);
+void readSingleImage(char* filename, int imageIndex, int ilow, int ihi, int jlow, int jhi, stepstripe *stripe);
+void readImageStack(char* filename, int first_frame, int Nframes, int ilow, int ihi, int jlow, int jhi, stepstripe *stripe);
+void readFrameWirePositions(char* filename, int first_frame, int Nframes, point_xyz *wire);
 
 /* File I/O */
 void getImageInfo(char* fn_base, int file_num_start, int file_num_end);
 void get_intensity_map(char* filename_base, int file_num_start);
-void readImageSet(char* fn_base, int ilow, int ihi, int jlow, int jhi, int file_num_start, int file_num_end, char* normalization);
+int intensity_cutoff(const double *v, size_t N, size_t kth);
+void make_active_pixels(void);
+void cull_active_pixels(void);
+void delete_active_pixels(void);
+void readScanMetadata(char* fn_base, int file_num_start, int file_num_end, char* normalization);
+void readImageSet(char* fn_base, int ilow, int ihi, int jlow, int jhi, int file_num_start, int file_num_end, stepstripe *stripe);
+void *readImageSet_thread(void *job);
+void *write_depth_data_thread(void *job);
 void writeAllHeaders(char* fn_in_first, char* fn_out_base, int file_num_start, int file_num_end);
 void write1Header(char* finalTemplate, char* fn_base, int file_num);
-void write_depth_data(size_t start_i, size_t end_i, char* fn_base);
-void write_depth_datai(int file_num, size_t start_i, size_t end_i, char* fileName);
+void writeStackFile(char* fn_in_first, char* fn_out_base);
+void openStackFile(char* fn_out_base);
+void closeStackFile(void);
+void write_turn_begin(char* fn_out_base);
+void write_turn_end(void);
+size_t write_depth_data(size_t start_i, size_t end_i, char* fn_base, stepstripe *stripe, double *image);
+size_t write_depth_datai(int file_num, size_t start_i, size_t end_i, char* fileName, stepstripe *stripe, double *image);
 
 /* image memory and image manipulation */
 void setup_depth_images(int numImages);
-void clear_depth_images(ws_image_set *is);
+void alloc_stepstripe(stepstripe *stripe, size_t rows, size_t cols, size_t n);
+void clear_stepstripe(stepstripe *stripe);
+void add_stepstripe_compensation(stepstripe *stripe);
+void free_stepstripe(stepstripe *stripe);
 void delete_images(void);
 void get_difference_images(void);
 void add_pixel_intensity_at_depth(point_ccd pixel, double intensity, double depth);
@@ -56,15 +84,80 @@ void add_pixel_intensity_at_index(size_t i, size_t j, double intensity, long ind
 /* actual calculations */
 double index_to_beam_depth(long index);
 double get_trapezoid_height(double partial_start, double partial_end, double full_start, double full_end, double depth);
-point_xyz pixel_to_point_xyz(point_ccd pixel);
-double pixel_xyz_to_depth(point_xyz point_on_ccd_xyz, point_xyz wire_position, BOOLEAN use_leading_wire_edge);
-void depth_resolve(int i_start, int i_stop);
+void make_pixel_edges(void);
+void delete_pixel_edges(void);
+int read_pixel_edges(char *fileName, unsigned long long key);
+void write_pixel_edges(char *fileName, unsigned long long key);
+unsigned long long pixel_edges_key(void);
+unsigned long long progress_key(char *fn_base, int file_num_start, int file_num_end, char *normalization);
+int read_progress(char *fileName, unsigned long long key, ws_progress *p);
+int write_progress(char *fileName, unsigned long long key, size_t chunk_rows, int Ndone, int *lo, int *hi, double *depth_intensity);
+void free_progress(ws_progress *p);
+int check_output_headers(char *fn_out_base);
+void depth_resolve(int i_start, int i_stop, ws_stripe_metrics *metrics);
+void add_stripe_depth_intensity(size_t rows);
 //inline void depth_resolve_pixel(double pixel_intensity, point_ccd pixel, point_xyz point, point_xyz next_point, point_xyz wire_position_1, point_xyz wire_position_2, BOOLEAN use_leading_wire_edge);
 //inline void depth_resolve_pixel(double pixel_intensity, size_t i, size_t j, point_xyz point, point_xyz next_point, point_xyz wire_position_1, point_xyz wire_position_2, BOOLEAN use_leading_wire_edge);
-void depth_resolve_pixel(double pixel_intensity, size_t i, size_t j, point_xyz point, point_xyz next_point, point_xyz wire_position_1, point_xyz wire_position_2, BOOLEAN use_leading_wire_edge);
+typedef struct {						/* intensity vs depth of one differenced step of one pixel, for one edge of the wire */
+	double	partial_start;				/* depth where partial intensity begins (micron) */
+	double	full_start;					/* depth where full pixel intensity begins (micron) */
+	double	full_end;					/* depth where full pixel intensity ends (micron) */
+	double	partial_end;				/* depth where partial pixel intensity ends (micron) */
+	double	area;						/* area of trapezoid assuming a height of 1 */
+	double	intensity;					/* intensity to spread over the trapezoid, sign already set for the wire edge */
+	long	start_index, end_index;		/* range of depth-resolved images that it overlaps */
+	BOOLEAN	ordered;					/* true if partial_start <= full_start <= full_end <= partial_end, then the cdf is used */
+	double	up, down;					/* 1/(2*width) of the sloping up and down parts, 0 if a part has no width */
+	double	cdf_low;					/* cumulative area up to the low edge of the next bin to deposit */
+} depth_trapezoid;
+int make_depth_trapezoid(double pixel_intensity, const double *back_depth, const double *front_depth, BOOLEAN use_leading_wire_edge, depth_trapezoid *t);
+double depth_trapezoid_cdf(const depth_trapezoid *t, double depth);
+double depth_trapezoid_next_bin(depth_trapezoid *t, long m);
+double depth_trapezoid_in_bin(const depth_trapezoid *t, long m);
+long depth_resolve_pixel(double pixel_intensity, size_t i, size_t j, const double *back_depth, const double *front_depth, BOOLEAN use_leading_wire_edge);
+long depth_resolve_pixel_both_edges(double pixel_intensity, size_t i, size_t j, const double *back_lead, const double *front_lead, const double *back_trail, const double *front_trail);
 void print_imaging_parameters(ws_imaging_parameters ip);
 
 
+/* the HDF5 library is not thread safe, so in the pipelined mode (-P) all HDF5 calls by the reading and writing threads are done holding this lock */
+pthread_mutex_t hdf5_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HDF5_LOCK pthread_mutex_lock(&hdf5_lock);
+#define HDF5_UNLOCK pthread_mutex_unlock(&hdf5_lock);
+
+/* in the single output file mode (-S), the output file and its 3D data set stay open for the whole run */
+hid_t	stack_file_id=0;
+hid_t	stack_data_id=0;
+
+/* the second stripes and output image used by PIPELINE_IO, image_set has the first ones, kept for the next scan of a batch (-B) */
+stepstripe	pipe_scanned, pipe_resolved;
+dvector		pipe_image;
+
+/* with MPI and a parallel HDF5 library, all ranks keep the single output file open and write into it together (collectively) */
+/* otherwise, the ranks take turns writing their stripes with serial HDF5 */
+#if defined(USE_MPI) && defined(H5_HAVE_PARALLEL)
+#define STACK_COLLECTIVE (NRANKS > 1 && SINGLE_OUTPUT_FILE)
+#else
+#define STACK_COLLECTIVE 0
+#endif
+
+typedef struct {						/* arguments for readImageSet_thread() */
+	char	*fn_base;
+	int		ilow, ihi;					/* rows of the stripe */
+	int		jlow, jhi;					/* columns of the stripe that have active pixels */
+	int		file_num_start, file_num_end;
+	stepstripe *stripe;					/* where to put the stripe */
+	ws_stripe_metrics *metrics;			/* gets the time used */
+} read_stripe_job;
+
+typedef struct {						/* arguments for write_depth_data_thread() */
+	size_t	start_i, end_i;				/* rows of the stripe */
+	char	*fn_base;
+	stepstripe *stripe;					/* depth resolved stripe to write */
+	double	*image;						/* space for one output image of the stripe */
+	ws_stripe_metrics *metrics;			/* gets the time used and bytes written */
+} write_stripe_job;
+
+
 #ifdef DEBUG_ALL					/* temp debug variable for JZT */
 int slowWay=0;						/* true if found reading stripes the slow way */
 int verbosePixel=0;
@@ -94,8 +187,9 @@ int main (int argc, const char *argv[]) {
 	char	geofile[FILENAME_MAX];
 	char	paramfile[FILENAME_MAX];
 	char	normalization[FILENAME_MAX];	/* if empty, then do not normalize */
+	char	manifest[FILENAME_MAX];			/* if not empty, reconstruct each of the scans listed in this file */
 
-	infile[0] = outfile[0] = geofile[0] = paramfile[0] = normalization[0] = '\0';
+	infile[0] = outfile[0] = geofile[0] = paramfile[0] = normalization[0] = manifest[0] = '\0';
 	double	depth_start = 0.;
 	double	depth_end = 0.;
 	double	resolution = 1;
@@ -110,14 +204,27 @@ int main (int argc, const char *argv[]) {
 #endif
 
 	/* initialize some globals */
+	RANK = 0;								/* one process, unless started by mpirun with USE_MPI */
+	NRANKS = 1;
+#ifdef USE_MPI
+	mpiStartup(&argc, (char ***)&argv);		/* sets RANK and NRANKS */
+#endif
 	geoIn.wire.axis[0]=1; geoIn.wire.axis[0]=geoIn.wire.axis[0]=0;	/* default wire.axis is {1,0,0} */
 	geoIn.wire.R[0] = geoIn.wire.R[1] = geoIn.wire.R[2] = 0;		/* default PM500 rotation of wire is 0 */
 	distortionPath[0] = '\0';				/* start with it empty */
 	depthCorrectStr[0] = '\0';				/* start with it empty */
+	edgeCachePath[0] = '\0';				/* start with it empty, do not cache the pixel edges */
 	verbose = 0;
 	percent = 100;
 	cutoff = 0;
-	AVAILABLE_RAM_MiB = 128;
+	AVAILABLE_RAM_MiB = 0;					/* automatic, size stripes from the free memory unless -m is given */
+	NUM_THREADS = 1;						/* single threaded unless -N is given */
+	PIPELINE_IO = 0;						/* read, depth resolve, and write one after the other unless -P is given */
+	SINGLE_OUTPUT_FILE = 0;					/* one output file for each depth unless -S is given */
+	COMPRESS_LEVEL = 1;						/* fast compression of the output images, -z 0 turns it off */
+	CHECKPOINT = 0;							/* no progress journal unless -c or -R is given */
+	RESUME = 0;								/* start from the first stripe unless -R is given */
+	MULTI_FRAME_FILE = 0;					/* one image per input file, unless getImageInfo() finds that infile is a stack of frames */
 	detNum = 0;								/* detector number */
 #ifdef DEBUG_ALL
 	getParentPath(ApplicationsPath);
@@ -141,9 +248,17 @@ int main (int argc, const char *argv[]) {
 			{"percent-to-process",	required_argument,		0,	'p'},
 			{"wire-edges",			required_argument,		0,	'w'},
 			{"memory",				required_argument,		0,	'm'},
+			{"threads",				required_argument,		0,	'N'},
+			{"pipeline",			no_argument,			0,	'P'},
+			{"single-file",			no_argument,			0,	'S'},
+			{"compress",			required_argument,		0,	'z'},
+			{"checkpoint",			no_argument,			0,	'c'},
+			{"resume",				no_argument,			0,	'R'},
+			{"batch",				required_argument,		0,	'B'},
 			{"type-output-pixel",	required_argument,		0,	't'},
 			{"distortion_map",		required_argument,		0,	'd'},
 			{"detector_number",		required_argument,		0,	'D'},
+			{"edge-cache",			required_argument,		0,	'C'},
 			{"wireDepths",			required_argument,		0,	'W'},
 			{"Parameters File",		required_argument,		0,	'F'},
 			{"ignore",				optional_argument,		0,	'@'},
@@ -153,7 +268,7 @@ int main (int argc, const char *argv[]) {
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		c = getopt_long (argc, (char * const *)argv, "i:o:g:s:e:r:v:f:l:n:p:w:m:t:d:D:W:F:@::h::", long_options, &option_index);
+		c = getopt_long (argc, (char * const *)argv, "i:o:g:s:e:r:v:f:l:n:p:w:m:N:PSz:cRB:t:d:D:W:C:F:@::h::", long_options, &option_index);
 
 		/* Detect the end of the options.  */
 		if (c == -1)
@@ -220,8 +335,48 @@ int main (int argc, const char *argv[]) {
 				break;
 
 			case 'm':
-				AVAILABLE_RAM_MiB = atoi(optarg);
-				AVAILABLE_RAM_MiB = MAX(AVAILABLE_RAM_MiB,1);
+				if (!strcmp(optarg,"auto")) AVAILABLE_RAM_MiB = 0;	/* "auto" or 0 means automatic */
+				else {
+					char	*end;
+					long	nMiB = strtol(optarg,&end,10);
+					if (end==optarg || *end || nMiB<0 || nMiB>INT_MAX) {
+						error("-m switch needs to be followed by a number of MiB, or 'auto' (e.g. -m 4096, not -m 4G)\n");
+						exit(1);
+						return 1;
+					}
+					AVAILABLE_RAM_MiB = (int)nMiB;
+				}
+				break;
+
+			case 'N':
+				NUM_THREADS = threadCount(atoi(optarg));	/* if input <=0, use all of the processors but one */
+				break;
+
+			case 'P':
+				PIPELINE_IO = 1;
+				break;
+
+			case 'S':
+				SINGLE_OUTPUT_FILE = 1;
+				break;
+
+			case 'z':
+				COMPRESS_LEVEL = atoi(optarg);
+				COMPRESS_LEVEL = MIN(MAX(COMPRESS_LEVEL,0),9);
+				break;
+
+			case 'c':
+				CHECKPOINT = 1;
+				break;
+
+			case 'R':
+				RESUME = CHECKPOINT = 1;					/* keep the journal going while resuming */
+				break;
+
+			case 'B':
+				strncpy(manifest,optarg,FILENAME_MAX-2);
+				manifest[FILENAME_MAX-1] = '\0';			/* strncpy may not terminate */
+				required = required | (1<<0) | (1<<1) | (1<<3);	/* each line of the manifest has the infile, outfile, and depths */
 				break;
 
 			case 't':
@@ -270,6 +425,11 @@ int main (int argc, const char *argv[]) {
 				strncpy(depthCorrectStr,optarg,1022);
 				depthCorrectStr[1023-1] = '\0';				/* strncpy may not terminate */
 				break;
+
+			case 'C':
+				strncpy(edgeCachePath,optarg,1022);
+				edgeCachePath[1023-1] = '\0';				/* strncpy may not terminate */
+				break;
 				
 			case '@':				/* a do nothing, just skip */
 				break;
@@ -298,20 +458,32 @@ int main (int argc, const char *argv[]) {
 		error("some required -D detector number must be 0, 1, or 2\n");
 		exit(1);
 	}
+	if (NRANKS > 1) {										/* ranks share the rows of the scan */
+		if (RANK == 0 && (PIPELINE_IO || CHECKPOINT)) printf("\nwith %d MPI ranks, -P, -c, and -R are not used\n",NRANKS);
+		PIPELINE_IO = CHECKPOINT = RESUME = 0;
+		if (RANK) verbose = 0;								/* only rank 0 talks */
+	}
 
 	if (verbose > 0) {
 		time_t systime;
 		systime = time(NULL);
 
 		printf("\nStarting execution at %s\n",ctime(&systime));
-		printf("infile = '%s'",infile);
-		printf("\noutfile = '%s'",outfile);
+		if (manifest[0]) printf("batch of scans listed in '%s'",manifest);
+		else {
+			printf("infile = '%s'",infile);
+			printf("\noutfile = '%s'",outfile);
+		}
 		printf("\ngeofile = '%s'",geofile);
 		printf("\ndistortion map = '%s'",distortionPath);
 		if (depthCorrectStr[0]) printf("\ndepthCorrect = '%s'",depthCorrectStr);
+		if (edgeCachePath[0]) printf("\npixel edge cache = '%s'",edgeCachePath);
 		if (paramfile[0]) printf("\nparamFile = '%s'",paramfile);
-		printf("\ndepth range = [%g, %g]micron with resolution of %g micron",depth_start,depth_end,resolution);
-		printf("\nimage index range = [%d, %d]  using %g%% of pixels",first_image,last_image,percent);
+		if (manifest[0]) printf("\ndepth resolution of %g micron,  using %g%% of pixels",resolution,percent);
+		else {
+			printf("\ndepth range = [%g, %g]micron with resolution of %g micron",depth_start,depth_end,resolution);
+			printf("\nimage index range = [%d, %d]  using %g%% of pixels",first_image,last_image,percent);
+		}
 		if (normalization[0]) printf("\nnormalizing by value in tag:  '%s'",normalization);
 		else printf("\nnot normalizing");
 
@@ -319,26 +491,37 @@ int main (int argc, const char *argv[]) {
 		else if (wireEdge) printf("\nusing only leading edge of wire (the usual)");
 		else printf("\nusing oly TRAILING edge of wire");
 		if (out_pixel_type >= 0) printf("\nwriting output images as type long");
-		printf("\nusing %dMiB of RAM, and verbose = %d",AVAILABLE_RAM_MiB,verbose);
+		if (AVAILABLE_RAM_MiB > 0) printf("\nusing %dMiB of RAM, and verbose = %d",AVAILABLE_RAM_MiB,verbose);
+		else printf("\nusing RAM based on free memory, and verbose = %d",verbose);
+		if (NUM_THREADS > 1) printf("\ndepth resolving with %d threads",NUM_THREADS);
+		if (PIPELINE_IO) printf("\nreading and writing stripes while depth resolving");
+		if (SINGLE_OUTPUT_FILE) printf("\nwriting all depths into the single file '%s.h5'",manifest[0] ? "<outfile>" : outfile);
+		if (NRANKS > 1) printf("\nsharing the rows among %d MPI ranks",NRANKS);
+		if (RESUME) printf("\nresuming from the progress journal '%sprogress.txt'",manifest[0] ? "<outfile>" : outfile);
+		else if (CHECKPOINT) printf("\nrecording the stripes done in '%sprogress.txt'",manifest[0] ? "<outfile>" : outfile);
 		printf("\n\n");
 	}
 	fflush(stdout);
 
-	start(infile, outfile, geofile, depth_start, depth_end, resolution, first_image, last_image, out_pixel_type, wireEdge, normalization, depthCorrectStr);
+	if (manifest[0]) startBatch(manifest, geofile, resolution, out_pixel_type, wireEdge, normalization, depthCorrectStr);
+	else start(infile, outfile, geofile, depth_start, depth_end, resolution, first_image, last_image, out_pixel_type, wireEdge, normalization, depthCorrectStr);
 
 	if (verbose) {
 		time_t systime;
 		systime = time(NULL);
 		printf("\nExecution ended at %s",ctime(&systime));
 	}
+#ifdef USE_MPI
+	mpiShutdown();
+#endif
 	return 0;
 }
 
 
 void printHelpText(void)
 {
-	printf("\nUsage: WireScan -i <file> -o <file> -g <file> [-s <\x23>] -e <\x23> [-r <\x23>] [-v <\x23>] [-f <\x23>] -l <\x23> [-p <\x23>]  [-t <\x23>]  [-m <\x23>] [-?] \n\n");
-	printf("\n-i <file>,\t --infile=<file>\t\tlocation and leading section of file names to process");
+	printf("\nUsage: WireScan -i <file> -o <file> -g <file> [-s <\x23>] -e <\x23> [-r <\x23>] [-v <\x23>] [-f <\x23>] -l <\x23> [-p <\x23>]  [-t <\x23>]  [-m <\x23>] [-N <\x23>] [-P] [-S] [-c] [-R] [-B <file>] [-z <\x23>] [-W <file>] [-C <file>] [-?] \n\n");
+	printf("\n-i <file>,\t --infile=<file>\t\tlocation and leading section of file names to process, or one .h5 file with all images as frames");
 	printf("\n-o <file>,\t --outfile=<file>\t\tlocation and leading section of file names to create");
 	printf("\n-g <file>,\t --geofile=<file>\t\tlocation of file containing parameters from the wirescan");
 	printf("\n-d <file>,\t --distortion map=<file>\tlocation of file with the distortion map, dXYdistortion");
@@ -346,14 +529,23 @@ void printHelpText(void)
 	printf("\n-e <\x23>,\t\t --depth-end=<\x23>\t\tdepth to stop recording values at - inclusive");
 	printf("\n-r <\x23>,\t\t --resolution=<\x23>\t\tum depth covered by a single depth-resolved image");
 	printf("\n-v <\x23>,\t\t --verbose=<\x23>\t\t\toutput detailed output of varying degrees (0, 1, 2, 3)");
-	printf("\n-f <\x23>,\t\t --first-image=<\x23>\t\tnumber of first image to process - inclusive");
-	printf("\n-l <\x23>,\t\t --last-image=<\x23>\t\tnumber of last image to process - inclusive");
+	printf("\n-f <\x23>,\t\t --first-image=<\x23>\t\tnumber of first image (or frame) to process - inclusive");
+	printf("\n-l <\x23>,\t\t --last-image=<\x23>\t\tnumber of last image (or frame) to process - inclusive");
 	printf("\n-n <tag>,\t --normalization=<tag>\t\ttag of variable in header to use for normalizing incident intensity, optional");
 	printf("\n-p <\x23>,\t\t --percent-to-process=<\x23>\tonly process the p%% brightest pixels in image");
 	printf("\n-w <l,t,b>,\t --wire-edges\t\t\tuse leading, trailing, or both edges of wire, (for both, output images will then be longs)");
 	printf("\n-t <\x23>,\t\t --type-output-pixel=<\x23>\ttype of output pixel (uses old WinView numbers), optional");
-	printf("\n-m <\x23>,\t\t --memory=<\x23>\t\t\tdefine the amount of memory in MiB that the programme is allowed to use");
+	printf("\n-m <\x23>,\t\t --memory=<\x23>\t\t\tdefine the amount of memory in MiB that the programme is allowed to use, 0 or 'auto' uses the free memory less some headroom (default is auto)");
+	printf("\n-N <\x23>,\t\t --threads=<\x23>\t\tnumber of threads used for depth resolving, <=0 uses all but one processor (default is 1)");
+	printf("\n-P,\t\t --pipeline\t\t\tread the next stripe and write the previous one while depth resolving, uses twice the stripe memory");
+	printf("\n-S,\t\t --single-file\t\t\twrite one file <outfile>.h5 holding all depths in a 3D data set [depth][x][y], instead of one file per depth");
+	printf("\n-c,\t\t --checkpoint\t\t\tafter each stripe is written and synced to disk, record it in the progress journal <outfile>progress.txt");
+	printf("\n-R,\t\t --resume\t\t\tcontinue an interrupted run with the same arguments, skipping the stripes in the progress journal (implies -c)");
+	printf("\n-B <file>,\t --batch=<file>\t\t\treconstruct many scans in this one process, each line of the file is:  infile first last outfile depth_start depth_end");
+	printf("\n\t\t\t\t\t\treplaces -i -o -f -l -s -e, the other options are used for every scan, lines starting with '#' are skipped");
+	printf("\n-z <\x23>,\t\t --compress=<\x23>\t\tdeflate level [0,9] of the output images, 0 is no compression (default is 1)");
 	printf("\n-W <file>,\t --wireDepths=<file>\t\tfile with depth corrections for each pixel");
+	printf("\n-C <file>,\t --edge-cache=<file>\t\tfile to save the pixel edge positions, re-used when the geometry and ROI are unchanged");
 	printf("\n-?,\t\t --help\t\t\t\tdisplay this help");
 	printf("\n\n");
 	printf("Example: WireScan -i /images/image_ -o /result/image_ -g /geo/file -s 0 -e 100 -r 1 -v 1 -f 1 -l 401 -p 1\n\n");
@@ -375,11 +567,78 @@ int start(
 	char *normalization,			/* optional tag for normalization */
 	char* depthCorrectStr)			/* optional name of file with depth corrections for each pixel */
 {
-	double	seconds;				/* seconds of CPU time used */
-	time_t	executionTime;			/* number of seconds since program started */
-	clock_t	tstart = clock();		/* clock() provides cpu usage, not total elapsed time */
-	time_t	sec0 = time(NULL);		/* time (since EPOCH) when program starts */
-	int		err=0;
+	gsl_matrix_float * depthCorrectMap=NULL;
+	depthCorrectMap = setupGeometry(geofile, depthCorrectStr);
+	processScan(infile, outfile, geofile, depth_start, depth_end, resolution, first_image, last_image, out_pixel_type, wireEdge, normalization, depthCorrectStr, depthCorrectMap);
+	finishScans();
+	return 0;
+}
+
+
+/* batch mode (-B), reconstruct each scan listed in the manifest file in this one process, a scan on each line:  */
+/*		<infile> <first image> <last image> <outfile> <depth start> <depth end> */
+/* blank lines and lines starting with '#' are skipped, all of the other settings come from the command line and are the same for every scan */
+/* the geometry is read once, and the pixel edges and the space for the stripes are re-used by the next scan when they fit it */
+int startBatch(
+	char *manifest,					/* file with one scan on each line */
+	char *geofile,					/* full path to geometry file */
+	double resolution,				/* depth resolution (micron) */
+	int out_pixel_type,				/* type to use for the output pixel */
+	int wireEdge,					/* 1=leading edge of wire, 0=trailing edge of wire, -1=both edges */
+	char *normalization,			/* optional tag for normalization */
+	char* depthCorrectStr)			/* optional name of file with depth corrections for each pixel */
+{
+	FILE	*f=NULL;
+	char	line[FILENAME_MAX];		/* one line of the manifest, so neither file name can be longer than FILENAME_MAX */
+	char	infile[FILENAME_MAX];
+	char	outfile[FILENAME_MAX];
+	char	errStr[FILENAME_MAX+256];
+	char	*p;
+	int		first_image, last_image;
+	double	depth_start, depth_end;
+	int		lineNum=0, Nscans=0;
+	double	t0 = monotonicSeconds();
+	gsl_matrix_float * depthCorrectMap=NULL;
+
+	if (!(f=fopen(manifest, "r"))) { printf("\nERROR -- startBatch(), failed to open the manifest '%s'\n\n",manifest); exit(1); }
+	depthCorrectMap = setupGeometry(geofile, depthCorrectStr);
+
+	while (fgets(line, FILENAME_MAX, f)) {
+		lineNum++;
+		if (!strchr(line,'\n') && !feof(f)) {
+			sprintf(errStr,"startBatch(), line %d of '%s' is too long",lineNum,manifest);
+			error(errStr);
+			exit(1);
+		}
+		for (p=line; *p==' ' || *p=='\t' || *p=='\r' || *p=='\n'; p++) ;
+		if (!*p || *p=='#') continue;							/* blank line or comment */
+		if (sscanf(p,"%s %d %d %s %lf %lf",infile,&first_image,&last_image,outfile,&depth_start,&depth_end) != 6) {
+			sprintf(errStr,"startBatch(), line %d of '%s' should be:  infile first_image last_image outfile depth_start depth_end",lineNum,manifest);
+			error(errStr);
+			exit(1);
+		}
+		Nscans++;
+		if (verbose > 0) {
+			printf("\n\n*** scan %d (line %d of '%s')",Nscans,lineNum,manifest);
+			printf("\ninfile = '%s',  image index range = [%d, %d]",infile,first_image,last_image);
+			printf("\noutfile = '%s',  depth range = [%g, %g]micron",outfile,depth_start,depth_end);
+			fflush(stdout);
+		}
+		processScan(infile, outfile, geofile, depth_start, depth_end, resolution, first_image, last_image, out_pixel_type, wireEdge, normalization, depthCorrectStr, depthCorrectMap);
+	}
+	fclose(f);
+	finishScans();
+	if (verbose) printf("\n\nreconstructed %d scans from '%s' in %.1f sec",Nscans,manifest,monotonicSeconds() - t0);
+	return 0;
+}
+
+
+/* things that are the same for every scan, read the geometry, the depth correction map and the distortion maps, and start with no images */
+gsl_matrix_float *setupGeometry(
+	char *geofile,					/* full path to geometry file */
+	char* depthCorrectStr)			/* optional name of file with depth corrections for each pixel */
+{
+	int err=0;
 
 	if (strlen(geofile)<1) { }								/* skip if no geo file specified, could have been entered via -F command line flag */
 	else if (!(err=readGeoFromFile(geofile, & geoIn))) {	/* readGeoFromFile returns 1=error */
@@ -402,25 +661,66 @@ int start(
 	gsl_matrix_float * depthCorrectMap=NULL;
 	depthCorrectMap = load_depth_correction_map(depthCorrectStr);
 
-
-	/* write first part of summary, then close it and write last part after computing */
-	FILE *f=NULL;
-	char summaryFile[FILENAME_MAX];
-	sprintf(summaryFile,"%ssummary.txt",outfile);
-	if (!(f=fopen(summaryFile, "w"))) { printf("\nERROR -- start(), failed to open file '%s'\n\n",summaryFile); exit(1); }
-	writeSummaryHead(f, infile, outfile, geofile, depth_start, depth_end, resolution, first_image, last_image, out_pixel_type, wireEdge, normalization, depthCorrectStr);
-	fclose(f);
-
 	/* initialize image_set.*, contains partial input images & wire positions and partial output images & total intensity */
-	image_set.wire_scanned.v = NULL;
-	image_set.wire_scanned.alloc = image_set.wire_scanned.size = 0;
-	image_set.depth_resolved.v = NULL;
-	image_set.depth_resolved.alloc = image_set.depth_resolved.size = 0;
+	image_set.wire_scanned.v = image_set.wire_scanned.c = NULL;
+	image_set.wire_scanned.alloc = image_set.wire_scanned.size = image_set.wire_scanned.capacity = 0;
+	image_set.wire_scanned.rows = image_set.wire_scanned.cols = 0;
+	image_set.depth_resolved.v = image_set.depth_resolved.c = NULL;
+	image_set.depth_resolved.alloc = image_set.depth_resolved.size = image_set.depth_resolved.capacity = 0;
+	image_set.depth_resolved.rows = image_set.depth_resolved.cols = 0;
+	image_set.depth_image.v = NULL;
+	image_set.depth_image.alloc = image_set.depth_image.size = 0;
 	image_set.wire_positions.v = NULL;
 	image_set.wire_positions.alloc = image_set.wire_positions.size = 0;
+	image_set.normalVector.v = NULL;
+	image_set.normalVector.alloc = image_set.normalVector.size = 0;
 	image_set.depth_intensity.v = NULL;
 	image_set.depth_intensity.alloc = image_set.depth_intensity.size = 0;
 
+#ifdef USE_DISTORTION_CORRECTION
+	load_peak_correction_maps(distortionPath);
+	/*	load_peak_correction_maps("/Users/tischler/dev/reconstructXcode_Mar07/dXYdistortion"); */
+	/*	load_peak_correction_maps("/home/nathaniel/Desktop/Reconstruction/WireScan/dXYdistortion"); */
+#endif
+	return depthCorrectMap;
+}
+
+
+/* reconstruct one wire scan, writes the output images, the summary, and the metrics file */
+int processScan(
+	char *infile,					/* base name of input image files */
+	char *outfile,					/* base name of output image files */
+	char *geofile,					/* full path to geometry file */
+	double depth_start,				/* first depth in reconstruction range (micron) */
+	double depth_end,				/* last depth in reconstruction range (micron) */
+	double resolution,				/* depth resolution (micron) */
+	int first_image,				/* index to first input image file */
+	int last_image,					/* index to last input image file */
+	int out_pixel_type,				/* type to use for the output pixel */
+	int wireEdge,					/* 1=leading edge of wire, 0=trailing edge of wire, -1=both edges */
+	char *normalization,			/* optional tag for normalization */
+	char* depthCorrectStr,			/* optional name of file with depth corrections for each pixel */
+	gsl_matrix_float *depthCorrectMap)	/* from setupGeometry() */
+{
+	double	seconds;				/* seconds of CPU time used */
+	time_t	executionTime;			/* number of seconds since program started */
+	clock_t	tstart = clock();		/* clock() provides cpu usage, not total elapsed time */
+	time_t	sec0 = time(NULL);		/* time (since EPOCH) when program starts */
+	double	t0 = monotonicSeconds();	/* for the wall time in the metrics file */
+	double	cpu0[2];					/* CPU time used before this scan, for the metrics file */
+
+	cpuSeconds(cpu0);
+
+	/* write first part of summary, then close it and write last part after computing */
+	FILE *f=NULL;
+	char summaryFile[FILENAME_MAX];
+	sprintf(summaryFile,"%ssummary.txt",outfile);
+	if (RANK == 0) {										/* with MPI, rank 0 gets the total intensity vs depth and writes the summary */
+		if (!(f=fopen(summaryFile, "w"))) { printf("\nERROR -- processScan(), failed to open file '%s'\n\n",summaryFile); exit(1); }
+		writeSummaryHead(f, infile, outfile, geofile, depth_start, depth_end, resolution, first_image, last_image, out_pixel_type, wireEdge, normalization, depthCorrectStr);
+		fclose(f);
+	}
+
 	user_preferences.depth_resolution = resolution;				/* depth resolution and range of the reconstruction (micron) */
 	depth_start = round(depth_start/resolution)*resolution;		/* depth range should have same resolution as step size */
 	depth_end = round(depth_end/resolution)*resolution;
@@ -434,22 +734,16 @@ int start(
 		exit(1);
 	}
 
-#ifdef USE_DISTORTION_CORRECTION
-	load_peak_correction_maps(distortionPath);
-	/*	load_peak_correction_maps("/Users/tischler/dev/reconstructXcode_Mar07/dXYdistortion"); */
-	/*	load_peak_correction_maps("/home/nathaniel/Desktop/Reconstruction/WireScan/dXYdistortion"); */
-#endif
-
 	/* *********************** this does everything *********************** */
 	processAll(first_image, last_image, infile, outfile, normalization,depthCorrectMap);
 
-	delete_images();
-	/* TODO: clear the depth-resolved images from memory*/
+	/* the images stay allocated for the next scan of a batch, finishScans() deletes them */
 	seconds = ((double)(clock() - tstart)) /((double)CLOCKS_PER_SEC);
 	executionTime = time(NULL) - sec0;	/* number of seconds since program started */
 
 	/* write remainder of summary file with the total intensity vs depth, for the user to check and see if the depth range is correct */
-	if (!(f=fopen(summaryFile, "a"))) printf("\nERROR -- start(), failed to re-open file '%s'\n\n",summaryFile);
+	if (RANK) { }
+	else if (!(f=fopen(summaryFile, "a"))) printf("\nERROR -- processScan(), failed to re-open file '%s'\n\n",summaryFile);
 	else {														/* re-open file, this section added Apr 1, 2008  JZT */
 		/* writeSummaryTail(f, seconds); */
 		writeSummaryTail(f, (double)executionTime);
@@ -458,9 +752,13 @@ int start(
 	/* if (verbose) printf("\ntotal execution time for this process took %.1f seconds",seconds); */
 	if (verbose) printf("\ntotal execution time for this process took %ld sec, for a CPU time of %.1f seconds",executionTime,seconds);
 
-	/* de-allocate and zero out image_set.depth_intensity */
-	CHECK_FREE(image_set.depth_intensity.v)
-	image_set.depth_intensity.alloc = image_set.depth_intensity.size = 0;
+	/* where the time went, and how much was read, written and depth resolved, for tuning -m, -p and -N */
+	char metricsFile[FILENAME_MAX];
+	if (RANK) sprintf(metricsFile,"%smetrics_%d.json",outfile,RANK);	/* each MPI rank reports its own stripes */
+	else sprintf(metricsFile,"%smetrics.json",outfile);
+	if (writeMetricsFile(metricsFile, infile, outfile, geofile, monotonicSeconds() - t0, cpu0)) printf("\nERROR -- processScan(), failed to write file '%s'\n\n",metricsFile);
+	CHECK_FREE(run_metrics.stripe)
+	run_metrics.Nstripes = 0;
 #ifdef DEBUG_ALL					/* temp debug variable for JZT */
 	if (slowWay) printf("\n\n********************************\n	reading the slow way\n********************************\n\n");
 #endif
@@ -469,6 +767,20 @@ int start(
 }
 
 
+/* after the last scan, de-allocate everything that was kept for the next scan */
+void finishScans(void)
+{
+	delete_images();
+	delete_pixel_edges();
+	if (intensity_map) gsl_matrix_free(intensity_map);
+	intensity_map = NULL;
+
+	/* de-allocate and zero out image_set.depth_intensity */
+	CHECK_FREE(image_set.depth_intensity.v)
+	image_set.depth_intensity.alloc = image_set.depth_intensity.size = 0;
+}
+
+
 
 
 void processAll(
@@ -484,15 +796,33 @@ void processAll(
 {
 #warning Have code for getting depthCorrectMap, but no way to use it yet.
 	/* TODO: Have code for getting depthCorrectMap, but no way to use it yet. */
+	const char *kernel;											/* name of the version of edge_depths_all_steps() being used */
+	double	t_start, t;											/* monotonic clock, for run_metrics */
+	CHECK_FREE(run_metrics.stripe)
+	memset(&run_metrics, 0, sizeof(run_metrics));
+	t_start = t = monotonicSeconds();
 	if (verbose > 0) printf("\nloading image information");
 	fflush(stdout);
 
 	getImageInfo(fn_base, file_num_start, file_num_end);		/* sets many of the values in the structure imaging_parameters which is a global */
+	HDF5cacheSetSize(MULTI_FRAME_FILE ? 1 : file_num_end-file_num_start+1);	/* keep the input files open, every stripe reads from all of them */
+	run_metrics.image_info = monotonicSeconds() - t;
 
 #ifdef DEBUG_1_PIXEL
 	testing_depth();
 #endif
+	t = monotonicSeconds();
 	get_intensity_map(fn_base, file_num_start);					/* finds cutoff, and saves the first image of the wire scan for later comparison */
+	run_metrics.intensity_map = monotonicSeconds() - t;
+	run_metrics.pixels_total = (size_t)imaging_parameters.nROI_i * (size_t)imaging_parameters.nROI_j;
+	run_metrics.pixels_above_cutoff = active_pixels.size;
+	run_metrics.bytes_read = run_metrics.pixels_total * (size_t)imaging_parameters.in_pixel_bytes;
+	t = monotonicSeconds();
+	make_pixel_edges();											/* positions of all pixel edges, computed once and used for every stripe */
+	run_metrics.pixel_edges = monotonicSeconds() - t;
+	kernel = edge_depths_init();								/* choose the version of edge_depths_all_steps() for this cpu */
+	run_metrics.kernel = kernel;
+	if (verbose > 0) printf("\nusing the '%s' version of the wire depth kernel",kernel);
 
 	/* set values in the output header */
 	int	output_pixel_type;										/* WinView number type of output pixels */
@@ -503,54 +833,57 @@ void processAll(
 	output_header.isize = pixel_size;							/* change size of pixels for output files */
 	output_header.itype = output_pixel_type;
 	output_header.xWire = output_header.yWire = output_header.zWire = NAN;	/* no wire positions in output file */
-
-	/* create all of the output files, and write the headers, with a dummy image filled with 0 */
-	char fn_in_first[FILENAME_MAX];								/* name of first input file */
-	sprintf(fn_in_first,"%s%d.h5",fn_base,file_num_start);
-
-#ifdef DEBUG_ALL
-	clock_t tstart = clock();
-	if (verbose > 0) { fprintf(stderr,"\nallocating disk space for results..."); fflush(stdout); }
-#endif
-	writeAllHeaders(fn_in_first,fn_out_base, 0, user_preferences.NoutputDepths - 1);
-#ifdef DEBUG_ALL
-	if (verbose > 0) { fprintf(stderr,"     took %.2f sec",((double)(clock() - tstart)) /((double)CLOCKS_PER_SEC)); fflush(stdout); }
-#endif
+	output_header.Nimages = 1;
 
 	/* [file_num_start, file_num_end] is the total range of files to read */
 	int		start_i, end_i;											/* first and last rows of the image to process, may be less than whole image depending upon depth range and wire range */
 	/*		actually for HDF5 files, you probably have to do the whole range */
 	size_t	rows;													/* number of rows (i's) that can be processed at once, limited by memory.  (1<<20) = 2^20 = 1MiB */
 	size_t	max_rows;												/* maximum number of rows that can be processed with this memory allocation */
-	rows = AVAILABLE_RAM_MiB * MiB;									/* total number of bytes available */
-	rows -= (imaging_parameters.nROI_i * imaging_parameters.nROI_j * sizeof(double) * 3);	/* subract space for intensity and distortion maps */
-	rows /= (imaging_parameters.nROI_j * sizeof(double));									/* divide by number of bytes per line */
-	rows /= (imaging_parameters.NinputImages + user_preferences.NoutputDepths);				/* divide by number of images to store */
+	size_t	reserved;												/* bytes used by the intensity, distortion, and pixel edge maps */
+	if (AVAILABLE_RAM_MiB > 0) rows = (size_t)AVAILABLE_RAM_MiB * MiB;	/* total number of bytes available */
+	else {
+		rows = autoMemoryBudget();									/* free memory and cgroup limit, less headroom */
+#ifdef USE_MPI
+		rows /= (size_t)mpiRanksOnNode();							/* the MPI ranks on this node share its memory */
+#endif
+		if (!rows) rows = 128 * MiB;								/* could not find out, use the old default */
+		if (verbose > 0) printf("\nautomatic memory budget is %lu MiB",rows/MiB);
+	}
+	imaging_parameters.memory_budget = rows;
+	reserved = imaging_parameters.nROI_i * imaging_parameters.nROI_j * sizeof(double) * 3;	/* space for intensity and distortion maps */
+	reserved += pixel_edges.Ni * pixel_edges.Nj * sizeof(double) * 2;						/* space for the y & z of the pixel edges */
+	if (MULTI_FRAME_FILE) reserved += FRAME_BLOCK_MiB * MiB;								/* space to read a block of frames before putting them in a stripe */
+	rows = (rows > reserved) ? rows - reserved : 0;					/* subtract reserved space, but do not go negative */
+	size_t	row_bytes;												/* bytes needed for each row of a stripe */
+	row_bytes = imaging_parameters.NinputImages + user_preferences.NoutputDepths;			/* values stored for each pixel of a stripe */
+#ifdef STRIPE_KAHAN
+	row_bytes += user_preferences.NoutputDepths;											/* compensation for each depth */
+#endif
+	row_bytes *= sizeof(stripe_real);
+	row_bytes += sizeof(double);															/* for image_set.depth_image */
+	if (PIPELINE_IO) row_bytes *= 2;														/* two of each stripe and output image, one being worked on and one being read or written */
+	rows /= (imaging_parameters.nROI_j * row_bytes);										/* divide by number of bytes per line */
 	rows = MAX(rows,1);												/* always at least one row */
 	max_rows = rows;												/* save maxium value for later */
 	if (verbose > 0) printf("\nFrom the amount of RAM, can process %lu rows at once",rows);
 	fflush(stdout);
 
 	/* get starting row and stopping row positions in images (range of i) */
-	if (verbose > 0) { printf("\nsetup depth-resolved images in memory"); fflush(stdout); }
 	start_i = 0;													/* start with whole image, then trim down depending upon wire range and depth range */
 	end_i = (int)(in_header.xdim - 1);
 	if (verbose > 0) printf("\nprocess rows %d thru %d",start_i,end_i);
 
-	if (0) {
-		if (user_preferences.wireEdge>=0) {								/* using only one edge of the wire */
-			start_i = find_first_valid_i(start_i,end_i,0,imaging_parameters.nROI_j-1,imaging_parameters.wire_first_xyz,(BOOLEAN)(user_preferences.wireEdge));
-			end_i = find_last_valid_i(start_i,end_i,0,imaging_parameters.nROI_j-1,imaging_parameters.wire_last_xyz,(BOOLEAN)(user_preferences.wireEdge));
-		}
-		else {															/* using both edges of the wire */
-			int i1,i2;
-			i1 = find_first_valid_i(start_i,end_i,0,imaging_parameters.nROI_j-1,imaging_parameters.wire_first_xyz,0);
-			i2 = find_first_valid_i(start_i,end_i,0,imaging_parameters.nROI_j-1,imaging_parameters.wire_first_xyz,1);
-			start_i = MIN(i1,i2);
-			i1 = find_last_valid_i(start_i,end_i,0,imaging_parameters.nROI_j-1,imaging_parameters.wire_last_xyz,0);
-			i2 = find_last_valid_i(start_i,end_i,0,imaging_parameters.nROI_j-1,imaging_parameters.wire_last_xyz,1);
-			end_i = MAX(i1,i2);
-		}
+	/* wire positions and normalizations do not change between stripes, get them once */
+	t = monotonicSeconds();
+	readScanMetadata(fn_base, file_num_start, file_num_end, normalization);
+	cull_active_pixels();											/* drop pixels that cannot see any depth in [depth_start, depth_end] */
+	run_metrics.metadata = monotonicSeconds() - t;
+	run_metrics.pixels_active = active_pixels.size;
+	if (active_pixels.size) {										/* no need to read rows before the first or after the last active pixel */
+		while (start_i < end_i && active_pixels.row_start[start_i+1] == active_pixels.row_start[start_i]) start_i++;
+		while (end_i > start_i && active_pixels.row_start[end_i+1] == active_pixels.row_start[end_i]) end_i--;
+		if (verbose > 0) printf("\nrows with active pixels are %d thru %d",start_i,end_i);
 	}
 	if (start_i<0 || end_i<0) {
 		char errStr[1024];
@@ -558,52 +891,294 @@ void processAll(
 		error(errStr);
 		exit(1);
 	}
+
+	/* with RESUME, the stripes already written by an earlier run with the same input and settings are in the progress journal */
+	ws_progress	progress;											/* stays empty unless resuming from a usable journal */
+	char	progressFile[FILENAME_MAX];								/* the progress journal, <outfile>progress.txt */
+	unsigned long long progressKey=0;
+	double	*intensity_done[2]={NULL,NULL};							/* image_set.depth_intensity after each of the last two stripes, for the journal */
+	memset(&progress, 0, sizeof(progress));
+	sprintf(progressFile,"%sprogress.txt",fn_out_base);				/* named even without CHECKPOINT, so a stale one can be removed */
+	if (CHECKPOINT) progressKey = progress_key(fn_base, file_num_start, file_num_end, normalization);
+	if (RESUME && read_progress(progressFile, progressKey, &progress)) printf("\nno usable progress journal '%s', starting from the first stripe",progressFile);
+
 	rows = MIN(rows,(size_t)(end_i-start_i+1));						/* re-set in case [start_i,end_i] is smaller, only have a few left */
+	if (NRANKS > 1) rows = MIN(rows,((size_t)(end_i-start_i+1) + NRANKS - 1) / NRANKS);	/* at least one stripe for each MPI rank */
+	if (progress.chunk_rows && MIN(progress.chunk_rows,(size_t)(end_i-start_i+1)) > rows) {
+		printf("\nthe stripes in '%s' need more memory than is available now, starting from the first stripe",progressFile);
+		free_progress(&progress);
+	}
+	{																/* a stripe is the part of one band of chunk_rows rows of the output images in [start_i,end_i] */
+		size_t	n = ((size_t)(end_i-start_i+1) + rows - 1) / rows;	/* number of stripes needed */
+		size_t	c;													/* rows in one chunk */
+		if (progress.chunk_rows) c = progress.chunk_rows;			/* the same stripes as the run being resumed */
+		else if (n == 1) c = (size_t)end_i + 1;						/* one band starting at row 0 holds all of the rows */
+		else {														/* make them all about the same size, taller if that saves a stripe */
+			for (c = ((size_t)(end_i-start_i+1) + n - 1) / n; c < rows && (size_t)end_i/c - (size_t)start_i/c + 1 > n; c++) ;
+		}
+		imaging_parameters.chunk_rows = c;
+		rows = MIN(c,(size_t)(end_i-start_i+1));
+	}
+	imaging_parameters.stripe_bytes = rows * imaging_parameters.nROI_j * row_bytes;
 	imaging_parameters.rows_at_one_time = rows;						/* number of rows that can be processed at one time due to memory limitations */
 	if (verbose > 0) printf("\nneed to process rows %d thru %d, can do %lu rows at a time",start_i,end_i,rows);
 
-	/* current row indicies */
-	int cur_start_i = start_i;										/* start and stop row for one band of image that fits into memory */
-	int cur_stop_i = (int)(start_i + rows - 1);
-	cur_stop_i = MIN(end_i,cur_stop_i);
-
 	/* in input and output images need space for (imaging_parameters.rows_at_one_time = rows) rows */
 	/* allocate space for wire_scanned images of length (rows = imaging_parameters.rows_at_one_time) */
+	if (verbose > 0) { printf("\nsetup depth-resolved images in memory"); fflush(stdout); }
 	setup_depth_images(file_num_end-file_num_start+1);				/* allocate space and initialize the structure image_set, which contains the output */
 	if (verbose > 0) print_imaging_parameters(imaging_parameters);
 
-	/* loop through ram-managable stripes of the image and process them */
-	while (cur_start_i <= end_i ) {
-		imaging_parameters.current_selection_start = cur_start_i;
-		imaging_parameters.current_selection_end = cur_stop_i;
+	/* list the ram-managable stripes of the image that have active pixels, the others are already all zero in the output */
+	int		Nstripes = 0;											/* number of stripes to process */
+	int		*lo, *hi;												/* first and last row of each stripe */
+	int		*jlo, *jhi;												/* first and last column with an active pixel in each stripe, only these are read */
+	int		cur_start_i, cur_stop_i;								/* start and stop row for one band of image that fits into memory */
+	int		k, b;													/* stripe index, and which buffer it uses */
+	size_t	a;
+	lo = calloc((size_t)(end_i-start_i)/rows + 2, sizeof(int));
+	hi = calloc((size_t)(end_i-start_i)/rows + 2, sizeof(int));
+	jlo = calloc((size_t)(end_i-start_i)/rows + 2, sizeof(int));
+	jhi = calloc((size_t)(end_i-start_i)/rows + 2, sizeof(int));
+	if (!lo || !hi || !jlo || !jhi) { error("processAll(), cannot allocate list of stripes"); exit(1); }
+	for (cur_start_i = start_i; cur_start_i <= end_i; cur_start_i = cur_stop_i + 1) {
+		cur_stop_i = (cur_start_i/(int)imaging_parameters.chunk_rows + 1)*(int)imaging_parameters.chunk_rows - 1;	/* stripes end on a chunk boundary of the output images */
+		cur_stop_i = MIN(cur_stop_i,end_i);							/* make sure loop doesn't go outside of the assigned area. */
+		if (active_pixels.row_start[cur_stop_i+1] == active_pixels.row_start[cur_start_i]) {	/* no active pixels in this stripe, output is already all zero */
+			if (verbose > 0) printf("\nskipping rows %d thru %d, no pixels above cutoff",cur_start_i,cur_stop_i);
+			continue;
+		}
+		lo[Nstripes] = cur_start_i;									/* only read the rows with active pixels */
+		hi[Nstripes] = cur_stop_i;
+		while (active_pixels.row_start[lo[Nstripes]+1] == active_pixels.row_start[lo[Nstripes]]) lo[Nstripes]++;
+		while (active_pixels.row_start[hi[Nstripes]+1] == active_pixels.row_start[hi[Nstripes]]) hi[Nstripes]--;
+		jlo[Nstripes] = imaging_parameters.nROI_j - 1;
+		jhi[Nstripes] = 0;
+		for (a=active_pixels.row_start[cur_start_i]; a < active_pixels.row_start[cur_stop_i+1]; a++) {
+			jlo[Nstripes] = MIN(jlo[Nstripes],active_pixels.j[a]);
+			jhi[Nstripes] = MAX(jhi[Nstripes],active_pixels.j[a]);
+		}
+		Nstripes++;
+	}
+	run_metrics.stripe = calloc(MAX(Nstripes,1), sizeof(ws_stripe_metrics));
+	if (!(run_metrics.stripe)) { error("processAll(), cannot allocate stripe metrics"); exit(1); }
+	run_metrics.Nstripes = Nstripes;
+	for (k=0; k < Nstripes; k++) {
+		run_metrics.stripe[k].ilo = lo[k];
+		run_metrics.stripe[k].ihi = hi[k];
+		run_metrics.stripe[k].jlo = jlo[k];
+		run_metrics.stripe[k].jhi = jhi[k];
+		run_metrics.stripe[k].bytes_read = (size_t)(hi[k]-lo[k]+1) * (size_t)(jhi[k]-jlo[k]+1) * (size_t)imaging_parameters.NinputImages * (size_t)imaging_parameters.in_pixel_bytes;
+	}
+
+	/* with MPI, this rank does only the stripes [kfirst, klast), a block of rows with about its share of the active pixels */
+	int		kfirst=0, klast=Nstripes;								/* stripes done by this process */
+	int		Nrounds;												/* stripes done by the busiest rank, all ranks write in this many rounds */
+#ifdef USE_MPI
+	if (NRANKS > 1) {
+		mpiAssignStripes(Nstripes, lo, hi, active_pixels.row_start, &kfirst, &klast);
+		for (k=0; k < Nstripes; k++) if (k < kfirst || k >= klast) run_metrics.stripe[k].bytes_read = 0;	/* another rank reads it */
+		if (verbose > 0) printf("\n%d stripes shared among %d MPI ranks, rank 0 does stripes [%d, %d)",Nstripes,NRANKS,kfirst,klast);
+	}
+#endif
+
+	/* only resume if the journal has the same stripes, and the output files from the earlier run are still there */
+	for (k=0; k < progress.Ndone; k++) {
+		if (k >= Nstripes || progress.lo[k] != lo[k] || progress.hi[k] != hi[k]) break;
+	}
+	if (progress.Ndone && (k < progress.Ndone || check_output_headers(fn_out_base))) {
+		printf("\ncannot resume from '%s', starting from the first stripe",progressFile);
+		free_progress(&progress);
+	}
+	if (CHECKPOINT) {
+		intensity_done[0] = calloc((size_t)user_preferences.NoutputDepths,sizeof(double));
+		intensity_done[1] = calloc((size_t)user_preferences.NoutputDepths,sizeof(double));
+		if (!intensity_done[0] || !intensity_done[1]) { error("processAll(), cannot allocate depth intensity for the progress journal"); exit(1); }
+		if (!(progress.Ndone)) write_progress(progressFile, progressKey, imaging_parameters.chunk_rows, 0, lo, hi, intensity_done[0]);	/* forget any earlier run before re-making its output */
+	}
+	else if (RANK == 0) unlink(progressFile);						/* the output is re-made without a journal, an old one would let -R skip blanked stripes */
 
-		clear_depth_images(&image_set);				/* sets all images in image_set.depth_resolved and image_set.wire_scanned to zero, does not de-allocate the space they use, or change .size or .alloc */
-		/* NOTE, do NOT clear image_set.depth_intensity or image_set.wire_positions */
+	/* create all of the output files and write the headers, the images are chunked and only the chunks that get written are stored */
+	char fn_in_first[FILENAME_MAX];								/* name of first input file */
+	if (MULTI_FRAME_FILE) strncpy(fn_in_first,fn_base,FILENAME_MAX-1);
+	else sprintf(fn_in_first,"%s%d.h5",fn_base,file_num_start);
+
+#ifdef DEBUG_ALL
+	clock_t tstart = clock();
+	if (verbose > 0) { fprintf(stderr,"\nallocating disk space for results..."); fflush(stdout); }
+#endif
+	t = monotonicSeconds();
+	if (RANK) { }													/* with MPI, rank 0 makes the output files for all of the ranks */
+	else if (progress.Ndone) {										/* keep the output written by the earlier run */
+		if (SINGLE_OUTPUT_FILE) openStackFile(fn_out_base);
+	}
+	else if (SINGLE_OUTPUT_FILE) writeStackFile(fn_in_first,fn_out_base);
+	else writeAllHeaders(fn_in_first,fn_out_base, 0, user_preferences.NoutputDepths - 1);
+#ifdef USE_MPI
+	if (NRANKS > 1) {
+		closeStackFile();											/* re-opened by all ranks for collective writes, or by each rank in its turn */
+		mpiBarrier();												/* the output files are there before any rank writes */
+		if (STACK_COLLECTIVE) openStackFile(fn_out_base);
+	}
+#endif
+	run_metrics.create_output = monotonicSeconds() - t;
+#ifdef DEBUG_ALL
+	if (verbose > 0) { fprintf(stderr,"     took %.2f sec",((double)(clock() - tstart)) /((double)CLOCKS_PER_SEC)); fflush(stdout); }
+#endif
+
+	if (progress.Ndone) {											/* the first stripes are already done */
+		if (verbose > 0) printf("\nresuming after %d of %d stripes, from '%s'",progress.Ndone,Nstripes,progressFile);
+		memcpy(image_set.depth_intensity.v, progress.depth_intensity, (size_t)user_preferences.NoutputDepths*sizeof(double));
+		for (k=0; k < progress.Ndone; k++) run_metrics.stripe[k].bytes_read = 0;
+	}
+	run_metrics.Nresumed = progress.Ndone;
+	kfirst += progress.Ndone;										/* progress is always empty with MPI */
+	Nrounds = klast - kfirst;
+#ifdef USE_MPI
+	Nrounds = mpiMaxInt(Nrounds);
+#endif
+
+
+	/* with PIPELINE_IO, stripe k+1 is read and stripe k-1 is written while stripe k is depth resolved, so need two of each */
+	stepstripe	scanned[2], resolved[2];							/* [0] are image_set's, [1] are only used with PIPELINE_IO */
+	double		*images[2];											/* one output image of a stripe, for writing resolved[] */
+	scanned[0] = image_set.wire_scanned;
+	resolved[0] = image_set.depth_resolved;
+	images[0] = image_set.depth_image.v;
+	if (PIPELINE_IO && Nstripes > 1) {
+		alloc_stepstripe(&pipe_scanned, scanned[0].rows, scanned[0].cols, scanned[0].alloc);
+		alloc_stepstripe(&pipe_resolved, resolved[0].rows, resolved[0].cols, resolved[0].alloc);
+		pipe_resolved.size = resolved[0].size;
+#ifdef STRIPE_KAHAN
+		add_stepstripe_compensation(&pipe_resolved);
+#endif
+		if (pipe_image.alloc < image_set.depth_image.size) {
+			CHECK_FREE(pipe_image.v)
+			pipe_image.alloc = image_set.depth_image.size;
+			pipe_image.v = calloc(pipe_image.alloc,sizeof(double));
+			if (!(pipe_image.v)) { error("processAll(), cannot allocate second output image"); exit(1); }
+		}
+		pipe_image.size = image_set.depth_image.size;
+		scanned[1] = pipe_scanned;
+		resolved[1] = pipe_resolved;
+		images[1] = pipe_image.v;
+	}
+	else {
+		scanned[1] = scanned[0];
+		resolved[1] = resolved[0];
+		images[1] = images[0];
+	}
+
+	pthread_t	reader, writer;
+	read_stripe_job		rjob;
+	write_stripe_job	wjob;
+	BOOLEAN		reading=0, writing=0;								/* true when reader or writer thread is running */
+	rjob.fn_base = fn_base;
+	rjob.file_num_start = file_num_start;
+	rjob.file_num_end = file_num_end;
+	wjob.fn_base = fn_out_base;
+
+	/* loop through the stripes of the image and process them */
+	double	t_stripes = monotonicSeconds();
+	for (k=kfirst; k < klast; k++) {
+		b = PIPELINE_IO ? k%2 : 0;
+		cur_start_i = lo[k];
+		cur_stop_i = hi[k];
 		if (verbose > 1) printf("\n");
 		if (verbose > 0) printf("\nprocessing rows %d thru %d  (%d of %d)...",cur_start_i,cur_stop_i,cur_stop_i-cur_start_i+1,end_i-start_i+1);
 		fflush(stdout);
 
-		/* read stripes from the input image files */
-		readImageSet(fn_base, cur_start_i, cur_stop_i, 0, imaging_parameters.nROI_j - 1, file_num_start, file_num_end, normalization);
+		/* read stripes from the input image files, with PIPELINE_IO all but the first were read during the previous stripe */
+		if (k==kfirst || !PIPELINE_IO) {
+			t = monotonicSeconds();
+			clear_stepstripe(&scanned[b]);
+			readImageSet(fn_base, cur_start_i, cur_stop_i, jlo[k], jhi[k], file_num_start, file_num_end, &scanned[b]);
+			run_metrics.stripe[k].read = monotonicSeconds() - t;
+		}
+		if (PIPELINE_IO && k+1 < klast) {						/* start reading the next stripe */
+			rjob.ilow = lo[k+1];
+			rjob.ihi = hi[k+1];
+			rjob.jlow = jlo[k+1];
+			rjob.jhi = jhi[k+1];
+			rjob.stripe = &scanned[1-b];
+			rjob.metrics = &run_metrics.stripe[k+1];
+			if (pthread_create(&reader, NULL, readImageSet_thread, &rjob)) { error("processAll(), cannot start reading thread"); exit(1); }
+			reading = 1;
+		}
 
 		if (verbose > 1) printf("\n\tdepth resolving");
 		if (verbose == 2) printf("       ");
 		fflush(stdout);
 
 		/* depth resolve the set of stripes just read */
-		depth_resolve(cur_start_i, cur_stop_i);
+		imaging_parameters.current_selection_start = cur_start_i;
+		imaging_parameters.current_selection_end = cur_stop_i;
+		image_set.wire_scanned = scanned[b];
+		image_set.depth_resolved = resolved[b];
+		clear_stepstripe(&image_set.depth_resolved);				/* NOTE, do NOT clear image_set.depth_intensity or image_set.wire_positions */
+		depth_resolve(cur_start_i, cur_stop_i, &run_metrics.stripe[k]);
+		if (CHECKPOINT) memcpy(intensity_done[k%2], image_set.depth_intensity.v, (size_t)user_preferences.NoutputDepths*sizeof(double));
+
+		if (reading) { pthread_join(reader, NULL); reading = 0; }
+		if (writing) {												/* done with resolved[1-b], it can be re-used */
+			pthread_join(writer, NULL);
+			writing = 0;
+			if (CHECKPOINT) write_progress(progressFile, progressKey, imaging_parameters.chunk_rows, k, lo, hi, intensity_done[(k-1)%2]);
+		}
 
 		if (verbose > 1) printf("\n\twriting out data");
 		if (verbose == 2) printf("      ");
 		fflush(stdout);
 
-		/* write the depth resolved stripes to the output image files */
-		write_depth_data((size_t)cur_start_i, (size_t)cur_stop_i, fn_out_base);
-
-		cur_start_i = cur_stop_i + 1;					/* increase row limits for next stripe */
-		cur_stop_i = MIN(cur_stop_i+(int)rows,end_i);	/* make sure loop doesn't go outside of the assigned area. */
+		/* write the depth resolved stripes to the output image files, with PIPELINE_IO this is done during the next stripe */
+		if (PIPELINE_IO && k+1 < klast) {
+			wjob.start_i = (size_t)cur_start_i;
+			wjob.end_i = (size_t)cur_stop_i;
+			wjob.stripe = &resolved[b];
+			wjob.image = images[b];
+			wjob.metrics = &run_metrics.stripe[k];
+			if (pthread_create(&writer, NULL, write_depth_data_thread, &wjob)) { error("processAll(), cannot start writing thread"); exit(1); }
+			writing = 1;
+		}
+		else {
+			t = monotonicSeconds();
+			write_turn_begin(fn_out_base);
+			run_metrics.stripe[k].bytes_written = write_depth_data((size_t)cur_start_i, (size_t)cur_stop_i, fn_out_base, &resolved[b], images[b]);
+			write_turn_end();
+			run_metrics.stripe[k].write = monotonicSeconds() - t;
+			if (CHECKPOINT) write_progress(progressFile, progressKey, imaging_parameters.chunk_rows, k+1, lo, hi, intensity_done[k%2]);
+		}
+	}
+	for (k = klast - kfirst; k < Nrounds; k++) {					/* with MPI, a rank with fewer stripes still takes part in each round of writing */
+		write_turn_begin(fn_out_base);
+		if (STACK_COLLECTIVE) write_depth_data(0, 0, fn_out_base, NULL, NULL);
+		write_turn_end();
+	}
+#ifdef USE_MPI
+	mpiWriteTurnsDone();
+	mpiSumDepthIntensity(image_set.depth_intensity.v, user_preferences.NoutputDepths);	/* rank 0 writes the summary */
+#endif
+	run_metrics.stripes = monotonicSeconds() - t_stripes;
+	for (k=0; k < Nstripes; k++) {
+		run_metrics.bytes_read += run_metrics.stripe[k].bytes_read;
+		run_metrics.bytes_written += run_metrics.stripe[k].bytes_written;
 	}
+	image_set.wire_scanned = scanned[0];							/* image_set owns only the [0] buffers, the [1] are pipe_* */
+	image_set.depth_resolved = resolved[0];
+	CHECK_FREE(lo)
+	CHECK_FREE(hi)
+	CHECK_FREE(jlo)
+	CHECK_FREE(jhi)
+	CHECK_FREE(intensity_done[0])
+	CHECK_FREE(intensity_done[1])
+	free_progress(&progress);
 	imaging_parameters.rows_at_one_time = max_rows;		/* save this for output to summary file */
+	imaging_parameters.Nstripes = Nstripes;
+	HDF5cacheSetSize(0);								/* close all of the input files */
+	closeStackFile();
+	delete_active_pixels();											/* the pixel edges are kept for the next scan of a batch */
+
+	run_metrics.total = monotonicSeconds() - t_start;
 
 	if (verbose > 1) printf("\n\nfinishing\n");
 	fflush(stdout);
@@ -614,22 +1189,34 @@ void processAll(
 
 
 /* depth sort out the intensity for for the pixels in one stripe */
+/* rows of the stripe are split among NUM_THREADS threads, each pixel only writes to its own depths in image_set.depth_resolved */
 void depth_resolve(
 	int i_start,			/* starting row of this stripe */
-	int i_stop)				/* final row of this stripe*/
+	int i_stop,				/* final row of this stripe*/
+	ws_stripe_metrics *metrics)	/* gets the time used and the counts for this stripe, may be NULL */
 {
-	point_ccd pixel_edge;					/* pixel indicies for an edge of a pixel (e.g. [117,90.5]) */
-	point_xyz front_edge;					/* xyz coords of the front edge of a pixel */
-	point_xyz back_edge;					/* xyz coords of the back edge of a pixel */
+	double	*edge_y, *edge_z;				/* rho-rotated y & z of the pixel edges in one row, pixel j is between edge_y[j] and edge_y[j+1] */
 	double	diff_value;						/* intensity difference between two wire steps for a pixel */
-	dvector pixel_values;					/* vector to hold one pixel's values at all depths */
+	stripe_real *pixel_values;				/* one pixel's values at all wire steps, points into image_set.wire_scanned */
+	size_t	Nvalues;						/* number of differenced values of a pixel */
 	size_t	step;							/* index over the input images */
-	size_t	idep;							/* index into depths */
-	size_t	i,j;							/* loop indicies */
-
-	pixel_values.size = pixel_values.alloc = imaging_parameters.NinputImages - 1 - 1;
-	pixel_values.v = calloc(pixel_values.alloc,sizeof(double));				/* allocate space for array of doubles in the vector */
-	if (!(pixel_values.v)) { fprintf(stderr,"\ncannot allocate space for pixel_values, %ld points\n",pixel_values.alloc); exit(1); }
+	long	i;								/* loop indicies, i is signed for the OpenMP loop */
+	size_t	j;
+	size_t	a;								/* index into active_pixels */
+	size_t	Nw;								/* number of wire positions used, one more than the number of differences used */
+	double	*wire_y=NULL, *wire_z=NULL;		/* y & z of the wire positions, as separate arrays for edge_depths_all_steps() */
+	double	radius;							/* wire radius (micron) */
+	double	*back_depth[2], *front_depth[2];	/* depths of the back & front edges of a pixel at every wire position, [0]=trailing, [1]=leading edge of wire */
+	double	*swap, *depth_block;				/* depth_block holds all four of back_depth[] & front_depth[] */
+	long	last_j;							/* pixel in this row whose front edge is in front_depth[], its front edge is the back edge of pixel last_j+1 */
+	int		e;								/* edge of the wire, 0=trailing, 1=leading */
+	size_t	slo, shi;						/* window of differenced steps of this pixel that can reach the output depths, from cull_active_pixels() */
+	size_t	elo, ehi;						/* edge depths [elo,ehi) are computed, a bit more than [slo,shi+1] so they match the full calculation */
+	size_t	last_elo, last_ehi;				/* the range in front_depth[] for pixel last_j */
+	size_t	differences=0, deposits=0;		/* non-zero differences depth resolved, and the depth bins they went into */
+	double	t0, t1;							/* monotonic clock at the start, and after differencing */
+
+	t0 = monotonicSeconds();
 
 #ifdef DEBUG_1_PIXEL
 	if (i_start<=pixelTESTi && pixelTESTi<=i_stop) { printf("\n\n  ****** start story of one pixel, [%g, %g]\n",(double)pixelTESTi,(double)pixelTESTj); verbosePixel = 1; }
@@ -638,56 +1225,97 @@ void depth_resolve(
 #ifdef DEBUG_1_PIXEL
 	verbosePixel = 0;
 #endif
+	t1 = monotonicSeconds();
+
+	Nw = (size_t)(imaging_parameters.NinputImages - 1 - 1);
+	radius = calibration.wire.diameter / 2;
+	wire_y = calloc(Nw,sizeof(double));
+	wire_z = calloc(Nw,sizeof(double));
+	if (!wire_y || !wire_z) { fprintf(stderr,"\ncannot allocate space for wire_y & wire_z, %lu points\n",Nw); exit(1); }
+	for (step=0; step < Nw; step++) {
+		wire_y[step] = image_set.wire_positions.v[step].y;
+		wire_z[step] = image_set.wire_positions.v[step].z;
+	}
 
 #warning "This loop is constructed assuming that the wire scans in the j direction, true for Orange detector, what about Yellow and Purple?"
 #warning "Also assumed is that the wire scans from low j to high j (high 2theta to low 2theta), so leading edge of pixel is -0.5"
-	for (i = i_start; i <= (size_t)i_stop; i++) {							/* loop over selected part of i */
-		pixel_edge.i = (double)i;
-		for (j=0; j < (size_t)imaging_parameters.nROI_j; j++) {				/* loop over all of j, wire travels in the j direction for the orange detector */
-			if (j==0) {														/* only need to recompute this for first j */
-				pixel_edge.j = 0.5 + ((double)j - 1);						/* upstream edge of pixel for the first pixel, (j-1) is the 'previous' j */
-				back_edge = pixel_to_point_xyz(pixel_edge);					/* this is the back edge of the first pixel */
-			}
-			else {
-				back_edge = front_edge;										/* reuse last front edge as the current back edge */
+#ifdef _OPENMP
+	#pragma omp parallel private(edge_y,edge_z,diff_value,pixel_values,Nvalues,step,j,a,back_depth,front_depth,swap,depth_block,last_j,e,slo,shi,elo,ehi,last_elo,last_ehi) reduction(+:differences,deposits) num_threads(NUM_THREADS)
+#endif
+	{
+	Nvalues = imaging_parameters.NinputImages - 1 - 1;						/* - 1 - 1 because images have already been differenced, and the last one has nothing to difference against */
+	depth_block = calloc(4*Nw,sizeof(double));								/* one block for all four depth arrays */
+	if (!depth_block) { fprintf(stderr,"\ncannot allocate space for edge depths, %lu points\n",4*Nw); exit(1); }
+	back_depth[0] = depth_block;
+	back_depth[1] = depth_block + Nw;
+	front_depth[0] = depth_block + 2*Nw;
+	front_depth[1] = depth_block + 3*Nw;
+
+#ifdef _OPENMP
+	#pragma omp for schedule(dynamic)
+#endif
+	for (i = i_start; i <= (long)i_stop; i++) {								/* loop over selected part of i */
+		edge_y = pixel_edges.y + i*pixel_edges.Nj;							/* the edges of row i, back edge of pixel j is [j], front edge is [j+1] */
+		edge_z = pixel_edges.z + i*pixel_edges.Nj;
+		last_j = -2;
+		last_elo = last_ehi = 0;
+		for (a=active_pixels.row_start[i]; a < active_pixels.row_start[i+1]; a++) {	/* loop over the active pixels of row i, wire travels in the j direction for the orange detector */
+			j = (size_t)active_pixels.j[a];									/* only pixels with enough intensity are in active_pixels */
+			slo = 0;														/* the other steps cannot reach [depth_start, depth_end] */
+			shi = Nvalues - 2;
+			if (active_pixels.step_lo) {
+				slo = (size_t)active_pixels.step_lo[a];
+				shi = (size_t)active_pixels.step_hi[a];
 			}
+			elo = slo & ~(size_t)3;											/* keep the same groups of 4 as the vector kernel uses for all Nw, so the */
+			ehi = (shi + 2 + 3) & ~(size_t)3;								/* depths are bit for bit the same as computing every step */
+			if (ehi > (Nw & ~(size_t)3)) ehi = Nw;
 #ifdef DEBUG_1_PIXEL
 			verbosePixel = (i==pixelTESTi) && (j==pixelTESTj);
 #endif
-			pixel_edge.j = 0.5 + (double)j;
-			front_edge = pixel_to_point_xyz(pixel_edge);					/* the front edge of this pixel */
-			if ( gsl_matrix_get(intensity_map, i, j)  < cutoff) continue;	/* not enough intensity, skip this pixel */
-			for (idep=0;idep<pixel_values.size;idep++) pixel_values.v[idep]=0.;	/* clear the pixel vector along depth, set all to zero */
 #ifdef DEBUG_1_PIXEL
 			if (verbosePixel)
-				printf("\nback_edge = {%g, %g, %g},  front_edge = {%g, %g, %g} for pixel[%lu, %lu]",back_edge.x,back_edge.y,back_edge.z,front_edge.x,front_edge.y,front_edge.z,i,j);
+				printf("\nback_edge = {%g, %g},  front_edge = {%g, %g} (rotated y,z) for pixel[%lu, %lu]",edge_y[j],edge_z[j],edge_y[j+1],edge_z[j+1],i,j);
 #endif
 
-			/* load the pixel vector full of values for this pixel
-			 *  - 1 - 1 because images have already been differenced within the matricies
-			 * meaning that the last image hasn't been differenced against anything and so we ignore it.
-			 */
-			for (step=0; step < (size_t)(imaging_parameters.NinputImages - 1 - 1); step++) {
-				/* pixel locations are real coordinates on detector, but image is stripe of image from middle of image - correct for this. */
-				pixel_values.v[step] = gsl_matrix_get(image_set.wire_scanned.v[step], i - imaging_parameters.current_selection_start, j);
-			}
+			/* the values for this pixel at all wire steps are contiguous, no need to copy them
+			 * pixel locations are real coordinates on detector, but image is stripe of image from middle of image - correct for this. */
+			pixel_values = STEP_PTR(image_set.wire_scanned, (size_t)(i - imaging_parameters.current_selection_start), j);
 
 #warning "TODO: put any curve-fitting stuff here before we go through the pixel in a line"
 
+			/* depths of the back and front edges of this pixel for the wire positions in its window, for the wire edges being used */
+			if (last_j == (long)j-1 && last_elo <= elo && ehi <= last_ehi) {	/* front edge of the previous pixel is the back edge of this one */
+				for (e=0; e<2; e++) {
+					swap = back_depth[e];
+					back_depth[e] = front_depth[e];
+					front_depth[e] = swap;
+				}
+			}
+			else if (user_preferences.wireEdge<0) edge_depths_both_all_steps(edge_y[j],edge_z[j], wire_y+elo,wire_z+elo, ehi-elo, radius, calibration.wire.ki, back_depth[1]+elo, back_depth[0]+elo);
+			else edge_depths_all_steps(edge_y[j],edge_z[j], wire_y+elo,wire_z+elo, ehi-elo, radius, calibration.wire.ki, user_preferences.wireEdge, back_depth[user_preferences.wireEdge]+elo);
+			if (user_preferences.wireEdge<0) edge_depths_both_all_steps(edge_y[j+1],edge_z[j+1], wire_y+elo,wire_z+elo, ehi-elo, radius, calibration.wire.ki, front_depth[1]+elo, front_depth[0]+elo);
+			else edge_depths_all_steps(edge_y[j+1],edge_z[j+1], wire_y+elo,wire_z+elo, ehi-elo, radius, calibration.wire.ki, user_preferences.wireEdge, front_depth[user_preferences.wireEdge]+elo);
+			last_j = (long)j;
+			last_elo = elo;
+			last_ehi = ehi;
+
 #warning "are the limits of this loop correct?, should it be one longer?"
-			for (step=0; step < (pixel_values.size)-1; step++) {			/* loop over all of the differenced intensities of this pixel */
-				diff_value = pixel_values.v[step];
+			for (step=slo; step <= shi; step++) {				/* loop over the differenced intensities of this pixel, outside [slo,shi] they cannot reach the output */
+				diff_value = pixel_values[step];
 #ifdef DEBUG_1_PIXEL
 				if (verbosePixel) printf("\n∆ pixel[%lu] values = %g",step,diff_value);
 #endif
 				if (diff_value==0) continue;								/* only process for non-zero intensity */
 				else if (user_preferences.wireEdge<0) {						/* using both leading and trailing edges of the wire */
 					/* DDDDDDDDDDDDDDDDD */
-					depth_resolve_pixel(diff_value, i,j, back_edge, front_edge, image_set.wire_positions.v[step], image_set.wire_positions.v[step+1], 1);
-					depth_resolve_pixel(diff_value, i,j, back_edge, front_edge, image_set.wire_positions.v[step], image_set.wire_positions.v[step+1], 0);
+					deposits += depth_resolve_pixel_both_edges(diff_value, i,j, back_depth[1]+step, front_depth[1]+step, back_depth[0]+step, front_depth[0]+step);
+					differences++;
 				}
 				else if (user_preferences.wireEdge && diff_value>0 || !(user_preferences.wireEdge) && diff_value<0) {
-					depth_resolve_pixel(diff_value, i,j, back_edge, front_edge, image_set.wire_positions.v[step], image_set.wire_positions.v[step+1], user_preferences.wireEdge);
+					e = user_preferences.wireEdge ? 1 : 0;
+					deposits += depth_resolve_pixel(diff_value, i,j, back_depth[e]+step, front_depth[e]+step, (BOOLEAN)e);
+					differences++;
 				}
 #ifdef DEBUG_1_PIXEL
 				if (verbosePixel) printf("\n∆ pixel[%lu] values = %g",step,diff_value);
@@ -698,127 +1326,272 @@ void depth_resolve(
 #endif
 		}
 	}
+	CHECK_FREE(depth_block);
+	}
+	CHECK_FREE(wire_y);
+	CHECK_FREE(wire_z);
 #ifdef DEBUG_1_PIXEL
 	verbosePixel = 0;
 #endif
+	add_stripe_depth_intensity((size_t)(i_stop - i_start + 1));			/* accumulate intensity vs depth of this stripe for the summary file */
+	if (metrics) {
+		metrics->difference = t1 - t0;
+		metrics->resolve = monotonicSeconds() - t1;
+		metrics->pixels = active_pixels.row_start[i_stop+1] - active_pixels.row_start[i_start];
+		metrics->differences = differences;
+		metrics->deposits = deposits;
+	}
 	return;
 }
 
 
-/* Given the difference intensity at one pixel for two wire positions, distribute the difference intensity into the depth histogram */
-/* This routine only tests for zero pixel_intensity, it does not avoid negative intensities,  this routine can accumulate negative intensities. */
+/* add the total intensity in each of the depth resolved images of the current stripe to image_set.depth_intensity */
+/* The sum for each depth is always taken in the same order (row by row), so the result does not depend on the number of threads */
+/* only active pixels can have any intensity, so only they are summed */
+void add_stripe_depth_intensity(
+	size_t	rows)							/* number of rows in this stripe, the last stripe may be narrower than image_set.depth_resolved */
+{
+	long	m;								/* index to depth, signed for the OpenMP loop */
+	size_t	i, k;
+	size_t	*row_start;						/* active pixels of the current stripe */
+	double	sum;
+
+	row_start = active_pixels.row_start + imaging_parameters.current_selection_start;
+#ifdef _OPENMP
+	#pragma omp parallel for private(sum,i,k) num_threads(NUM_THREADS)
+#endif
+	for (m=0; m < (long)image_set.depth_resolved.size; m++) {
+		sum = 0.;
+		for (i=0; i < rows; i++) {
+			for (k=row_start[i]; k < row_start[i+1]; k++) sum += STEP_PTR(image_set.depth_resolved, i, (size_t)active_pixels.j[k])[m];
+		}
+		image_set.depth_intensity.v[m] += sum;
+	}
+}
+
+
+/* Given the difference intensity at one pixel for two wire positions, set up the trapezoid of intensity vs depth for one edge of the wire */
+/* returns 0 if the trapezoid does not overlap the depth-resolved region or has no area, then there is nothing to deposit */
 /* This routine assumes that the wire is moving "forward" */
-void depth_resolve_pixel(
+int make_depth_trapezoid(
 	double pixel_intensity,				/* difference of the intensity at the two wire positions */
-	size_t	i,							/* indicies to the the pixel being processed, relative to the full stored image, range is (xdim,ydim) */
-	size_t	j,
-	point_xyz back_edge,				/* xyz postition of the trailing edge of the pixel in beam line coords relative to the Si */
-	point_xyz front_edge,				/* xyz postition of the leading edge of the pixel in beam line coords relative to the Si */
-	point_xyz wire_position_1,			/* first wire position (xyz) in beam line coords relative to the Si */
-	point_xyz wire_position_2,			/* second wire position (xyz) in beam line coords relative to the Si */
-	BOOLEAN use_leading_wire_edge)		/* true=(use leading endge of wire), false=(use trailing edge of wire) */
+	const double *back_depth,			/* depths from the trailing edge of the pixel, [0] for the first wire position, [1] for the second, from edge_depths_all_steps() */
+	const double *front_depth,			/* depths from the leading edge of the pixel, [0] for the first wire position, [1] for the second */
+	BOOLEAN use_leading_wire_edge,		/* true=(use leading endge of wire), false=(use trailing edge of wire) */
+	depth_trapezoid *t)					/* the result */
 {
-	double	partial_start;					/* trapezoid parameters, depth where partial intensity begins (micron) */
-	double	full_start;						/* depth where full pixel intensity begins (micron) */
-	double	full_end;						/* depth where full pixel intensity ends (micron) */
-	double	partial_end;					/* depth where partial pixel intensity ends (micron) */
-	double	area;							/* area of trapezoid */
 	double	maxDepth;						/* depth of deepest reconstructed image (micron) */
 	double	dDepth;							/* local version of user_preferences.depth_resolution */
-	long	m;								/* index to depth */
 /*	double	depthOffset=0.0;				// depth correction for this pixel */
 
-	if (pixel_intensity==0) return;											/* do not process pixels without intensity */
-	pixel_intensity = use_leading_wire_edge ? pixel_intensity : -pixel_intensity;	/* invert intensity for trailing edge */
+	if (pixel_intensity==0) return 0;										/* do not process pixels without intensity */
+	t->intensity = use_leading_wire_edge ? pixel_intensity : -pixel_intensity;	/* invert intensity for trailing edge */
 
 	dDepth = user_preferences.depth_resolution;								/* just a local copy */
 	maxDepth = dDepth*(image_set.depth_resolved.size- 1) + user_preferences.depth_start;	/* max reconstructed depth (mciron) */
 	/* change maxDepth by depth offset DDDDDDDDDDDDDD */
-	
+
 	/* get the depths over which the intensity from this pixel could originate.  These points define the trapezoid. */
-	partial_end = pixel_xyz_to_depth(back_edge, wire_position_2, use_leading_wire_edge);
-	partial_start = pixel_xyz_to_depth(front_edge, wire_position_1, use_leading_wire_edge);
+	t->partial_end = back_depth[1];
+	t->partial_start = front_depth[0];
 	/* change partial_end and partial_start by depth offset DDDDDDDDDDDDDD */
-	if (partial_end < user_preferences.depth_start || partial_start > maxDepth) return;		/* trapezoid does not overlap depth-resolved region, do not process */
+	if (t->partial_end < user_preferences.depth_start || t->partial_start > maxDepth) return 0;	/* trapezoid does not overlap depth-resolved region, do not process */
 
-	full_start = pixel_xyz_to_depth(back_edge, wire_position_1, use_leading_wire_edge);
-	full_end = pixel_xyz_to_depth(front_edge, wire_position_2, use_leading_wire_edge);
+	t->full_start = back_depth[0];
+	t->full_end = front_depth[1];
 	/* change full_start and full_end by depth offset DDDDDDDDDDDDDD */
-	if (full_end < full_start) {			/* in case mid points are backwards, ensure proper order by swapping */
+	if (t->full_end < t->full_start) {		/* in case mid points are backwards, ensure proper order by swapping */
 		double swap;
-		swap = full_end;
-		full_end = full_start;
-		full_start = swap;
+		swap = t->full_end;
+		t->full_end = t->full_start;
+		t->full_start = swap;
 	}
-	area = (full_end + partial_end - full_end - partial_start) / 2;			/* area of trapezoid assuming a height of 1, used for normalizing */
-	if (area < 0 || isnan(area)) return;									/* do not process if trapezoid has no area (or is NAN) */
+	t->area = (t->full_end + t->partial_end - t->full_end - t->partial_start) / 2;	/* area of trapezoid assuming a height of 1, used for normalizing */
+	if (t->area < 0 || isnan(t->area)) return 0;							/* do not process if trapezoid has no area (or is NAN) */
 
 	long imax = (long)image_set.depth_resolved.size- 1;						/* imax is maximum allowed value of index */
-	long start_index, end_index;											/* range of output images for this trapezoid */
-	start_index = (long)floor((partial_start - user_preferences.depth_start) / dDepth);
-	start_index = MAX((long)0,start_index);									/* start_index lie in range [0,imax] */
-	start_index = MIN(imax,start_index);
-	end_index = (long)ceil((partial_end - user_preferences.depth_start) / dDepth);
-	end_index = MAX(start_index,end_index);									/* end_index must lie in range [start_index, imax] */
-	end_index = MIN(imax,end_index);
+	t->start_index = (long)floor((t->partial_start - user_preferences.depth_start) / dDepth);
+	t->start_index = MAX((long)0,t->start_index);							/* start_index lie in range [0,imax] */
+	t->start_index = MIN(imax,t->start_index);
+	t->end_index = (long)ceil((t->partial_end - user_preferences.depth_start) / dDepth);
+	t->end_index = MAX(t->start_index,t->end_index);						/* end_index must lie in range [start_index, imax] */
+	t->end_index = MIN(imax,t->end_index);
+
+	t->ordered = (t->partial_start <= t->full_start && t->full_end <= t->partial_end);	/* full_start <= full_end already */
+	t->up = (t->full_start > t->partial_start) ? 0.5 / (t->full_start - t->partial_start) : 0.;
+	t->down = (t->partial_end > t->full_end) ? 0.5 / (t->partial_end - t->full_end) : 0.;
+	t->cdf_low = depth_trapezoid_cdf(t, index_to_beam_depth(t->start_index) - dDepth*0.5);
 
 #ifdef DEBUG_1_PIXEL
-	if (verbosePixel) printf("\n\ttrapezoid over range (% .3f, % .3f) micron == image index[%ld, %ld],  area=%g",partial_start,partial_end,start_index,end_index,area);
+	if (verbosePixel) printf("\n\ttrapezoid over range (% .3f, % .3f) micron == image index[%ld, %ld],  area=%g",t->partial_start,t->partial_end,t->start_index,t->end_index,t->area);
 #endif
+	return 1;
+}
 
-	double area_in_range = 0;
-	double depth_1, depth_2, height_1, height_2;							/* one part of the trapezoid that overlaps the current bin */
-	double depth_i, depth_i1;												/* depth range of depth bin i */
-	for (m = start_index; m <= end_index; m++) {							/* loop over possible depth indicies (m is index to depth-resolved image) */
-		area_in_range = 0;
-		depth_i = index_to_beam_depth(m) - (dDepth*0.5);					/* ends of current depth bin */
-		depth_i1 = depth_i + dDepth;
-
-		if (full_start > depth_i && partial_start < depth_i1) {				/* this depth bin overlaps first part of trapezoid (sloping up from zero) */
-			depth_1 = MAX(depth_i,partial_start);
-			depth_2 = MIN(depth_i1,full_start);
-			height_1 = get_trapezoid_height(partial_start, partial_end, full_start, full_end, depth_1);
-			height_2 = get_trapezoid_height(partial_start, partial_end, full_start, full_end, depth_2);
-			area_in_range += ((height_1 + height_2) / 2 * (depth_2 - depth_1));
-		}
 
-		if (full_end > depth_i && full_start < depth_i1) {					/* this depth bin overlaps second part of trapezoid (the flat top) */
-			depth_1 = MAX(depth_i,full_start);
-			depth_2 = MIN(depth_i1,full_end);
-			area_in_range += (depth_2 - depth_1);							/* the height of both points is 1, so area is just the width */
-		}
+/* area of an ordered trapezoid of height 1 from -infinity to depth, it is piecewise quadratic: */
+/*	(x-ps)^2/(2*(fs-ps)) on the way up, then rises linearly along the flat top, then (x-fe) - (x-fe)^2/(2*(pe-fe)) on the way down */
+/* each part is evaluated with the depth clamped to that part, so there are no branches */
+double depth_trapezoid_cdf(
+	const depth_trapezoid *t,
+	double	depth)						/* depth along the beam (micron) */
+{
+	double	u, v, w;
+	u = MIN(MAX(depth,t->partial_start),t->full_start) - t->partial_start;	/* distance into each of the three parts */
+	v = MIN(MAX(depth,t->full_start),t->full_end) - t->full_start;
+	w = MIN(MAX(depth,t->full_end),t->partial_end) - t->full_end;
+	return u*u*t->up + v + (w - w*w*t->down);
+}
 
-		if (partial_end > depth_i && full_end < depth_i1) {					/* this depth bin overlaps third part of trapezoid (sloping down to zero) */
-			depth_1 = MAX(depth_i,full_end);
-			depth_2 = MIN(depth_i1,partial_end);
-			height_1 = get_trapezoid_height(partial_start, partial_end, full_start, full_end, depth_1);
-			height_2 = get_trapezoid_height(partial_start, partial_end, full_start, full_end, depth_2);
-			area_in_range += ((height_1 + height_2) / 2 * (depth_2 - depth_1));
-		}
 
-		if (area_in_range>0) add_pixel_intensity_at_index(i,j, pixel_intensity * (area_in_range / area), m);		/* do not accumulate zeros */
-	}
+/* the part of the area of trapezoid t that lies in depth bin m, the bins must be taken in order starting at t->start_index */
+/* for an ordered trapezoid this is the difference of the cdf at the ends of the bin, so the bins always add up to the area */
+double depth_trapezoid_next_bin(
+	depth_trapezoid *t,
+	long	m)							/* index to depth-resolved image */
+{
+	double	cdf_high, area_in_range;
+
+	if (!(t->ordered)) return depth_trapezoid_in_bin(t, m);				/* does not happen with a forward moving wire */
+	cdf_high = depth_trapezoid_cdf(t, index_to_beam_depth(m+1) - user_preferences.depth_resolution*0.5);
+	area_in_range = cdf_high - t->cdf_low;
+	t->cdf_low = cdf_high;
+	return area_in_range;
 }
 
-void add_pixel_intensity_at_index(
-	size_t	i,							/* indicies to pixel, relative to the full stored image, range is (xdim,ydim) */
-	size_t	j,
-	double intensity,					/* intensity to add */
-	long index)							/* depth index */
+
+/* the part of the area of trapezoid t that lies in depth bin m, done piece by piece, this works even if t is not ordered */
+double depth_trapezoid_in_bin(
+	const depth_trapezoid *t,
+	long	m)							/* index to depth-resolved image */
 {
-	double *d;							/* pointer to value in gsl_matrix */
+	double	dDepth = user_preferences.depth_resolution;
+	double	area_in_range = 0;
+	double	depth_1, depth_2, height_1, height_2;							/* one part of the trapezoid that overlaps the current bin */
+	double	depth_i, depth_i1;												/* depth range of depth bin i */
+
+	depth_i = index_to_beam_depth(m) - (dDepth*0.5);						/* ends of current depth bin */
+	depth_i1 = depth_i + dDepth;
+
+	if (t->full_start > depth_i && t->partial_start < depth_i1) {			/* this depth bin overlaps first part of trapezoid (sloping up from zero) */
+		depth_1 = MAX(depth_i,t->partial_start);
+		depth_2 = MIN(depth_i1,t->full_start);
+		height_1 = get_trapezoid_height(t->partial_start, t->partial_end, t->full_start, t->full_end, depth_1);
+		height_2 = get_trapezoid_height(t->partial_start, t->partial_end, t->full_start, t->full_end, depth_2);
+		area_in_range += ((height_1 + height_2) / 2 * (depth_2 - depth_1));
+	}
 
-#ifdef DEBUG_1_PIXEL
-	if (verbosePixel && i==pixelTESTi && j==pixelTESTj) printf("\n\t\t adding %g to pixel [%lu, %lu] at depth index %ld",intensity,i,j,index);
-#endif
+	if (t->full_end > depth_i && t->full_start < depth_i1) {				/* this depth bin overlaps second part of trapezoid (the flat top) */
+		depth_1 = MAX(depth_i,t->full_start);
+		depth_2 = MIN(depth_i1,t->full_end);
+		area_in_range += (depth_2 - depth_1);								/* the height of both points is 1, so area is just the width */
+	}
 
-	if (index < 0 || (unsigned long)index >= image_set.depth_resolved.size) return;	/* ignore if index is outside of valid range */
-	i -= imaging_parameters.current_selection_start;	/* get pixel indicies relative to this stripe */
+	if (t->partial_end > depth_i && t->full_end < depth_i1) {				/* this depth bin overlaps third part of trapezoid (sloping down to zero) */
+		depth_1 = MAX(depth_i,t->full_end);
+		depth_2 = MIN(depth_i1,t->partial_end);
+		height_1 = get_trapezoid_height(t->partial_start, t->partial_end, t->full_start, t->full_end, depth_1);
+		height_2 = get_trapezoid_height(t->partial_start, t->partial_end, t->full_start, t->full_end, depth_2);
+		area_in_range += ((height_1 + height_2) / 2 * (depth_2 - depth_1));
+	}
+	return area_in_range;
+}
+
+
+/* Given the difference intensity at one pixel for two wire positions, distribute the difference intensity into the depth histogram */
+/* This routine only tests for zero pixel_intensity, it does not avoid negative intensities,  this routine can accumulate negative intensities. */
+/* returns the number of depth bins that got some intensity */
+long depth_resolve_pixel(
+	double pixel_intensity,				/* difference of the intensity at the two wire positions */
+	size_t	i,							/* indicies to the the pixel being processed, relative to the full stored image, range is (xdim,ydim) */
+	size_t	j,
+	const double *back_depth,			/* depths from the trailing edge of the pixel, [0] for the first wire position, [1] for the second, from edge_depths_all_steps() */
+	const double *front_depth,			/* depths from the leading edge of the pixel, [0] for the first wire position, [1] for the second */
+	BOOLEAN use_leading_wire_edge)		/* true=(use leading endge of wire), false=(use trailing edge of wire) */
+{
+	depth_trapezoid t;
+	double	area_in_range;
+	long	m;								/* index to depth */
+	long	n=0;							/* number of deposits */
 
-	/* get a pointer to the existing value of that pixel at that depth */
-	d = gsl_matrix_ptr(image_set.depth_resolved.v[index], i,j);
-	*d += intensity;
-	image_set.depth_intensity.v[index] += intensity;	/* accumulate for the summary file */
+	if (!make_depth_trapezoid(pixel_intensity, back_depth, front_depth, use_leading_wire_edge, &t)) return 0;
+	for (m = t.start_index; m <= t.end_index; m++) {						/* loop over possible depth indicies (m is index to depth-resolved image) */
+		area_in_range = depth_trapezoid_next_bin(&t, m);
+		if (area_in_range>0) { add_pixel_intensity_at_index(i,j, t.intensity * (area_in_range / t.area), m); n++; }	/* do not accumulate zeros */
+	}
+	return n;
+}
+
+
+/* same as depth_resolve_pixel() for the leading and then the trailing edge of the wire, but the two trapezoids are set up together */
+/* and deposited in one pass where they overlap.  Each depth bin still gets the leading edge part first, so the result is identical */
+/* returns the number of deposits */
+long depth_resolve_pixel_both_edges(
+	double pixel_intensity,				/* difference of the intensity at the two wire positions */
+	size_t	i,							/* indicies to the the pixel being processed, relative to the full stored image, range is (xdim,ydim) */
+	size_t	j,
+	const double *back_lead,			/* depths of the pixel edges, as for depth_resolve_pixel(), for the leading edge of the wire */
+	const double *front_lead,
+	const double *back_trail,			/* and for the trailing edge of the wire */
+	const double *front_trail)
+{
+	depth_trapezoid	lead, trail;
+	int		useLead, useTrail;
+	double	area_in_range;
+	long	m;
+	long	n=0;							/* number of deposits */
+
+	useLead = make_depth_trapezoid(pixel_intensity, back_lead, front_lead, 1, &lead);
+	useTrail = make_depth_trapezoid(pixel_intensity, back_trail, front_trail, 0, &trail);
+	if (useLead && useTrail && lead.start_index <= trail.end_index && trail.start_index <= lead.end_index) {
+		for (m = MIN(lead.start_index,trail.start_index); m <= MAX(lead.end_index,trail.end_index); m++) {	/* the two overlap, one pass over both */
+			if (lead.start_index <= m && m <= lead.end_index) {
+				area_in_range = depth_trapezoid_next_bin(&lead, m);
+				if (area_in_range>0) { add_pixel_intensity_at_index(i,j, lead.intensity * (area_in_range / lead.area), m); n++; }
+			}
+			if (trail.start_index <= m && m <= trail.end_index) {
+				area_in_range = depth_trapezoid_next_bin(&trail, m);
+				if (area_in_range>0) { add_pixel_intensity_at_index(i,j, trail.intensity * (area_in_range / trail.area), m); n++; }
+			}
+		}
+		return n;
+	}
+	for (m = lead.start_index; useLead && m <= lead.end_index; m++) {		/* separate, so just do one after the other */
+		area_in_range = depth_trapezoid_next_bin(&lead, m);
+		if (area_in_range>0) { add_pixel_intensity_at_index(i,j, lead.intensity * (area_in_range / lead.area), m); n++; }
+	}
+	for (m = trail.start_index; useTrail && m <= trail.end_index; m++) {
+		area_in_range = depth_trapezoid_next_bin(&trail, m);
+		if (area_in_range>0) { add_pixel_intensity_at_index(i,j, trail.intensity * (area_in_range / trail.area), m); n++; }
+	}
+	return n;
+}
+
+void add_pixel_intensity_at_index(
+	size_t	i,							/* indicies to pixel, relative to the full stored image, range is (xdim,ydim) */
+	size_t	j,
+	double intensity,					/* intensity to add */
+	long index)							/* depth index */
+{
+#ifdef DEBUG_1_PIXEL
+	if (verbosePixel && i==pixelTESTi && j==pixelTESTj) printf("\n\t\t adding %g to pixel [%lu, %lu] at depth index %ld",intensity,i,j,index);
+#endif
+
+	if (index < 0 || (unsigned long)index >= image_set.depth_resolved.size) return;	/* ignore if index is outside of valid range */
+	i -= imaging_parameters.current_selection_start;	/* get pixel indicies relative to this stripe */
+
+	/* all depths of a pixel are next to each other, so the depths of one trapezoid are adjacent */
+	/* image_set.depth_intensity is accumulated for the whole stripe in add_stripe_depth_intensity() */
+#ifdef STRIPE_KAHAN
+	stripe_real *sum = STEP_PTR(image_set.depth_resolved, i, j) + index;
+	stripe_real *c = image_set.depth_resolved.c + (sum - image_set.depth_resolved.v);	/* compensation of this sum */
+	stripe_real y = (stripe_real)intensity - *c;
+	stripe_real t = *sum + y;
+	*c = (t - *sum) - y;								/* the low part of y that was lost in t */
+	*sum = t;
+#else
+	STEP_PTR(image_set.depth_resolved, i, j)[index] += intensity;
+#endif
 }
 
 
@@ -853,119 +1626,304 @@ double get_trapezoid_height(
 
 
 
-/* Returns depth (starting point of ray with one end point at point_on_ccd_xyz that is tangent */
-/* to leading (or trailing) edge of the wire and intersects the incident beam.  The returned depth is relative to the Si position (origin) */
-/* depth is measured along the incident beam from the origin, not just the z value. */
-double pixel_xyz_to_depth(
-	point_xyz point_on_ccd_xyz,			/* end point of ray, an xyz location on the detector */
-	point_xyz wire_position,			/* wire center, used to find the tangent point, has been PM500 corrected, origin subtracted, rotated by rho */
-	BOOLEAN use_leading_wire_edge)		/* which edge of wire are using here, TRUE for leading edge */
+
+/* fill pixel_edges with the rho-rotated (y,z) of every pixel edge along j for the whole ROI.
+ * Edge k of row i is at pixel [i, k-0.5], so each row has nROI_j+1 edges.
+ * If edgeCachePath is set, the edges are read from that file when it was made with the same geometry and ROI, otherwise they are computed and saved there. */
+void make_pixel_edges(void)
 {
-	point_xyz	pixelPos;								/* current pixel position */
-	point_xyz	ki;										/* incident beam direction */
-	point_xyz	S;										/* point where rays intersects incident beam */
-	double		pixel_to_wireCenter_y;					/* vector from pixel to wire center, y,z coordinates */
-	double		pixel_to_wireCenter_z;
-	double		pixel_to_wireCenter_len;				/* length of vector pixel_to_wireCenter (only y & z components) */
-	double		wire_radius;							/* wire radius */
-	double		phi0;									/* angle from yhat to wireCenter (measured at the pixel) */
-	double		dphi;									/* angle between line from detector to centre of wire and to tangent of wire */
-	double		tanphi;									/* phi is angle from yhat to tangent point on wire */
-	double		b_reflected;
-	double		depth;									/* the result */
-
-	/* change coordinate system so that wire axis lies along {1,0,0}, a rotated system */
-
-	ki.x = calibration.wire.ki.x;						/* ki = rho x {0,0,1} */
-	ki.y = calibration.wire.ki.y;
-	ki.z = calibration.wire.ki.z;
-	pixelPos = MatrixMultiply31(calibration.wire.rho,point_on_ccd_xyz);	/* pixelPos = rho x point_on_ccd_xyz, rotate pxiel center to new coordinate system */
-
-	pixel_to_wireCenter_y = wire_position.y - pixelPos.y; /* vector from point on detector to wire centre. */
-	pixel_to_wireCenter_z = wire_position.z - pixelPos.z;
-	pixel_to_wireCenter_len = sqrt(pixel_to_wireCenter_y*pixel_to_wireCenter_y + pixel_to_wireCenter_z*pixel_to_wireCenter_z);/* length of vector pixel_to_wireCenter */
-
-	wire_radius = calibration.wire.diameter / 2;		/* wire radius */
-	phi0 = atan2(pixel_to_wireCenter_z , pixel_to_wireCenter_y);	/* angle from yhat to wireCenter (measured at the pixel) */
-	dphi = asin(wire_radius / pixel_to_wireCenter_len);	/* angle between line from detector to centre of wire and line to tangent of wire */
-	tanphi = tan(phi0+(use_leading_wire_edge ? -dphi : dphi));	/* phi is angle from yhat to V (measured at the pixel) */
-
-	b_reflected = pixelPos.z - pixelPos.y * tanphi;		/* line from pixel to tangent point is:   z = y*tan(phio±dphi) + b */
-	/* line of incident beam is:   y = kiy/kiz * z		Thiis line goes through origin, so intercept is 0 */
-	/* find intersection of this line and line from pixel to tangent point */
-	S.z = b_reflected / (1-tanphi * ki.y / ki.z);		/* intersection of two lines at this z value */
-	S.y = ki.y / ki.z * S.z;							/* corresponding y of point on incident beam */
-	S.x = ki.x / ki.z * S.z;							/* corresponding z of point on incident beam */
-	depth = DOT3(ki,S);
-
-	/*	if (verbosePixel) {
-	 *		printf("\n    -- pixel on detector = {%.3f, %.3f, %.3f}",point_on_ccd_xyz.x,point_on_ccd_xyz.y,point_on_ccd_xyz.z);
-	 *		printf("\n       wire center = {%.3f, %.3f, %.3f} relative to Si (micron)",wire_position.x,wire_position.y,wire_position.z);
-	 *		printf("\n       pixel_to_wireCenter = {%.9lf, %.9lf}µm,  |v|=%.9f",pixel_to_wireCenter_y,pixel_to_wireCenter_z,pixel_to_wireCenter_len);
-	 *		printf("\n       phi0 = %g (rad),   dphi = %g (rad),   tanphi = %g,   depth = %.2f (micron)\n",phi0,dphi,tanphi,DOT3(ki,S));
-	 *	}
-	 */
-	return depth;										/* depth measured along incident beam (remember that ki is normalized) */
+	unsigned long long key;				/* identifies the geometry and ROI used to make the edges */
+	size_t	N;							/* total number of edges */
+	long	i;							/* row, signed for the OpenMP loop */
+	size_t	k;
+	point_ccd pixel_edge;				/* pixel indicies for an edge of a pixel (e.g. [117,90.5]) */
+	point_xyz xyz;
+
+	key = pixel_edges_key();
+	if (pixel_edges.y && pixel_edges.key == key) {					/* same geometry and ROI as the previous scan of a batch */
+		if (verbose > 0) printf("\nre-using the pixel edges of the previous scan");
+		return;
+	}
+	delete_pixel_edges();
+	pixel_edges.Ni = (size_t)imaging_parameters.nROI_i;
+	pixel_edges.Nj = (size_t)imaging_parameters.nROI_j + 1;
+	pixel_edges.key = key;
+	N = pixel_edges.Ni * pixel_edges.Nj;
+	pixel_edges.y = calloc(N,sizeof(double));
+	pixel_edges.z = calloc(N,sizeof(double));
+	if (!(pixel_edges.y) || !(pixel_edges.z)) { fprintf(stderr,"\ncannot allocate space for pixel_edges, %lu points\n",N); exit(1); }
+
+	if (edgeCachePath[0]) {
+		if (!read_pixel_edges(edgeCachePath,key)) {
+			if (verbose > 0) printf("\nread pixel edges from '%s'",edgeCachePath);
+			return;
+		}
+	}
+
+#ifdef _OPENMP
+	#pragma omp parallel for private(k,pixel_edge,xyz) num_threads(NUM_THREADS)
+#endif
+	for (i=0; i < (long)pixel_edges.Ni; i++) {
+		pixel_edge.i = (double)i;
+		for (k=0; k < pixel_edges.Nj; k++) {
+			pixel_edge.j = (double)k - 0.5;									/* back edge of pixel k, and front edge of pixel k-1 */
+			xyz = pixel_to_point_xyz(pixel_edge);
+			xyz = MatrixMultiply31(calibration.wire.rho,xyz);				/* rotate to system with wire axis along {1,0,0}, as in pixel_xyz_to_depth() */
+			pixel_edges.y[i*pixel_edges.Nj + k] = xyz.y;
+			pixel_edges.z[i*pixel_edges.Nj + k] = xyz.z;
+		}
+	}
+	if (edgeCachePath[0] && RANK == 0) write_pixel_edges(edgeCachePath,key);	/* with MPI, the other ranks just compute them */
 }
 
 
+void delete_pixel_edges(void)
+{
+	CHECK_FREE(pixel_edges.y);
+	CHECK_FREE(pixel_edges.z);
+	pixel_edges.Ni = pixel_edges.Nj = 0;
+	pixel_edges.key = 0;
+}
 
 
+#define PIXEL_EDGES_MAGIC "WSEDGES1"
+/* FNV-1a hash of everything that goes into the pixel edges: the calibration (detector & wire) and the ROI & binning of the images */
+unsigned long long pixel_edges_key(void)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	unsigned char *b;
+	size_t	n;
+	int		roi[8];
+
+	roi[0] = imaging_parameters.nROI_i;		roi[1] = imaging_parameters.nROI_j;
+	roi[2] = imaging_parameters.starti;		roi[3] = imaging_parameters.endi;
+	roi[4] = imaging_parameters.startj;		roi[5] = imaging_parameters.endj;
+	roi[6] = imaging_parameters.bini;		roi[7] = imaging_parameters.binj;
+
+	for (b=(unsigned char *)&calibration, n=0; n<sizeof(calibration); n++) { h ^= b[n]; h *= 1099511628211ULL; }
+	for (b=(unsigned char *)roi, n=0; n<sizeof(roi); n++) { h ^= b[n]; h *= 1099511628211ULL; }
+#ifdef USE_DISTORTION_CORRECTION
+	for (b=(unsigned char *)distortionPath; *b; b++) { h ^= *b; h *= 1099511628211ULL; }
+#endif
+	return h;
+}
+
 
-/* Take the indicies to a detector pixel and returns an 3vector point in beam-line coordinates of the pixel centre
- * Here is the only place where the corrections for a ROI (binning & sub-region of detector) has been used.  Hopefully it is the only place needed.
- * All pixel values (binned & un-binned) are zero based.
- * This routine uses the same conventions a used in Igor
- */
-point_xyz pixel_to_point_xyz(
-	point_ccd pixel)					/* input, binned ROI (zero-based) pixel value on detector, can be non-integer, and can lie outside range (e.g. -05 is acceptable) */
+/* read pixel_edges from fileName, returns 0 on success, 1 if the file is missing or was made with a different key or size */
+int read_pixel_edges(
+	char	*fileName,					/* full path to the cache file */
+	unsigned long long key)				/* key from pixel_edges_key() */
 {
-	point_xyz coordinates;								/* point with coordinates in R3 to return */
-	point_ccd corrected_pixel;							/* pixel data to be filled by the peak_correction method */
-	double	x,y,z;										/* 3d coordinates */
+	FILE	*f=NULL;
+	char	magic[8];
+	unsigned long long fkey, Ni, Nj;
+	size_t	N;
+	int		err=1;
+
+	if (!(f=fopen(fileName,"rb"))) return 1;
+	N = pixel_edges.Ni * pixel_edges.Nj;
+	if (fread(magic,1,8,f)!=8 || strncmp(magic,PIXEL_EDGES_MAGIC,8)) goto exitPoint;
+	if (fread(&fkey,sizeof(fkey),1,f)!=1 || fkey!=key) goto exitPoint;
+	if (fread(&Ni,sizeof(Ni),1,f)!=1 || Ni!=pixel_edges.Ni) goto exitPoint;
+	if (fread(&Nj,sizeof(Nj),1,f)!=1 || Nj!=pixel_edges.Nj) goto exitPoint;
+	if (fread(pixel_edges.y,sizeof(double),N,f)!=N) goto exitPoint;
+	if (fread(pixel_edges.z,sizeof(double),N,f)!=N) goto exitPoint;
+	err = 0;
+
+	exitPoint:
+	fclose(f);
+	return err;
+}
 
-#warning "here is the only place where the pixel is swapped for the transpose in an HDF5 file"
-	corrected_pixel.i = pixel.j;						/* the transpose swap needed with the HDF5 files */
-	corrected_pixel.j = pixel.i;
 
-	/* convert pixel from binned ROI value to full frame un-binned pixels, both binned and un-binned are zero based. */
-	corrected_pixel.i = corrected_pixel.i * imaging_parameters.bini + imaging_parameters.starti;		/* convert from binned ROI to full chip un-binned pixel */
-	corrected_pixel.j = corrected_pixel.j * imaging_parameters.binj + imaging_parameters.startj;
-	corrected_pixel.i += (imaging_parameters.bini-1)/2.;	/* move from leading edge of pixel to the pixel center(e) */
-	corrected_pixel.j += (imaging_parameters.binj-1)/2.;	/*	this is needed because the center of a pixel changes with binning */
+/* save pixel_edges to fileName, a failure only prints a warning since the cache is not needed */
+void write_pixel_edges(
+	char	*fileName,					/* full path to the cache file */
+	unsigned long long key)				/* key from pixel_edges_key() */
+{
+	FILE	*f=NULL;
+	unsigned long long Ni, Nj;
+	size_t	N;
+	int		err=1;
+
+	if (!(f=fopen(fileName,"wb"))) { printf("\nWARNING -- write_pixel_edges(), failed to open file '%s'\n",fileName); return; }
+	Ni = pixel_edges.Ni;
+	Nj = pixel_edges.Nj;
+	N = pixel_edges.Ni * pixel_edges.Nj;
+	if (fwrite(PIXEL_EDGES_MAGIC,1,8,f)!=8) goto exitPoint;
+	if (fwrite(&key,sizeof(key),1,f)!=1) goto exitPoint;
+	if (fwrite(&Ni,sizeof(Ni),1,f)!=1 || fwrite(&Nj,sizeof(Nj),1,f)!=1) goto exitPoint;
+	if (fwrite(pixel_edges.y,sizeof(double),N,f)!=N) goto exitPoint;
+	if (fwrite(pixel_edges.z,sizeof(double),N,f)!=N) goto exitPoint;
+	err = 0;
+
+	exitPoint:
+	if (fclose(f)) err = 1;
+	if (err) { printf("\nWARNING -- write_pixel_edges(), failed writing file '%s'\n",fileName); unlink(fileName); }
+	else if (verbose > 0) printf("\nsaved pixel edges to '%s'",fileName);
+}
 
-#ifdef DEBUG_1_PIXEL
-	if (verbosePixel) printf("\nin pixel_to_point_xyz(), pixel = [%g, %g] (binned ROI, on input),   size is (%g, %g) (micron)",pixel.i,pixel.j,calibration.pixel_size_i,calibration.pixel_size_j);
-	if (verbosePixel) printf("\n   corrected_pixel = [%g, %g] (un-binned full chip pixels)",corrected_pixel.i,corrected_pixel.j);
-#endif
-	corrected_pixel = PEAKCORRECTION(corrected_pixel);		/* do the distortion correction */
 
-#if defined(DEBUG_ALL) && defined(USE_DISTORTION_CORRECTION)
-	if (verbosePixel) printf("\n   distortion corrected_pixel = [%g, %g] (un-binned full chip pixels)",corrected_pixel.i,corrected_pixel.j);
-#endif
+/* key for the progress journal, a hash of everything that changes the depth resolved images: */
+/* the geometry and ROI (from pixel_edges_key()), the input images, and the reconstruction settings */
+unsigned long long progress_key(
+	char	*fn_base,					/* base name of input image files */
+	int		file_num_start,				/* index to first input image file */
+	int		file_num_end,				/* index to last input image file */
+	char	*normalization)				/* optional tag for normalization */
+{
+	unsigned long long h = pixel_edges_key();
+	unsigned char *b;
+	size_t	n;
+	double	settings[13];
+	char	*strings[3];
+	int		k;
+
+	settings[0] = user_preferences.depth_start;		settings[1] = user_preferences.depth_resolution;
+	settings[2] = user_preferences.NoutputDepths;	settings[3] = user_preferences.wireEdge;
+	settings[4] = user_preferences.out_pixel_type;	settings[5] = percent;
+	settings[6] = cutoff;							settings[7] = file_num_start;
+	settings[8] = file_num_end;						settings[9] = imaging_parameters.NinputImages;
+	settings[10] = (double)active_pixels.size;		settings[11] = sizeof(stripe_real);
+	settings[12] = SINGLE_OUTPUT_FILE;
+	strings[0] = fn_base;		strings[1] = normalization;		strings[2] = depthCorrectStr;
+
+	for (b=(unsigned char *)settings, n=0; n<sizeof(settings); n++) { h ^= b[n]; h *= 1099511628211ULL; }
+	for (k=0; k<3; k++) {
+		for (b=(unsigned char *)strings[k]; *b; b++) { h ^= *b; h *= 1099511628211ULL; }
+		h ^= 0xFF; h *= 1099511628211ULL;		/* so that "ab","c" differs from "a","bc" */
+	}
+	return h;
+}
 
-	/* get 3D coordinates in detector frame of the pixel */
-	x = (corrected_pixel.i - 0.5*(calibration.ccd_pixels_i - 1)) * calibration.pixel_size_i;	/* (x', y', z') position of pixel (detector frame) */
-	y = (corrected_pixel.j - 0.5*(calibration.ccd_pixels_j - 1)) * calibration.pixel_size_j;	/* note, in detector frame all points on detector have z'=0 */
-	/*if (REVERSE_X_AXIS) x = -x; */
 
-	x += calibration.P.x;									/* translate by P (P is from geoN.detector.P) */
-	y += calibration.P.y;
-	z  = calibration.P.z;
+/* read the progress journal fileName into p, returns 0 on success, 1 if the file is missing, damaged, or made with a different key */
+/* on failure p is left empty (Ndone = 0 and chunk_rows = 0) */
+int read_progress(
+	char	*fileName,					/* full path to the journal, <outfile>progress.txt */
+	unsigned long long key,				/* key from progress_key() */
+	ws_progress *p)						/* gets the contents of the journal */
+{
+	FILE	*f=NULL;
+	unsigned long chunk_rows;
+	long	m;
+	int		k, n;
+	int		err=1;
+
+	memset(p, 0, sizeof(ws_progress));
+	if (!(f=fopen(fileName,"r"))) return 1;
+	if (fscanf(f," $progressKey %llx%*[^\n]",&(p->key))!=1 || p->key!=key) goto exitPoint;
+	if (fscanf(f," $chunkRows %lu%*[^\n]",&chunk_rows)!=1 || chunk_rows<1) goto exitPoint;
+	if (fscanf(f," $Ndepths %ld%*[^\n]",&(p->Ndepths))!=1 || p->Ndepths!=user_preferences.NoutputDepths) goto exitPoint;
+	if (fscanf(f," $stripesDone %d%*[^\n]",&(p->Ndone))!=1 || p->Ndone<0) goto exitPoint;
+	p->lo = calloc((size_t)MAX(p->Ndone,1),sizeof(int));
+	p->hi = calloc((size_t)MAX(p->Ndone,1),sizeof(int));
+	p->depth_intensity = calloc((size_t)p->Ndepths,sizeof(double));
+	if (!(p->lo) || !(p->hi) || !(p->depth_intensity)) goto exitPoint;
+	for (k=0; k<p->Ndone; k++) if (fscanf(f," %d %d",p->lo+k,p->hi+k)!=2) goto exitPoint;
+	n = 0;
+	if (fscanf(f," $depthIntensity%n%*[^\n]",&n)<0 || !n) goto exitPoint;
+	for (m=0; m<p->Ndepths; m++) if (fscanf(f," %lg",p->depth_intensity+m)!=1) goto exitPoint;
+	n = 0;
+	if (fscanf(f," $end%n",&n)<0 || !n) goto exitPoint;	/* the last line, so the whole journal was read */
+	p->chunk_rows = (size_t)chunk_rows;
+	err = 0;
+
+	exitPoint:
+	fclose(f);
+	if (err) free_progress(p);
+	return err;
+}
+
 
-	/* finally, rotate (x,y,z) by rotation vector geo.detector.R using precomputed matrix calibration.detector_rotation[3][3] */
-	coordinates.x = calibration.detector_rotation[0][0] * x + calibration.detector_rotation[0][1] * y + calibration.detector_rotation[0][2] * z;
-	coordinates.y = calibration.detector_rotation[1][0] * x + calibration.detector_rotation[1][1] * y + calibration.detector_rotation[1][2] * z;
-	coordinates.z = calibration.detector_rotation[2][0] * x + calibration.detector_rotation[2][1] * y + calibration.detector_rotation[2][2] * z;
-#ifdef DEBUG_1_PIXEL
-	if (verbosePixel) printf("\n   pixel xyz coordinates = (%g, %g, %g)\n",coordinates.x,coordinates.y,coordinates.z);
-#endif
-	return coordinates;									/* return point_xyz coordinates */
+/* write the progress journal after the first Ndone stripes have been written, returns 0 on success */
+/* the output images are flushed and synced to disk first, and the journal is written to a temporary file that */
+/* then replaces fileName, so after a crash the journal always describes output that is really on the disk */
+int write_progress(
+	char	*fileName,					/* full path to the journal, <outfile>progress.txt */
+	unsigned long long key,				/* key from progress_key() */
+	size_t	chunk_rows,					/* rows in one band of the output images */
+	int		Ndone,						/* number of stripes done */
+	int		*lo,						/* first and last rows of the stripes done */
+	int		*hi,
+	double	*depth_intensity)			/* image_set.depth_intensity summed over the stripes done */
+{
+	FILE	*f=NULL;
+	char	tempName[FILENAME_MAX];
+	long	m;
+	int		k;
+	int		err=1;
+
+	HDF5_LOCK
+	if (stack_file_id>0) H5Fflush(stack_file_id,H5F_SCOPE_GLOBAL);	/* the files of each depth were closed after writing */
+	HDF5_UNLOCK
+	sync();												/* put the output images on the disk before the journal says they are there */
+
+	snprintf(tempName,FILENAME_MAX,"%s.tmp",fileName);
+	if (!(f=fopen(tempName,"w"))) { printf("\nWARNING -- write_progress(), failed to open file '%s'\n",tempName); return 1; }
+	if (fprintf(f,"$progressKey\t%016llx\t\t// input images, geometry, and settings of this reconstruction\n",key)<0) goto exitPoint;
+	fprintf(f,"$chunkRows\t%lu\t\t\t// rows in one band of the output images\n",(unsigned long)chunk_rows);
+	fprintf(f,"$Ndepths\t%d\t\t\t// number of output images\n",user_preferences.NoutputDepths);
+	fprintf(f,"$stripesDone\t%d\t\t\t// first and last rows of each stripe written\n",Ndone);
+	for (k=0; k<Ndone; k++) fprintf(f,"%d\t%d\n",lo[k],hi[k]);
+	fprintf(f,"$depthIntensity\t\t\t// total intensity at each depth of the stripes written\n");
+	for (m=0; m<user_preferences.NoutputDepths; m++) fprintf(f,"%.17g\n",depth_intensity[m]);	/* %.17g reads back exactly */
+	if (fprintf(f,"$end\n")<0 || fflush(f) || fsync(fileno(f))) goto exitPoint;
+	err = 0;
+
+	exitPoint:
+	if (fclose(f)) err = 1;
+	if (!err && rename(tempName,fileName)) err = 1;
+	if (err) { printf("\nWARNING -- write_progress(), failed writing file '%s'\n",fileName); unlink(tempName); }
+	return err;
 }
 
 
+/* free the space allocated by read_progress(), and mark p as empty */
+void free_progress(
+	ws_progress *p)
+{
+	CHECK_FREE(p->lo)
+	CHECK_FREE(p->hi)
+	CHECK_FREE(p->depth_intensity)
+	p->Ndone = 0;
+	p->chunk_rows = 0;
+}
 
 
+/* check that the output files left by an earlier run are what this run would make, returns 0 if they can be resumed */
+/* the image size, pixel type, and depth(s) must match output_header and the requested depths */
+int check_output_headers(
+	char	*fn_out_base)				/* base name of output image files */
+{
+	struct HDF5_Header head;
+	char	fname[FILENAME_MAX];
+	long	m, Ndepths = user_preferences.NoutputDepths;
+	double	tolerance = user_preferences.depth_resolution * 1e-3;
+	int		err;
+
+	for (m=0; m<Ndepths; m++) {
+		if (SINGLE_OUTPUT_FILE) sprintf(fname,"%s.h5",fn_out_base);
+		else sprintf(fname,"%s%ld.h5",fn_out_base,m);
+		err = readHDF5header(fname,&head);
+		HDF5cacheForget(fname);										/* it is re-opened for writing later */
+		if (err) { printf("\ncannot resume, cannot read the header of '%s'",fname); return 1; }
+		if (head.xdim!=output_header.xdim || head.ydim!=output_header.ydim || head.itype!=output_header.itype) {
+			printf("\ncannot resume, '%s' holds %lux%lu images of type %d, not %lux%lu of type %d",fname,head.xdim,head.ydim,head.itype,output_header.xdim,output_header.ydim,output_header.itype);
+			return 1;
+		}
+		if (SINGLE_OUTPUT_FILE) {
+			if (head.Nimages != (size_t)Ndepths) { printf("\ncannot resume, '%s' holds %lu depths, not %ld",fname,head.Nimages,Ndepths); return 1; }
+			break;														/* the depths are all in the one file */
+		}
+		if (!(fabs(head.depth - index_to_beam_depth(m)) <= tolerance)) {
+			printf("\ncannot resume, '%s' is for depth %g, not %g",fname,head.depth,index_to_beam_depth(m));
+			return 1;
+		}
+	}
+	return 0;
+}
+
 
 
 
@@ -981,50 +1939,42 @@ void setup_depth_images(
 	if (Ndepths<1 || numImages<1) {											/* nothing to do */
 		image_set.depth_intensity.v =NULL;
 		image_set.depth_resolved.v = NULL;
+		image_set.depth_image.v = NULL;
+		image_set.depth_image.alloc = image_set.depth_image.size = 0;
 		image_set.depth_intensity.alloc = image_set.depth_intensity.size = 0;
 		image_set.depth_resolved.alloc = image_set.depth_resolved.size = 0;
 		image_set.wire_scanned.alloc = image_set.wire_scanned.size = 0;
 		image_set.wire_positions.alloc = image_set.wire_positions.size = 0;
+		image_set.normalVector.alloc = image_set.normalVector.size = 0;
 		return;
 	}
-	if (image_set.depth_intensity.v || image_set.depth_resolved.v || image_set.wire_positions.v || image_set.wire_scanned.v) {
-		error("ERROR -- setup_depth_images(), one of 'image_set.*.v' is not NULL\n");
-		exit(1);
+	/* in a batch (-B), the space left by the previous scan is re-used when it is big enough */
+	if (image_set.depth_intensity.alloc < (size_t)Ndepths) {
+		CHECK_FREE(image_set.depth_intensity.v)
+		image_set.depth_intensity.v = calloc((size_t)Ndepths,sizeof(double));/* allocate space for array of doubles in the vector */
+		if (!(image_set.depth_intensity.v)) { fprintf(stderr,"\ncannot allocate space for image_set.depth_intensity, %ld points\n",Ndepths); exit(1); }
+		image_set.depth_intensity.alloc = Ndepths;
 	}
-	if (image_set.depth_intensity.alloc || image_set.depth_resolved.alloc || image_set.wire_positions.alloc || image_set.wire_scanned.alloc) {
-		error("ERROR -- setup_depth_images(), one of 'image_set.*.alloc' is not NULL\n");
-		exit(1);
-	}
-
-	image_set.depth_intensity.v = calloc((size_t)Ndepths,sizeof(double));/* allocate space for array of doubles in the vector */
-	if (!(image_set.depth_intensity.v)) { fprintf(stderr,"\ncannot allocate space for image_set.depth_intensity, %ld points\n",Ndepths); exit(1); }
-	image_set.depth_intensity.alloc = image_set.depth_intensity.size = Ndepths;
+	image_set.depth_intensity.size = Ndepths;
 	for (i=0; i<Ndepths; i++) image_set.depth_intensity.v[i] = 0.;		/* init to all zeros */
 
-	image_set.depth_resolved.v = calloc((size_t)Ndepths,sizeof(gsl_matrix *));	/* allocate space for array of pointers to gsl_matricies (these are image) in the vector */
-	if (!(image_set.depth_resolved.v)) { fprintf(stderr,"\ncannot allocate space for image_set.depth_resolved, %ld points\n",Ndepths); exit(1); }
-	image_set.depth_resolved.alloc = image_set.depth_resolved.size = Ndepths;
-	for (i=0; i<Ndepths; i++) {
-		image_set.depth_resolved.v[i] = gsl_matrix_calloc((size_t)(imaging_parameters.rows_at_one_time), (size_t)(imaging_parameters.nROI_j));	/* pointers to gsl_matrix containing space for the image, initialized to zero */
+	alloc_stepstripe(&(image_set.depth_resolved), imaging_parameters.rows_at_one_time, (size_t)(imaging_parameters.nROI_j), (size_t)Ndepths);
+	image_set.depth_resolved.size = Ndepths;
+#ifdef STRIPE_KAHAN
+	add_stepstripe_compensation(&(image_set.depth_resolved));
+#endif
+
+	image_set.depth_image.size = image_set.depth_resolved.rows * image_set.depth_resolved.cols;
+	if (image_set.depth_image.alloc < image_set.depth_image.size) {
+		CHECK_FREE(image_set.depth_image.v)
+		image_set.depth_image.alloc = image_set.depth_image.size;
+		image_set.depth_image.v = calloc(image_set.depth_image.alloc,sizeof(double));	/* one output image of the stripe */
+		if (!(image_set.depth_image.v)) { fprintf(stderr,"\ncannot allocate space for image_set.depth_image, %lu points\n",image_set.depth_image.alloc); exit(1); }
 	}
 
 	/* *************** */
-	/* allocate for .wire_scanned and .wire_positions for numImages input images */
-	point_xyz badPnt;
-	badPnt.x = badPnt.y = badPnt.z = NAN;
-	image_set.wire_positions.v = calloc((size_t)numImages,sizeof(point_xyz));/* allocate space for array of doubles in the vector */
-	if (!(image_set.wire_positions.v)) { fprintf(stderr,"\ncannot allocate space for image_set.wire_positions, %d points\n",numImages); exit(1); }
-	image_set.wire_positions.alloc = numImages;							/* room allocated */
-	image_set.wire_positions.size = numImages;							/* and set length used also */
-	for (i=0; i<numImages; i++) image_set.wire_positions.v[i] = badPnt;	/* set all values to NAN */
-
-	image_set.wire_scanned.v = calloc((size_t)numImages,sizeof(gsl_matrix *));	/* allocate space for array of pointers to gsl_matricies these are pieces of the input images */
-	if (!(image_set.wire_scanned.v)) { fprintf(stderr,"\ncannot allocate space for image_set.wire_scanned, %d points\n",numImages); exit(1); }
-	image_set.wire_scanned.alloc = numImages;							/* room allocated */
-	image_set.wire_scanned.size = 0;									/* but nothing set */
-	for (i=0; i<numImages; i++) {
-		image_set.wire_scanned.v[i] = gsl_matrix_calloc((size_t)(imaging_parameters.rows_at_one_time), (size_t)(imaging_parameters.nROI_j));	/* pointers to gsl_matrix containing space for the image */
-	}
+	/* allocate for .wire_scanned for numImages input images, .wire_positions were already made by readScanMetadata() */
+	alloc_stepstripe(&(image_set.wire_scanned), imaging_parameters.rows_at_one_time, (size_t)(imaging_parameters.nROI_j), (size_t)numImages);
 }
 /*	for (i = (long)(user_preferences.depth_start / user_preferences.depth_resolution); i <= (long)(user_preferences.depth_end / user_preferences.depth_resolution); i ++ ) {
  *		image = gsl_matrix_calloc(imaging_parameters.nROI_i, imaging_parameters.rows_at_one_time);
@@ -1034,39 +1984,78 @@ void setup_depth_images(
  */
 
 
-/* this just sets the images in image_set to zero, it does NOT de-allocate the space they use */
-/* for .depth_resolved & .wire_scanned, set all the elements to zero, assumes space already allocated */
-void clear_depth_images(
-	ws_image_set *is)
+/* allocate one cache aligned, zeroed block for a stripe of n values per pixel, [row][col][n], .size is set to 0 */
+/* a stripe that is already allocated (e.g. by the previous scan of a batch) keeps its space when it is big enough */
+void alloc_stepstripe(
+	stepstripe *stripe,					/* either allocated or all zero */
+	size_t	rows,						/* rows in the stripe */
+	size_t	cols,						/* columns in the stripe */
+	size_t	n)							/* number of values for each pixel (wire steps or depths) */
 {
-	size_t i;
-	for (i=0; i < is->depth_resolved.alloc; i++) gsl_matrix_set_zero(is->depth_resolved.v[i]);
-	for (i=0; i < is->wire_scanned.alloc; i++) gsl_matrix_set_zero(is->wire_scanned.v[i]);
+	size_t	N = rows * cols * n;
+	if (stripe->v && stripe->capacity < N) free_stepstripe(stripe);	/* too small to re-use */
+	stripe->rows = rows;
+	stripe->cols = cols;
+	stripe->alloc = n;
+	stripe->size = 0;
+	if (!(stripe->v)) {
+		stripe->c = NULL;
+		stripe->capacity = MAX(N,1);
+		if (posix_memalign((void **)&(stripe->v), 64, stripe->capacity*sizeof(stripe_real))) stripe->v = NULL;
+	}
+	if (!(stripe->v)) { fprintf(stderr,"\ncannot allocate space for a stripe, %lu points\n",N); exit(1); }
+	clear_stepstripe(stripe);
 }
 
-void delete_images(void)				/* delete the images stored in image_set, and deallocate everything too, do: .wire_scanned, .depth_resolved, and .wire_positions, but NOT .depth_intensity */
+/* allocate the Kahan compensation of an already allocated stripe, the same size as .v and zeroed */
+void add_stepstripe_compensation(
+	stepstripe *stripe)
 {
-	gsl_matrix * image;
+	size_t	N = stripe->capacity;
+	if (stripe->c) return;				/* re-used along with .v, alloc_stepstripe() zeroed it */
+	stripe->c = calloc(MAX(N,1),sizeof(stripe_real));
+	if (!(stripe->c)) { fprintf(stderr,"\ncannot allocate space for stripe compensation, %lu points\n",N); exit(1); }
+}
+
+/* free the space of a stripe allocated by alloc_stepstripe() */
+void free_stepstripe(
+	stepstripe *stripe)
+{
+	CHECK_FREE(stripe->v)
+	CHECK_FREE(stripe->c)
+	stripe->alloc = stripe->size = stripe->capacity = 0;
+	stripe->rows = stripe->cols = 0;
+}
 
+/* this just sets the values in a stripe to zero, it does NOT de-allocate the space, or change .size or .alloc */
+void clear_stepstripe(
+	stepstripe *stripe)
+{
+	if (stripe->v) memset(stripe->v, 0, stripe->rows * stripe->cols * stripe->alloc * sizeof(stripe_real));
+	if (stripe->c) memset(stripe->c, 0, stripe->rows * stripe->cols * stripe->alloc * sizeof(stripe_real));
+}
+
+void delete_images(void)				/* delete the images stored in image_set, and deallocate everything too, do: .wire_scanned, .depth_resolved, and .wire_positions, but NOT .depth_intensity */
+{
 	/* de-allocate and zero out .wire_scanned */
-	while (image_set.wire_scanned.alloc) {
-		image = image_set.wire_scanned.v[--(image_set.wire_scanned.alloc)];
-		if (image != 0) gsl_matrix_free(image);
-	}
-	CHECK_FREE(image_set.wire_scanned.v)
-	image_set.wire_scanned.alloc = image_set.wire_scanned.size = 0;
+	free_stepstripe(&image_set.wire_scanned);
 
-	/* de-allocate and zero out .depth_resolved */
-	while (image_set.depth_resolved.alloc) {
-		image = image_set.depth_resolved.v[--(image_set.depth_resolved.alloc)];
-		if (image != 0) gsl_matrix_free(image);
-	}
-	CHECK_FREE(image_set.depth_resolved.v)
-	image_set.depth_resolved.alloc = image_set.depth_resolved.size = 0;
+	/* de-allocate and zero out .depth_resolved and .depth_image */
+	free_stepstripe(&image_set.depth_resolved);
+	CHECK_FREE(image_set.depth_image.v)
+	image_set.depth_image.alloc = image_set.depth_image.size = 0;
 
 	/* de-allocate and zero out .wire_positions */
 	CHECK_FREE(image_set.wire_positions.v)
 	image_set.wire_positions.alloc = image_set.wire_positions.size = 0;
+	CHECK_FREE(image_set.normalVector.v)
+	image_set.normalVector.alloc = image_set.normalVector.size = 0;
+
+	/* and the second stripes of PIPELINE_IO */
+	free_stepstripe(&pipe_scanned);
+	free_stepstripe(&pipe_resolved);
+	CHECK_FREE(pipe_image.v)
+	pipe_image.alloc = pipe_image.size = 0;
 }
 /*
  *	void delete_images()
@@ -1085,14 +2074,38 @@ void delete_images(void)				/* delete the images stored in image_set, and deallo
  */
 
 /* subtract from each image from its following image */
+/* all of the wire steps of a pixel are contiguous, so this goes through each pixel in order, rows can be split among threads */
+/* only the active pixels are differenced, the others are never used */
 void get_difference_images(void)
 {
-	size_t m;
-	for (m=0; m < (image_set.wire_scanned.size)-1; m++) {
+	size_t	m, k, n, mlo;
+	long	i;									/* row in the stripe, signed for the OpenMP loop */
+	long	nrows;								/* number of rows in the current stripe */
+	size_t	*row_start;							/* active pixels of the current stripe */
+	stripe_real *a;
+
 #ifdef DEBUG_1_PIXEL
-		if (verbosePixel) printf("pixel[%d,%d] raw image[% 3d] = %g\n",pixelTESTi,pixelTESTj,(int)m,gsl_matrix_get(image_set.wire_scanned.v[m], pixelTESTi -  imaging_parameters.current_selection_start, pixelTESTj));
+	for (m=0; verbosePixel && m < (image_set.wire_scanned.size)-1; m++) {
+		printf("pixel[%d,%d] raw image[% 3d] = %g\n",pixelTESTi,pixelTESTj,(int)m,STEP_PTR(image_set.wire_scanned, pixelTESTi -  imaging_parameters.current_selection_start, pixelTESTj)[m]);
+	}
 #endif
-		gsl_matrix_sub(image_set.wire_scanned.v[m], image_set.wire_scanned.v[m+1]);	/* gsl_matrix_sub(a,b) -->  a -= b */
+	if (image_set.wire_scanned.size < 2) return;
+	nrows = imaging_parameters.current_selection_end - imaging_parameters.current_selection_start + 1;
+	row_start = active_pixels.row_start + imaging_parameters.current_selection_start;
+#ifdef _OPENMP
+	#pragma omp parallel for private(m,k,n,mlo,a) num_threads(NUM_THREADS)
+#endif
+	for (i=0; i < nrows; i++) {
+		for (k=row_start[i]; k < row_start[i+1]; k++) {
+			a = STEP_PTR(image_set.wire_scanned, (size_t)i, (size_t)active_pixels.j[k]);	/* all steps of this pixel */
+			n = image_set.wire_scanned.size - 1;
+			mlo = 0;
+			if (active_pixels.step_lo) {								/* only the differences in the window of the pixel are used */
+				mlo = (size_t)active_pixels.step_lo[k];
+				n = MIN(n,(size_t)active_pixels.step_hi[k]+1);
+			}
+			for (m=mlo; m < n; m++) a[m] -= a[m+1];						/* a[m+1] is not changed until after it is used here */
+		}
 	}
 }
 
@@ -1116,7 +2129,24 @@ void getImageInfo(
 	H5Eset_auto2(H5E_DEFAULT,NULL,NULL);				/* turn off printing of HDF5 errors */
 #endif
 
-	sprintf(filename,"%s%d.h5",fn_base,file_num_start);
+	MULTI_FRAME_FILE = 0;
+#ifdef MULTI_IMAGE_FILE
+	/* fn_base may be one file with all of the images as frames, then [file_num_start, file_num_end] are frame numbers */
+	size_t	len = strlen(fn_base);
+	if (len>3 && !strcmp(fn_base+len-3,".h5") && !access(fn_base,R_OK) && !readHDF5header(fn_base, &in_header) && in_header.Nimages>1) {
+		if (file_num_start<0 || (size_t)file_num_end>=in_header.Nimages) {
+			char errStr[1024];
+			sprintf(errStr,"getImageInfo(), frames [%d, %d] are not in '%s', it has %lu frames",file_num_start,file_num_end,fn_base,in_header.Nimages);
+			error(errStr);
+			exit(1);
+		}
+		MULTI_FRAME_FILE = 1;
+		if (verbose > 0) printf("\nreading frames %d thru %d of the %lu in '%s'",file_num_start,file_num_end,in_header.Nimages,fn_base);
+	}
+#endif
+
+	if (MULTI_FRAME_FILE) strncpy(filename,fn_base,FILENAME_MAX-1);
+	else sprintf(filename,"%s%d.h5",fn_base,file_num_start);
 	if (readHDF5header(filename, &in_header)) goto error_path;
 	imaging_parameters.nROI_i = (int)(in_header.xdim);		/* number of binned pixels along the x direction of one image */
 	imaging_parameters.nROI_j = (int)(in_header.ydim);		/* number of binned pixels in one full stored image along detector y */
@@ -1132,6 +2162,11 @@ void getImageInfo(
 	imaging_parameters.NinputImages = file_num_end - file_num_start + 1;/* number of input images to process */
 
 	positionerType = positionerTypeFromFileTime(in_header.fileTime);		/* sets global value position type, needed for wirePosition2beamLine() */
+	if (MULTI_FRAME_FILE) {												/* wire positions are vectors, one value for each frame */
+		readFrameWirePositions(filename, file_num_start, 1, &imaging_parameters.wire_first_xyz);
+		readFrameWirePositions(filename, file_num_end, 1, &imaging_parameters.wire_last_xyz);
+		return;
+	}
 	wire_pos.x = in_header.xWire;
 	wire_pos.y = in_header.yWire;
 	wire_pos.z = in_header.zWire;
@@ -1164,12 +2199,21 @@ void get_intensity_map(
 	char	filename[FILENAME_MAX];		/* full filename */
 	struct HDF5_Header header;
 
-	intensity_map = gsl_matrix_alloc(dimi, dimj);	/* get memory for one whole image */
-	sprintf(filename,"%s%d.h5",filename_base,file_num_start);
-	readHDF5header(filename, &header);
+	if (intensity_map && (intensity_map->size1 != dimi || intensity_map->size2 != dimj)) {	/* the previous scan of a batch had another ROI */
+		gsl_matrix_free(intensity_map);
+		intensity_map = NULL;
+	}
+	if (!intensity_map) intensity_map = gsl_matrix_alloc(dimi, dimj);	/* get memory for one whole image */
+	if (MULTI_FRAME_FILE) {							/* the first frame, an image is a stack of one step */
+		if (HDF5ReadROIframes(filename_base,"entry1/data/data", intensity_map->data, H5T_NATIVE_DOUBLE, dimi, dimj, 1, 0, (size_t)file_num_start, 1, 0, (dimi-1), 0, (dimj-1), &in_header)) { error("\nFailed to read the intensity map frame"); exit(1); }
+	}
+	else {
+		sprintf(filename,"%s%d.h5",filename_base,file_num_start);
+		readHDF5header(filename, &header);
 
-	/* read data (of any kind) into a double array */
-	if (HDF5ReadROIdouble(filename,"entry1/data/data", &(intensity_map->data), 0, (dimi-1), 0,(dimj-1), &in_header)) { error("\nFailed to open intensity map file"); exit(1); }
+		/* read data (of any kind) into a double array */
+		if (HDF5ReadROIdouble(filename,"entry1/data/data", &(intensity_map->data), 0, (dimi-1), 0,(dimj-1), &in_header)) { error("\nFailed to open intensity map file"); exit(1); }
+	}
 
 
 #ifdef DEBUG_1_PIXEL
@@ -1183,53 +2227,229 @@ void get_intensity_map(
 
 	/* remove image noise below certain value */
 	size_t	sort_len = dimj*dimi;
-	double *intensity_sorted;		/* std::vector<double> intensity_sorted;		This line is in WireScan.h, move it to here */
-	intensity_sorted = (double*)calloc(sort_len,sizeof(double));
-	if (!intensity_sorted) { fprintf(stderr,"\nCould not allocate intensity_sorted %ld bytes in get_intensity_map()\n",sort_len); exit(1); }
-
-	//	size_t	i, j, m;
-	//	for (m=j=0; j < dimj; j++) { for (i=0; i < dimi; i++) intensity_sorted[m++] = gsl_matrix_get(intensity_map, i, j); }
-	//	// #warning "is this memcpy correct?"
-	//	memcpy(intensity_sorted,intensity_map->data,dimi*dimj*sizeof(double));
-	//	printf("gsl_matrix_get(intensity_map,%d, %d) = %g\n",pixelTESTi,pixelTESTj,gsl_matrix_get(intensity_map,pixelTESTi,pixelTESTj));
-	//	printf("intensity_map->tda = %lu\n",intensity_map->tda);
-	//	printf("intensity_sorted[%d*%lu + %d] = %g\n",pixelTESTi,dimj,pixelTESTj,intensity_sorted[pixelTESTi*dimj+pixelTESTj]);
-
-	memcpy(intensity_sorted,intensity_map->data,dimi*dimj*sizeof(double));
-	qsort(intensity_sorted,(dimj*dimi), sizeof(double), (void *)compare_double);
-
-	cutoff = intensity_sorted[ (size_t)floor((double)sort_len * MIN((100. - percent)/100.,1.)) ];
+	size_t	kth = (size_t)floor((double)sort_len * MIN((100. - percent)/100.,1.));	/* index of cutoff if the image were sorted */
+	cutoff = intensity_cutoff(intensity_map->data, sort_len, MIN(kth,sort_len-1));
 	cutoff = MAX(cutoff,1);
-	CHECK_FREE(intensity_sorted);
 
 	if (verbose > 0) printf("\nignoring pixels with a value less than %d",cutoff);
+	make_active_pixels();
+	if (verbose > 0) printf("\nwill process %lu of %lu pixels",active_pixels.size,dimi*dimj);
 	fflush(stdout);
 	return;
 }
 
 
+/* the cutoff is the integer part of the kth smallest of v[N], found in O(N) without sorting */
+/* since cutoff is always >= 1, all values < 1 are counted together, then an exact histogram of the integer parts gives the answer, */
+/* this works for any image of integers (e.g. uint16) and most others.  For a huge range of values, use select_kth_double() on a copy */
+#define MAX_CUTOFF_HISTOGRAM (1<<20)		/* most bins allowed in the histogram, 8 MiB */
+int intensity_cutoff(
+	const double *v,					/* the image */
+	size_t	N,							/* number of pixels in v */
+	size_t	kth)						/* want the value that would be v[kth] if v were sorted */
+{
+	size_t	*hist=NULL;					/* hist[b] is the number of pixels with integer part b, hist[0] is all of those < 1 */
+	size_t	m, b, Nbins;
+	size_t	sum;
+	double	vmax=0.;
+	int		result;
+
+	if (N<1) return 0;
+	for (m=0; m<N; m++) vmax = MAX(vmax,v[m]);			/* NaN is ignored */
+	if (vmax < 1.) return 0;							/* every value is < 1 */
+
+	if (vmax < MAX_CUTOFF_HISTOGRAM) {
+		Nbins = (size_t)vmax + 1;
+		hist = calloc(Nbins,sizeof(size_t));
+	}
+	if (!hist) {										/* too big for a histogram, use a partial sort */
+		double *copy = (double*)calloc(N,sizeof(double));
+		if (!copy) { fprintf(stderr,"\nCould not allocate %lu points in intensity_cutoff()\n",N); exit(1); }
+		memcpy(copy,v,N*sizeof(double));
+		result = (int)select_kth_double(copy,N,kth);
+		CHECK_FREE(copy);
+		return result;
+	}
+
+	for (m=0; m<N; m++) hist[(v[m] >= 1.) ? (size_t)v[m] : 0]++;	/* values < 1 and NaN go in hist[0] */
+	for (b=sum=0; b<Nbins-1; b++) {
+		sum += hist[b];
+		if (sum > kth) break;							/* v[kth] has integer part b (or is < 1 when b==0) */
+	}
+	CHECK_FREE(hist);
+	return (int)b;
+}
+
+
+/* make the list of pixels with intensity_map >= cutoff, only these pixels are read, differenced, and depth resolved */
+void make_active_pixels(void)
+{
+	size_t	dimi = imaging_parameters.nROI_i;
+	size_t	dimj = imaging_parameters.nROI_j;
+	size_t	i, j, m;
+	double	*row;
+
+	active_pixels.Ni = dimi;
+	active_pixels.row_start = calloc(dimi+1,sizeof(size_t));
+	if (!(active_pixels.row_start)) { fprintf(stderr,"\ncannot allocate space for active_pixels.row_start, %lu points\n",dimi+1); exit(1); }
+	for (m=i=0; i < dimi; i++) {							/* first count them */
+		active_pixels.row_start[i] = m;
+		row = gsl_matrix_ptr(intensity_map, i, 0);
+		for (j=0; j < dimj; j++) m += (row[j] >= cutoff);
+	}
+	active_pixels.row_start[dimi] = active_pixels.size = m;
+
+	active_pixels.j = calloc(MAX(m,1),sizeof(int));
+	if (!(active_pixels.j)) { fprintf(stderr,"\ncannot allocate space for active_pixels.j, %lu points\n",m); exit(1); }
+	for (m=i=0; i < dimi; i++) {							/* then save the columns */
+		row = gsl_matrix_ptr(intensity_map, i, 0);
+		for (j=0; j < dimj; j++) if (row[j] >= cutoff) active_pixels.j[m++] = (int)j;
+	}
+}
+
+
+/* remove the active pixels that cannot put any intensity into [depth_start, depth_end] at any step of the wire scan, */
+/* and save the window of wire steps [step_lo,step_hi] of each one that can.  This is the same test that depth_resolve_pixel() */
+/* makes before it deposits anything, so the output is unchanged, and rows & columns left without active pixels are never read. */
+/* Every step is tested, so it works for any wire path and detector orientation, steps outside the window are never used */
+#define STEP_REACHES_DEPTHS(B,F,S) (!((B)[(S)+1] < depthLo || (F)[(S)] > depthHi))	/* trapezoid of step S is [F[S], B[S+1]] */
+void cull_active_pixels(void)
+{
+	size_t	Nw;								/* number of wire positions used, as in depth_resolve() */
+	double	*wire_y=NULL, *wire_z=NULL;		/* y & z of the wire positions */
+	double	radius;							/* wire radius (micron) */
+	double	depthLo, depthHi;				/* depth range of the output, same as in depth_resolve_pixel() (micron) */
+	double	*edge_y, *edge_z;				/* rho-rotated y & z of the pixel edges in one row */
+	double	*back_depth[2], *front_depth[2];	/* depths of the back & front edges of a pixel at every wire position, [0]=trailing, [1]=leading */
+	double	*swap, *depth_block;
+	long	last_j;							/* previous pixel in this row, its front edge is the back edge of pixel last_j+1 */
+	long	lo, hi;							/* window of steps for one pixel */
+	long	i;								/* signed for the OpenMP loop */
+	long	s;
+	size_t	a, m, end;
+	int		j, e;
+
+	if (active_pixels.size < 1 || imaging_parameters.NinputImages < 3) return;
+	Nw = (size_t)(imaging_parameters.NinputImages - 1 - 1);
+	radius = calibration.wire.diameter / 2;
+	depthLo = user_preferences.depth_start;
+	depthHi = user_preferences.depth_resolution*(user_preferences.NoutputDepths - 1) + user_preferences.depth_start;
+	wire_y = calloc(Nw,sizeof(double));
+	wire_z = calloc(Nw,sizeof(double));
+	CHECK_FREE(active_pixels.step_lo);
+	CHECK_FREE(active_pixels.step_hi);
+	active_pixels.step_lo = calloc(active_pixels.size,sizeof(int));
+	active_pixels.step_hi = calloc(active_pixels.size,sizeof(int));
+	if (!wire_y || !wire_z || !active_pixels.step_lo || !active_pixels.step_hi) { fprintf(stderr,"\ncannot allocate space in cull_active_pixels(), %lu points\n",active_pixels.size); exit(1); }
+	for (s=0; s < (long)Nw; s++) {
+		wire_y[s] = image_set.wire_positions.v[s].y;
+		wire_z[s] = image_set.wire_positions.v[s].z;
+	}
+
+#ifdef _OPENMP
+	#pragma omp parallel private(edge_y,edge_z,back_depth,front_depth,swap,depth_block,last_j,lo,hi,a,s,j,e) num_threads(NUM_THREADS)
+#endif
+	{
+	depth_block = calloc(4*Nw,sizeof(double));
+	if (!depth_block) { fprintf(stderr,"\ncannot allocate space for edge depths, %lu points\n",4*Nw); exit(1); }
+	back_depth[0] = depth_block;
+	back_depth[1] = depth_block + Nw;
+	front_depth[0] = depth_block + 2*Nw;
+	front_depth[1] = depth_block + 3*Nw;
+#ifdef _OPENMP
+	#pragma omp for schedule(dynamic)
+#endif
+	for (i=0; i < (long)active_pixels.Ni; i++) {
+		edge_y = pixel_edges.y + i*pixel_edges.Nj;
+		edge_z = pixel_edges.z + i*pixel_edges.Nj;
+		last_j = -2;
+		for (a=active_pixels.row_start[i]; a < active_pixels.row_start[i+1]; a++) {
+			j = active_pixels.j[a];
+			lo = (long)Nw;
+			hi = -1;
+			if (last_j == (long)j-1) {									/* front edge of the previous pixel is the back edge of this one */
+				for (e=0; e<2; e++) {
+					swap = back_depth[e];
+					back_depth[e] = front_depth[e];
+					front_depth[e] = swap;
+				}
+			}
+			else if (user_preferences.wireEdge<0) edge_depths_both_all_steps(edge_y[j],edge_z[j], wire_y,wire_z, Nw, radius, calibration.wire.ki, back_depth[1], back_depth[0]);
+			else edge_depths_all_steps(edge_y[j],edge_z[j], wire_y,wire_z, Nw, radius, calibration.wire.ki, user_preferences.wireEdge, back_depth[user_preferences.wireEdge]);
+			if (user_preferences.wireEdge<0) edge_depths_both_all_steps(edge_y[j+1],edge_z[j+1], wire_y,wire_z, Nw, radius, calibration.wire.ki, front_depth[1], front_depth[0]);
+			else edge_depths_all_steps(edge_y[j+1],edge_z[j+1], wire_y,wire_z, Nw, radius, calibration.wire.ki, user_preferences.wireEdge, front_depth[user_preferences.wireEdge]);
+			for (e=0; e<2; e++) {
+				if (user_preferences.wireEdge>=0 && user_preferences.wireEdge!=e) continue;
+				for (s=0; s < lo && s+1 < (long)Nw; s++) {			/* first step that reaches */
+					if (STEP_REACHES_DEPTHS(back_depth[e],front_depth[e],s)) { lo = s; break; }
+				}
+				for (s=(long)Nw-2; s > hi; s--) {						/* last step that reaches */
+					if (STEP_REACHES_DEPTHS(back_depth[e],front_depth[e],s)) { hi = s; break; }
+				}
+			}
+			last_j = j;
+			active_pixels.step_lo[a] = (int)lo;
+			active_pixels.step_hi[a] = (int)hi;						/* hi < lo if no step reaches */
+		}
+	}
+	CHECK_FREE(depth_block);
+	}
+
+	for (m=a=0, i=0; i < (long)active_pixels.Ni; i++) {		/* squeeze out the pixels that never reach */
+		end = active_pixels.row_start[i+1];
+		active_pixels.row_start[i] = m;
+		for (; a < end; a++) {
+			if (active_pixels.step_hi[a] < active_pixels.step_lo[a]) continue;
+			active_pixels.j[m] = active_pixels.j[a];
+			active_pixels.step_lo[m] = active_pixels.step_lo[a];
+			active_pixels.step_hi[m++] = active_pixels.step_hi[a];
+		}
+	}
+	if (verbose > 0) printf("\n%lu of %lu active pixels can reach depths [%g, %g]",m,active_pixels.size,depthLo,depthHi);
+	active_pixels.row_start[active_pixels.Ni] = active_pixels.size = m;
+	CHECK_FREE(wire_y);
+	CHECK_FREE(wire_z);
+}
+
+
+void delete_active_pixels(void)
+{
+	CHECK_FREE(active_pixels.j);
+	CHECK_FREE(active_pixels.row_start);
+	CHECK_FREE(active_pixels.step_lo);
+	CHECK_FREE(active_pixels.step_hi);
+	active_pixels.size = active_pixels.Ni = 0;
+}
+
+
 void readImageSet(
 	char	*fn_base,					/* base name of input image files */
 	int		ilow,						/* range of ROI to read from file */
 	int		ihi,
-	int		jlow,						/* for best speed, jhi-jlow+1 == ydim */
+	int		jlow,						/* columns [jlow,jhi] go into the same columns of the stripe, the others are left alone */
 	int		jhi,
 	int		file_num_start,				/* index of first input image */
 	int		file_num_end,				/* infex of last input image */
-	char	*normalization)				/* optional tag for normalization */
+	stepstripe *stripe)					/* put the stripe here, usually &image_set.wire_scanned */
 {
 	int		f;
 	char	filename[FILENAME_MAX];			/* full filename */
 	if (verbose > 1) printf("\n\tabout to load %d new images...",(file_num_end - file_num_start) + 1);
 	fflush(stdout);
 
+	if (MULTI_FRAME_FILE) {					/* all of the images are in one file, read many frames at once */
+		readImageStack(fn_base, file_num_start, file_num_end-file_num_start+1, ilow, ihi, jlow, jhi, stripe);
+		if (verbose > 2) printf("\n\t\tloaded images");
+		fflush(stdout);
+		return;
+	}
 	for (f = file_num_start; f <= file_num_end; f++) {
 #ifdef DEBUG_1_PIXEL
 		if (f==file_num_start) verbosePixel=1;
 #endif
 
 		sprintf(filename,"%s%d.h5",fn_base,f);
-		readSingleImage(filename, f-file_num_start, ilow, ihi, jlow, jhi, normalization);	/* load a single image from disk */
+		readSingleImage(filename, f-file_num_start, ilow, ihi, jlow, jhi, stripe);	/* load a single image from disk */
 
 #ifdef DEBUG_1_PIXEL
 		verbosePixel=0;
@@ -1239,6 +2459,18 @@ void readImageSet(
 	fflush(stdout);
 }
 
+/* pthread version of readImageSet(), job is a read_stripe_job, the stripe is cleared first */
+void *readImageSet_thread(
+	void	*job)
+{
+	read_stripe_job *r = (read_stripe_job *)job;
+	double	t0 = monotonicSeconds();
+	clear_stepstripe(r->stripe);
+	readImageSet(r->fn_base, r->ilow, r->ihi, r->jlow, r->jhi, r->file_num_start, r->file_num_end, r->stripe);
+	r->metrics->read = monotonicSeconds() - t0;
+	return NULL;
+}
+
 void readSingleImage(
 	char	*filename,							/* fully qualified file name */
 	int		imageIndex,							/* index to images, image number that appears in the full file name - first image number */
@@ -1246,58 +2478,165 @@ void readSingleImage(
 	int		ihi,								/* these are in terms of the image stored in the file, not raw un-binned pixels of the detector */
 	int		jlow,
 	int		jhi,
-	char	*normalization)						/* full path to meta-data to be used for normalization, if not found (i.e. empty string) nothing is done */
+	stepstripe *stripe)							/* put the image here, usually &image_set.wire_scanned */
 {
-	struct HDF5_Header header;
 	int		i,j;
+	size_t	k;
+	stripe_real *v;
 
-	point_xyz wire_pos;						/* position of wire retrieved from image */
-
-	/* matrix to store image */
-	gsl_matrix *image;
 	int dimi = ihi - ilow + 1;
-	int dimj = jhi - jlow + 1;				/* for best performance jlow-jhi+1 == ydim */
-	double *buf = NULL;
+	double	norm;							/* normalization, the image is multiplied by this */
 
-	/* set image_set.wire_scanned.size to be big enough (probably just increment .size by 1) */
-	if ( (unsigned int)imageIndex >= image_set.wire_scanned.alloc) {/* do not have enough gsl_matrix arrays allocated */
-		fprintf(stderr,"\nERROR -- readSingleImage(), need room for image #%d, but only have .alloc = %ld",imageIndex,image_set.wire_scanned.alloc);
+	/* set stripe->size to be big enough (probably just increment .size by 1) */
+	if ( (unsigned int)imageIndex >= stripe->alloc) {/* do not have enough room for this image */
+		fprintf(stderr,"\nERROR -- readSingleImage(), need room for image #%d, but only have .alloc = %ld",imageIndex,stripe->alloc);
 		exit(2);
 	}
-	image_set.wire_scanned.size = imageIndex+1;		/* number of input images read so far */
-	image = image_set.wire_scanned.v[imageIndex];
+	stripe->size = imageIndex+1;					/* number of input images read so far */
+	if ((size_t)imageIndex >= image_set.normalVector.size) { error("readSingleImage(), image_set.normalVector.alloc too small"); exit(3); }
+	norm = image_set.normalVector.v[imageIndex];	/* from readScanMetadata() */
 
-	if (readHDF5header(filename, &header)){
-		error("Error reading image header");
-		exit(1);
-	}
-
-	/* read data (of any kind) into a double array */
+	/* read data (of any kind) straight into step imageIndex of the stripe, HDF5 converts it to stripe_real */
+	/* all images of the scan have the same size as in_header, the last stripe just uses fewer rows of the stripe */
 #ifdef DEBUG_ALL
-	slowWay = ((size_t)(jhi-jlow+1)<(header.ydim)) || slowWay;	/* check stripe orientation */
+	slowWay = ((size_t)(jhi-jlow+1)<(in_header.ydim)) || slowWay;	/* check stripe orientation */
 #endif
-	if (HDF5ReadROIdouble(filename, "entry1/data/data", &buf, (size_t)ilow, (size_t)ihi, (size_t)jlow, (size_t)jhi, &header)) {
+	HDF5_LOCK
+	if (HDF5ReadROIstep(filename, "entry1/data/data", stripe->v, H5T_STRIPE_REAL, stripe->rows, stripe->cols, stripe->alloc, (size_t)imageIndex,
+		(size_t)ilow, (size_t)ihi, (size_t)jlow, (size_t)jhi, &in_header)) {
 		error("Error reading image");
 		exit(1);
 	}
-
-	/* transfer into a gsl_matrix, cannot do memcpy because last stripe is narrower & so there could be a mismatch */
-	for (j = 0; j < dimj; j++) {
-		for (i = 0; i < dimi; i++) {
-			gsl_matrix_set(image, (size_t)i, (size_t)j, buf[i*dimj + j]);
-		}
-	}
+	HDF5_UNLOCK
 
 #ifdef DEBUG_1_PIXEL
 	if (verbosePixel && ilow<=pixelTESTi && pixelTESTi<=ihi) {
 		printf("\n ++++++++++ in readSingleImage(), finished reading i=[%d, %d], j=[%d, %d]",ilow,ihi,jlow,jhi);
-		printf("\n ++++++++++ pixel[%d,%d] = %g,     ROI: i=[%d,%d], j=[%d, %d],  Nj=%d",pixelTESTi,pixelTESTj, buf[dimj*(pixelTESTi-ilow) + pixelTESTj],ilow,ihi,jlow,jhi,dimj);
-		printf("\n ++++++++++ gsl pixel[%d-%d,%d] = %g",pixelTESTi,ilow,pixelTESTj,gsl_matrix_get(image, pixelTESTi-ilow, pixelTESTj));
-		printf("\n            gsl_matrix.size1 = %lu,  gsl_matrix.size2 = %lu,  gsl_matrix.tda = %lu",image->size1,image->size2,image->tda);
+		printf("\n ++++++++++ pixel[%d,%d] = %g,     ROI: i=[%d,%d], j=[%d, %d]",pixelTESTi,pixelTESTj, (double)STEP_PTR(*stripe, pixelTESTi-ilow, pixelTESTj)[imageIndex],ilow,ihi,jlow,jhi);
 		fflush(stdout);
 	}
 #endif
 
+	/* normalize the active pixels, the others are never used */
+	if (norm == 1.) return;
+	for (i = 0; i < dimi; i++) {
+		for (k = active_pixels.row_start[ilow+i]; k < active_pixels.row_start[ilow+i+1]; k++) {
+			j = active_pixels.j[k];
+			if (j < jlow || j > jhi) continue;
+			v = STEP_PTR(*stripe, (size_t)i, (size_t)j) + imageIndex;
+			*v = *v * norm;
+		}
+	}
+}
+
+
+/* read the frames [first_frame, first_frame+Nframes-1] of a stack of images in one file into steps [0, Nframes-1] of the stripe */
+/* the frames are read in blocks of at most FRAME_BLOCK_MiB, usually the whole stripe is one H5Dread */
+void readImageStack(
+	char	*filename,							/* fully qualified file name */
+	int		first_frame,						/* frame in the file that goes into step 0 */
+	int		Nframes,							/* number of frames to read */
+	int		ilow,								/* range of ROI to read from file */
+	int		ihi,
+	int		jlow,
+	int		jhi,
+	stepstripe *stripe)							/* put the images here, usually &image_set.wire_scanned */
+{
+	int		i, j, f, block;
+	size_t	k;
+	stripe_real *v;
+	const double *norm = image_set.normalVector.v;	/* from readScanMetadata() */
+
+	if ((size_t)Nframes > stripe->alloc) {
+		fprintf(stderr,"\nERROR -- readImageStack(), need room for %d images, but only have .alloc = %ld",Nframes,stripe->alloc);
+		exit(2);
+	}
+	if ((size_t)Nframes > image_set.normalVector.size) { error("readImageStack(), image_set.normalVector.alloc too small"); exit(3); }
+
+	block = (int)((FRAME_BLOCK_MiB * MiB) / ((size_t)(ihi-ilow+1) * (size_t)(jhi-jlow+1) * sizeof(stripe_real)));
+	block = MAX(block,1);
+	for (f = 0; f < Nframes; f += block) {
+		HDF5_LOCK
+		if (HDF5ReadROIframes(filename, "entry1/data/data", stripe->v, H5T_STRIPE_REAL, stripe->rows, stripe->cols, stripe->alloc, (size_t)f,
+			(size_t)(first_frame+f), (size_t)MIN(block,Nframes-f), (size_t)ilow, (size_t)ihi, (size_t)jlow, (size_t)jhi, &in_header)) {
+			error("Error reading frames");
+			exit(1);
+		}
+		HDF5_UNLOCK
+	}
+	stripe->size = (size_t)Nframes;				/* number of input images read */
+
+	/* normalize the active pixels, the others are never used */
+	for (f = 0; f < Nframes && norm[f] == 1.; f++) ;
+	if (f >= Nframes) return;					/* nothing to do */
+	for (i = 0; i <= ihi-ilow; i++) {
+		for (k = active_pixels.row_start[ilow+i]; k < active_pixels.row_start[ilow+i+1]; k++) {
+			j = active_pixels.j[k];
+			if (j < jlow || j > jhi) continue;
+			v = STEP_PTR(*stripe, (size_t)i, (size_t)j);
+			for (f = 0; f < Nframes; f++) v[f] = v[f] * norm[f];
+		}
+	}
+}
+
+
+/* read the wire positions of frames [first_frame, first_frame+Nframes-1] of a stack of images, one vector for each of X, Y, Z */
+/* the wire positions are corrected as they are read, the same way as for an image in its own file */
+void readFrameWirePositions(
+	char	*filename,					/* fully qualified file name */
+	int		first_frame,				/* first frame */
+	int		Nframes,					/* number of wire positions to read */
+	point_xyz *wire)					/* put the wire positions here */
+{
+	const char *names[2][3] = {{"entry1/wire/wireX","entry1/wire/wireY","entry1/wire/wireZ"}, {"entry1/wireX","entry1/wireY","entry1/wireZ"}};
+	double	*xyz[3];
+	int		a, n, m;
+
+	xyz[0] = calloc((size_t)Nframes*3,sizeof(double));
+	if (!xyz[0]) { fprintf(stderr,"\ncannot allocate space for %d wire positions\n",Nframes); exit(1); }
+	xyz[1] = xyz[0] + Nframes;
+	xyz[2] = xyz[1] + Nframes;
+	for (a=0; a<3; a++) {						/* look in 'entry1/wire' first, then the default for old files */
+		for (n=0; n<2 && readHDF5frameVector(filename, names[n][a], xyz[a], (size_t)first_frame, (size_t)Nframes); n++) ;
+		if (n>=2) for (m=0; m<Nframes; m++) xyz[a][m] = NAN;
+	}
+	for (m=0; m<Nframes; m++) {
+		wire[m].x = xyz[0][m];
+		wire[m].y = xyz[1][m];
+		wire[m].z = xyz[2][m];
+		wire[m] = wirePosition2beamLine(wire[m]);	/* correct raw wire position: PM500 distortion, origin, PM500 rotation, wire axis rotation */
+	}
+	CHECK_FREE(xyz[0]);
+}
+
+
+/* read the wire position and the normalization of every image in the scan, these are the same for every stripe */
+/* allocates and fills image_set.wire_positions and image_set.normalVector */
+void readScanMetadata(
+	char	*fn_base,					/* base name of input image files */
+	int		file_num_start,				/* index of first input image */
+	int		file_num_end,				/* index of last input image */
+	char	*normalization)				/* full path to meta-data to be used for normalization, if not found (i.e. empty string) nothing is done */
+{
+	struct HDF5_Header header;
+	point_xyz wire_pos;						/* position of wire retrieved from image */
+	char	filename[FILENAME_MAX];			/* full filename */
+	double	norm;							/* normalization, the image is multiplied by this */
+	int		f, m;
+	int		numImages = file_num_end - file_num_start + 1;
+
+	if (numImages<1) return;
+	if (image_set.wire_positions.alloc < (size_t)numImages || image_set.normalVector.alloc < (size_t)numImages) {	/* else re-use the space of the previous scan of a batch */
+		CHECK_FREE(image_set.wire_positions.v)
+		CHECK_FREE(image_set.normalVector.v)
+		image_set.wire_positions.v = calloc((size_t)numImages,sizeof(point_xyz));
+		image_set.normalVector.v = calloc((size_t)numImages,sizeof(double));
+		if (!(image_set.wire_positions.v) || !(image_set.normalVector.v)) { fprintf(stderr,"\ncannot allocate space for image_set.wire_positions, %d points\n",numImages); exit(1); }
+		image_set.wire_positions.alloc = image_set.normalVector.alloc = numImages;
+	}
+	image_set.wire_positions.size = numImages;
+	image_set.normalVector.size = numImages;
+
 	/* resolve any normalization shortcuts here */
 	char normUse[FILENAME_MAX];							/* value after resolving shortcuts */
 	if (strcmp(normalization,"mA")==0) strncpy(normUse,"/entry1/microDiffraction/source/current",FILENAME_MAX-2);	/* shortcut for beam current */
@@ -1305,29 +2644,57 @@ void readSingleImage(
 	/*	else if (strcmp(normalization,"cnt3")==0) normUse[0]='\0'; */
 	else strncpy(normUse,normalization,FILENAME_MAX-2);	/* no shortcut found, use what was passed */
 	normUse[FILENAME_MAX-1] = '\0';						/* strncpy may not terminate */
-	if (normUse[0]) {									/* if I have a normalization tag, try to use it */
-		double norm;
-		norm = readHDF5oneValue(filename, normUse);
-		if (norm == norm) {								/* not true if norm is NAN */
+
+	if (verbose > 1) printf("\nreading wire positions and normalizations of %d images",file_num_end-file_num_start+1);
+	if (MULTI_FRAME_FILE) {								/* one vector with a value for each frame */
+		readFrameWirePositions(fn_base, file_num_start, numImages, image_set.wire_positions.v);
+		if (!normUse[0] || readHDF5frameVector(fn_base, normUse, image_set.normalVector.v, (size_t)file_num_start, (size_t)numImages)) {
+			for (m = 0; m < numImages; m++) image_set.normalVector.v[m] = 1.;
+		}
+		for (m = 0; m < numImages; m++) {
+			norm = image_set.normalVector.v[m];
+			if (norm != norm) norm = 1.;				/* no valid normalization, use image as is */
 #ifdef TYPICAL_mA
-			if (strcmp(normUse,"mA")==0) norm /= TYPICAL_mA; /* for beam current, divide by typical beam current */
+			else if (strcmp(normUse,"mA")==0) norm /= TYPICAL_mA;
 #endif
 #ifdef TYPICAL_cnt3
-			if (strcmp(normUse,"cnt3")==0) norm /= TYPICAL_cnt3;
+			else if (strcmp(normUse,"cnt3")==0) norm /= TYPICAL_cnt3;
 #endif
-			/* printf("\nnorm = %g      %d\n",norm,norm==norm); */
-			gsl_matrix_scale(image,norm);
+			image_set.normalVector.v[m] = norm;
 		}
+		fflush(stdout);
+		return;
 	}
-
-	if ((size_t)imageIndex >= image_set.wire_positions.size) { error("readSingleImage(), image_set.wire_positions.alloc too small"); exit(3); }
-	/* #warning "the wire position is corrected here when it is read in for: PM500, origin, rotation (by rho)" */
-	wire_pos.x = header.xWire;
-	wire_pos.y = header.yWire;
-	wire_pos.z = header.zWire;
-	image_set.wire_positions.v[imageIndex] = wirePosition2beamLine(wire_pos);	/* correct raw wire position: PM500 distortion, origin, PM500 rotation, wire axis rotation */
-
-	CHECK_FREE(buf);
+	for (f = file_num_start; f <= file_num_end; f++) {
+		m = f - file_num_start;
+		sprintf(filename,"%s%d.h5",fn_base,f);
+		if (readHDF5header(filename, &header)){
+			error("Error reading image header");
+			exit(1);
+		}
+		/* #warning "the wire position is corrected here when it is read in for: PM500, origin, rotation (by rho)" */
+		wire_pos.x = header.xWire;
+		wire_pos.y = header.yWire;
+		wire_pos.z = header.zWire;
+		image_set.wire_positions.v[m] = wirePosition2beamLine(wire_pos);	/* correct raw wire position: PM500 distortion, origin, PM500 rotation, wire axis rotation */
+
+		norm = 1.;
+		if (normUse[0]) {								/* if I have a normalization tag, try to use it */
+			norm = readHDF5oneValue(filename, normUse);
+			if (norm == norm) {							/* not true if norm is NAN */
+#ifdef TYPICAL_mA
+				if (strcmp(normUse,"mA")==0) norm /= TYPICAL_mA; /* for beam current, divide by typical beam current */
+#endif
+#ifdef TYPICAL_cnt3
+				if (strcmp(normUse,"cnt3")==0) norm /= TYPICAL_cnt3;
+#endif
+				/* printf("\nnorm = %g      %d\n",norm,norm==norm); */
+			}
+			else norm = 1.;								/* no valid normalization, use image as is */
+		}
+		image_set.normalVector.v[m] = norm;
+	}
+	fflush(stdout);
 }
 
 
@@ -1339,63 +2706,34 @@ void writeAllHeaders(
 	int		file_num_start,				/* first output file number */
 	int		file_num_end)				/* last output file number */
 {
-	size_t	pixel_size = (user_preferences.out_pixel_type < 0) ? imaging_parameters.in_pixel_bytes : WinView_itype2len(user_preferences.out_pixel_type);
-	size_t	NpixelsImage = imaging_parameters.nROI_i * imaging_parameters.nROI_j;	/* number of pixels in one whole image */
 	int		i;
-	char	filenameTemp[L_tmpnam];			/* a temp file, delete at end of this routine */
-	char	finalTemplate[L_tmpnam];		/* final template file */
-	char	*buf=NULL;
+	char	finalTemplate[L_tmpnam];		/* final template file, delete at end of this routine */
 	int		dims[2] = {(int)(output_header.xdim), (int)(output_header.ydim)};
-	hid_t	file_id=0;
+	int		chunk[2] = {(int)(imaging_parameters.chunk_rows), (int)(output_header.ydim)};	/* one chunk for each stripe */
+	const char *skip[] = {"entry1/data/data", "entry1/wireX", "entry1/wireY", "entry1/wireZ", NULL};
 
-	/* buf is the same size of one of the output images and is initialized by calloc() to all zeros */
-	buf = (char*)calloc(NpixelsImage , pixel_size);
-	if (!buf) {fprintf(stderr,"\nCould not allocate buf %lu bytes in writeAllHeaders()\n", NpixelsImage*imaging_parameters.in_pixel_bytes); exit(1);}
-
-	/* create the first output file using fn_in_first as a template */
+	/* create the template output file from the meta data of fn_in_first, without the main data and the wire positions */
+	/* for a stack of frames the per-frame vectors (wire positions, beam current, ...) are left out too */
 //#pragma GCC diagnostic push
 //#pragma GCC diagnostic ignored "-Wdeprecated"			/* do not warn that tmpnam is deprecated */
-	strcpy(filenameTemp,tmpnam(NULL));					/* get unique filenames */
-	strcpy(finalTemplate,tmpnam(NULL));
+	strcpy(finalTemplate,tmpnam(NULL));					/* get unique filename */
 //#pragma GCC diagnostic pop
-	copyFile(fn_in_first,filenameTemp,1);
-
-	/* delete the main data in file, and delete the wire positions from the template otuput file */
-	if ((file_id=H5Fopen(filenameTemp,H5F_ACC_RDWR,H5P_DEFAULT))<=0) { fprintf(stderr,"error after file open, file_id = %d\n",file_id); goto error_path; }
-	if ((file_id=H5Fopen(filenameTemp,H5F_ACC_RDWR,H5P_DEFAULT))<=0) { fprintf(stderr,"error after file open, file_id = %d\n",file_id); goto error_path; }
-	if (deleteDataFromFile(file_id,"entry1/data","data")) { fprintf(stderr,"error trying to delete \"/entry1/data/data\", file_id = %d\n",file_id); goto error_path; }	/* delete the data */
-	if (deleteDataFromFile(file_id,"entry1","wireX")) { fprintf(stderr,"error trying to delete \"/entry1/wireX\", file_id = %d\n",file_id); goto error_path; }			/* delete the wire positions */
-	if (deleteDataFromFile(file_id,"entry1","wireY")) { fprintf(stderr,"error trying to delete \"/entry1/wireY\", file_id = %d\n",file_id); goto error_path; }
-	if (deleteDataFromFile(file_id,"entry1","wireZ")) { fprintf(stderr,"error trying to delete \"/entry1/wireZ\", file_id = %d\n",file_id); goto error_path; }
-	if (H5Fclose(file_id)) { fprintf(stderr,"file close error\n"); goto error_path; } else file_id = 0;
+	if (copyHDF5metadata(fn_in_first,finalTemplate,skip,MULTI_FRAME_FILE ? in_header.Nimages : 0)) { fprintf(stderr,"error copying the header of '%s'\n",fn_in_first); goto error_path; }
 
 	/* write the depth */
-	writeDepthInFile(filenameTemp,0.0);					/* create & write the depth, it will overwrite if depth already present */
-
-	/* make a re-packed version of file */
-	if (repackFile(filenameTemp,finalTemplate)) { fprintf(stderr,"error after calling repackFile()\n"); goto error_path; }
+	writeDepthInFile(finalTemplate,0.0);				/* create & write the depth, it will overwrite if depth already present */
 
 	/* re-create the /entry1/data/data, same full size, but with appropriate data type */
-	if(createNewData(finalTemplate,"entry1/data/data",2,dims,getHDFtype(output_header.itype))) fprintf(stderr,"error after calling createNewData()\n");
-
-	/* write entire image back into file, but using different data type, using HDF5WriteROI() */
-	/*	for (i=0;i<(1024*1024);i++) wholeImage[i] = wholeImage[i] & 0x7FFFFFFF;	// trim off high order bit */
-	if ((HDF5WriteROI(finalTemplate,"entry1/data/data",buf,0,(output_header.xdim)-1,0,(output_header.ydim)-1,getHDFtype(output_header.itype),&output_header)))
-	{ fprintf(stderr,"error from HDF5WriteROI()\n"); goto error_path; }
+	/* it is chunked with a fill value of zero, so nothing is stored for the image until a stripe with something in it is written */
+	if(createNewData(finalTemplate,"entry1/data/data",2,dims,getHDFtype(output_header.itype),chunk,COMPRESS_LEVEL)) fprintf(stderr,"error after calling createNewData()\n");
 
 	/* create each of the output files with the correct depth in it */
 	for (i = file_num_start; i <= file_num_end; i++) write1Header(finalTemplate,fn_out_base, i);
 
-	/* delete both unused files */
-	printf("\n ********************************* START FIX HERE *********************************\n");
-	deleteFile(filenameTemp);
-	deleteFile(finalTemplate);
-	printf("\n *********************************   END FIX HERE *********************************\n");
-	CHECK_FREE(buf);
+	deleteFile(finalTemplate);							/* delete the unused template */
 	return;
 
 error_path:
-	CHECK_FREE(buf);
 	exit(1);
 }
 /* write the correct header and a single image of all zeros for an output HDF5 file */
@@ -1422,57 +2760,196 @@ void write1Header(
 }
 
 
+/* single output file mode, instead of one file per depth make <fn_out_base>.h5, holding all of the depths */
+/* in the 3D data set entry1/data/data [depth][i][j], and the depth of each image in the vector entry1/depth */
+/* the file and data set are left open for write_depth_datai(), close them with closeStackFile() */
+void writeStackFile(
+	char	*fn_in_first,				/* full path (including the .h5) to the first input file */
+	char	*fn_out_base)				/* full path of the output file, without the .h5 */
+{
+	char	fname[FILENAME_MAX];		/* full name of file to write */
+	long	m, Ndepths = user_preferences.NoutputDepths;
+	double	*depths=NULL;				/* depth of each output image (micron) */
+	hsize_t	dims[1];
+	hid_t	grp=0;
+	const char *skip[] = {"entry1/data/data", "entry1/wireX", "entry1/wireY", "entry1/wireZ", "entry1/depth", NULL};
+
+	/* start from the meta data of the first input file, the images, wire positions, per-frame vectors, and any depth are not copied */
+	sprintf(fname,"%s.h5",fn_out_base);
+	if (copyHDF5metadata(fn_in_first,fname,skip,MULTI_FRAME_FILE ? in_header.Nimages : 0)) { fprintf(stderr,"error copying the header of '%s' to '%s'\n",fn_in_first,fname); goto error_path; }
+	if ((stack_file_id=H5Fopen(fname,H5F_ACC_RDWR,H5P_DEFAULT))<=0) { fprintf(stderr,"error after file open, file_id = %ld\n",(long)stack_file_id); goto error_path; }
+
+	/* write the depths */
+	depths = calloc((size_t)Ndepths,sizeof(double));
+	if (!depths) { fprintf(stderr,"\nCould not allocate depths %ld points in writeStackFile()\n",Ndepths); goto error_path; }
+	for (m=0; m<Ndepths; m++) depths[m] = index_to_beam_depth(m);
+	dims[0] = (hsize_t)Ndepths;
+	if ((grp=H5Gopen(stack_file_id,"entry1",H5P_DEFAULT))<=0) { fprintf(stderr,"error opening group \"entry1\"\n"); goto error_path; }
+	if (H5LTmake_dataset_double(grp,"depth",1,dims,depths)) { fprintf(stderr,"error writing \"/entry1/depth\"\n"); goto error_path; }
+	if (H5LTset_attribute_string(grp,"depth","units","micron")) { fprintf(stderr,"error writing units attribute to depth\n"); goto error_path; }
+	H5Gclose(grp);
+	CHECK_FREE(depths);
+
+	/* the stack of images, initially all zero, when writing collectively openStackFile() makes it with all of the ranks */
+	if (STACK_COLLECTIVE) return;
+	stack_data_id = createNewStack(stack_file_id,"entry1/data/data",(size_t)Ndepths,output_header.xdim,output_header.ydim,getHDFtype(output_header.itype),imaging_parameters.chunk_rows,COMPRESS_LEVEL);
+	if (stack_data_id<=0) { fprintf(stderr,"error after calling createNewStack()\n"); stack_data_id = 0; goto error_path; }
+	return;
+
+error_path:
+	if (grp>0) H5Gclose(grp);
+	CHECK_FREE(depths);
+	exit(1);
+}
+
+
+/* re-open the output file made by writeStackFile(), to resume an earlier run, or to write into it from several MPI ranks */
+/* when writing collectively, the ranks also create the stack of images here, together */
+void openStackFile(
+	char	*fn_out_base)				/* full path of the output file, without the .h5 */
+{
+	char	fname[FILENAME_MAX];		/* full name of file to open */
+	hid_t	fapl=H5P_DEFAULT;			/* file access properties */
+
+	sprintf(fname,"%s.h5",fn_out_base);
+#if defined(USE_MPI) && defined(H5_HAVE_PARALLEL)
+	if (STACK_COLLECTIVE) {				/* all of the ranks open it together */
+		fapl = H5Pcreate(H5P_FILE_ACCESS);
+		H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+	}
+#endif
+	stack_file_id = H5Fopen(fname,H5F_ACC_RDWR,fapl);
+	if (fapl != H5P_DEFAULT) H5Pclose(fapl);
+	if (stack_file_id<=0) { fprintf(stderr,"error opening '%s' to write, file_id = %ld\n",fname,(long)stack_file_id); stack_file_id = 0; exit(1); }
+#if defined(USE_MPI) && defined(H5_HAVE_PARALLEL)
+	if (STACK_COLLECTIVE && H5Lexists(stack_file_id,"entry1/data/data",H5P_DEFAULT)<=0) {	/* a new file from writeStackFile() */
+		int deflate = HDF5_PARALLEL_DEFLATE ? COMPRESS_LEVEL : 0;
+		if (RANK==0 && deflate<COMPRESS_LEVEL) printf("\nthe output is not compressed, writing compressed data from several MPI ranks needs HDF5 1.14 or later");
+		stack_data_id = createNewStack(stack_file_id,"entry1/data/data",(size_t)user_preferences.NoutputDepths,output_header.xdim,output_header.ydim,getHDFtype(output_header.itype),imaging_parameters.chunk_rows,deflate);
+		if (stack_data_id<=0) { fprintf(stderr,"error after calling createNewStack() on rank %d\n",RANK); stack_data_id = 0; exit(1); }
+		return;
+	}
+#endif
+	if ((stack_data_id=H5Dopen(stack_file_id,"entry1/data/data",H5P_DEFAULT))<=0) { fprintf(stderr,"error opening \"/entry1/data/data\" in '%s'\n",fname); stack_data_id = 0; exit(1); }
+}
+
+
+/* close the output file made by writeStackFile(), nothing to do if it was not used */
+void closeStackFile(void)
+{
+	if (stack_data_id>0) H5Dclose(stack_data_id);
+	if (stack_file_id>0) H5Fclose(stack_file_id);
+	stack_data_id = stack_file_id = 0;
+}
+
+
+/* with MPI and serial HDF5, only one rank at a time may write to the output files, wait for this rank's turn */
+/* the single output file is only open during the turn, nothing to do without MPI or when writing collectively */
+void write_turn_begin(
+	char	*fn_out_base)				/* base name of output image files */
+{
+	(void)fn_out_base;					/* only used with MPI */
+#ifdef USE_MPI
+	if (NRANKS < 2 || STACK_COLLECTIVE) return;
+	mpiWriteTurnBegin();
+	if (SINGLE_OUTPUT_FILE) openStackFile(fn_out_base);
+#endif
+}
+/* done writing this round, close the single output file so the next rank can open it, and pass on the turn */
+void write_turn_end(void)
+{
+#ifdef USE_MPI
+	if (NRANKS < 2 || STACK_COLLECTIVE) return;
+	closeStackFile();
+	mpiWriteTurnEnd();
+#endif
+}
+
+
 
 /* write out one stripe of the reconstructed image, and the correct depth */
 /* multiple image version */
-void write_depth_data(
+/* returns the number of bytes written (uncompressed) */
+size_t write_depth_data(
 	size_t	start_i,					/* start i of this stripe */
 	size_t	end_i,						/* end i of this stripe */
-	char	*fn_base)					/* base name of file, just add index and .h5 */
+	char	*fn_base,					/* base name of file, just add index and .h5 */
+	stepstripe *stripe,					/* the depth resolved stripe, usually &image_set.depth_resolved */
+	double	*image)						/* space for one output image of the stripe, usually image_set.depth_image.v */
 {
 	//	int file_num_end = (int)((user_preferences.depth_end - user_preferences.depth_start) / user_preferences.depth_resolution);
 	int file_num_end = user_preferences.NoutputDepths - 1;
 	int m;
 	char fileName[FILENAME_MAX];
+	size_t bytes=0;
 
 	/*	if (verbose == 2) printf("     "); */
+#if defined(USE_MPI) && defined(H5_HAVE_PARALLEL)
+	if (!stripe) {														/* nothing to write this round, but the writes are collective */
+		for (m=0; m <= file_num_end; m++) HDF5WriteSliceCollective(stack_data_id, (size_t)m, NULL, 0, 0, 0, 0, H5T_IEEE_F64LE);
+		return 0;
+	}
+#endif
+	fileName[0] = '\0';													/* not used with stack_data_id */
 	for (m=0; m <= file_num_end; m++) {									/* output file numbers are in the range [0, file_num_end] */
-		sprintf(fileName,"%s%d.h5",fn_base,m);
-		write_depth_datai(m, start_i, end_i, fileName);
+		if (!stack_data_id) sprintf(fileName,"%s%d.h5",fn_base,m);
+		bytes += write_depth_datai(m, start_i, end_i, fileName, stripe, image);
 	}
+	return bytes;
+}
+/* pthread version of write_depth_data(), job is a write_stripe_job */
+void *write_depth_data_thread(
+	void	*job)
+{
+	write_stripe_job *w = (write_stripe_job *)job;
+	double	t0 = monotonicSeconds();
+	w->metrics->bytes_written = write_depth_data(w->start_i, w->end_i, w->fn_base, w->stripe, w->image);
+	w->metrics->write = monotonicSeconds() - t0;
+	return NULL;
 }
-/* single image version, write both the depth and the data */
-void write_depth_datai(
+/* single image version, write both the depth and the data, returns the number of bytes written, 0 when the stripe is all zero */
+size_t write_depth_datai(
 	int		file_num,					/* the file number to write also the index into the number of output images, zero based */
 	size_t	start_i,					/* start and end i of this stripe */
 	size_t	end_i,
-	char	*fileName)					/* fully qualified name of file */
+	char	*fileName,					/* fully qualified name of file */
+	stepstripe *stripe,					/* the depth resolved stripe */
+	double	*image)						/* space for the image to write, [row][col] */
 {
 	int		output_pixel_type, pixel_size;
-	size_t	m;
-	gsl_matrix *gslMatrix = image_set.depth_resolved.v[file_num];		/* pointer to the gsl_matrix with data to write */
-
-	if (gslMatrix->size2 != gslMatrix->tda) {							/* I will be assuming that this is true, so check here */
-		error("write_depth_datai(), gslMatrix.size1 != gslMatrix.tda");	/* this is needed so I can just write the gslMatrix->data directly */
-		exit(1);
+	size_t	i, k, n;
+	size_t	rows = end_i - start_i + 1;										/* rows in this stripe */
+	size_t	cols = stripe->cols;
+	size_t	*row_start = active_pixels.row_start + start_i;					/* active pixels of this stripe */
+	double	d, dmax=0., dmin=0.;
+
+	/* take depth file_num out of depth_resolved, only active pixels can be non-zero, the rest of image stays zero */
+	memset(image, 0, rows*cols*sizeof(double));
+	for (i=0; i < rows; i++) {
+		for (k=row_start[i]; k < row_start[i+1]; k++) {
+			n = i*cols + (size_t)active_pixels.j[k];
+			d = stripe->v[n*stripe->alloc + (size_t)file_num];
+			if (user_preferences.wireEdge>=0) d = MAX(0,d);					/* using only one edge of wire, no negative numbers */
+			dmax = MAX(dmax,d);
+			dmin = MIN(dmin,d);
+			image[n] = d;
+		}
 	}
 
 #ifdef DEBUG_1_PIXEL
 	if (start_i<=pixelTESTi && pixelTESTi<=end_i)
 		printf("\t%%%%\t about to write stripe[%lu, %lu] of output image % 3d, pixel[%d,%d] = %g\t\tmax pixel = %g\n", \
-			start_i,end_i,file_num,pixelTESTi,pixelTESTj,gsl_matrix_get(gslMatrix, pixelTESTi -  start_i, pixelTESTj),gsl_matrix_max(gslMatrix));
+			start_i,end_i,file_num,pixelTESTi,pixelTESTj,image[(pixelTESTi-start_i)*cols + pixelTESTj],dmax);
 #endif
 
 	output_pixel_type = (user_preferences.out_pixel_type < 0) ? imaging_parameters.in_pixel_type : user_preferences.out_pixel_type;
 	pixel_size = (user_preferences.out_pixel_type < 0) ? imaging_parameters.in_pixel_bytes : WinView_itype2len(user_preferences.out_pixel_type);
-	if (user_preferences.wireEdge>=0) {									/* using only one edge of wire, so ensure that that all values are positive (not using both edges of wire) */
-		double	*d;
-		if (gsl_matrix_max(gslMatrix)<=0.0) return;						/* do not need to write blocks of zero */
-		for (m=0, d=gslMatrix->data; m<(gslMatrix->size1 * gslMatrix->tda + gslMatrix->size2); m++, d++) {
-			*d = MAX(0,*d);												/* set all values in gslMatrix to a minimum of zero, no negative numbers */
-		}
+	if (dmax==0 && dmin==0) {											/* do not need to write blocks of zero */
+#if defined(USE_MPI) && defined(H5_HAVE_PARALLEL)
+		if (STACK_COLLECTIVE) HDF5WriteSliceCollective(stack_data_id, (size_t)file_num, NULL, 0, 0, 0, 0, H5T_IEEE_F64LE);	/* the other ranks may be writing */
+#endif
+		return 0;
 	}
-	else if (gsl_matrix_max(gslMatrix)==0 && gsl_matrix_min(gslMatrix)==0) return;	/* for both sides of wire check if this piece of an image is all zero */
 
 	/*	WinViewWriteROI(readfile, (char*)cbuf, output_pixel_type, imaging_parameters.nROI_i, 0, imaging_parameters.nROI_i - 1, start_i, end_i); */
 	struct HDF5_Header header;
@@ -1481,17 +2958,21 @@ void write_depth_datai(
 	header.isize = pixel_size;
 	header.itype = output_pixel_type;
 
-	HDF5WriteROI(fileName,"entry1/data/data",(void*)(gslMatrix->data), start_i, end_i, 0, (size_t)(imaging_parameters.nROI_j - 1), H5T_IEEE_F64LE, &header);
+	HDF5_LOCK
+#if defined(USE_MPI) && defined(H5_HAVE_PARALLEL)
+	if (STACK_COLLECTIVE) HDF5WriteSliceCollective(stack_data_id, (size_t)file_num, (void*)image, start_i, end_i, 0, (size_t)(imaging_parameters.nROI_j - 1), H5T_IEEE_F64LE);
+	else
+#endif
+	if (stack_data_id>0) HDF5WriteSlice(stack_data_id, (size_t)file_num, (void*)image, start_i, end_i, 0, (size_t)(imaging_parameters.nROI_j - 1), H5T_IEEE_F64LE);
+	else HDF5WriteROI(fileName,"entry1/data/data",(void*)image, start_i, end_i, 0, (size_t)(imaging_parameters.nROI_j - 1), H5T_IEEE_F64LE, &header);
+	HDF5_UNLOCK
+	return rows * (size_t)imaging_parameters.nROI_j * (size_t)pixel_size;
 }
 
 
 
 
 
-
-
-
-
 /* convert index of a depth resolved image to its depth along the beam (micron) */
 /* this is the depth of the center of the bin */
 double index_to_beam_depth(
@@ -1503,104 +2984,6 @@ double index_to_beam_depth(
 }
 
 
-#warning "find_first_valid_i() and find_last_valid_i() my be unusable with this detector"
-/* find the lowest possible row (i) in the image given the depth range and image size.  Only the first wire position of the scan is needed. */
-int find_first_valid_i(
-	int ilo,							/* check i in the range [ilo,ihi], thses are usually the ends of the image */
-	int ihi,
-	int j1,								/* check pixels (i,j1) and(i,j2) */
-	int j2,
-	point_xyz wire,						/* first wire position (xyz) of wire scan (in beam line coords relative to the Si) */
-	BOOLEAN use_leading_wire_edge)		/* true=used leading endge of wire, false=use trailing edge of wire */
-{
-	int i;							/* index to a row in the image */
-	double	d;						/* computed depth from either j1 or j2 */
-	point_ccd pixel_edge;			/* pixel indicies for the edge of a pixel (e.g. [117,90.5]) */
-	point_xyz back_edge;			/* xyz postition of the trailing edge of the pixel (in beam line coords relative to the Si) */
-	double depth_end = user_preferences.depth_end;							/* max depth of a reconstructed image */
-
-	for (i=ilo; i<=ihi; i++) {
-		pixel_edge.i = 0.5 + (double)i;
-		pixel_edge.j = (double)j1;
-		back_edge = pixel_to_point_xyz(pixel_edge);							/* the back (low) edge of this pixel, using j1 */
-		d = pixel_xyz_to_depth(back_edge, wire, use_leading_wire_edge);
-		/* change d by depth offset DDDDDDDDDDDDDD ?????*/
-		if (user_preferences.depth_start <= d && d <= depth_end) return i;	/* this d lies in our depth range, so i is OK */
-		if (i==ilo && user_preferences.depth_start > d && d <= depth_end) return i;	/* limiting i is negative */
-
-		pixel_edge.j = (double)j2;
-		back_edge = pixel_to_point_xyz(pixel_edge);							/* the back (low) edge of this pixel, using j2 */
-		d = pixel_xyz_to_depth(back_edge, wire, use_leading_wire_edge);
-		/* change d by depth offset DDDDDDDDDDDDDD ?????*/
-		if (user_preferences.depth_start <= d && d <= depth_end) return i;	/* this d lies in our depth range, so i is OK */
-		if (i==ilo && user_preferences.depth_start > d && d <= depth_end) return i;	/* limiting i is negative */
-	}
-	return -1;																/* none of the i were acceptable */
-}
-
-
-/* find the highest possible row (i) in the image given the depth range and image size.  Only the last wire position of the scan is needed. */
-int find_last_valid_i(
-	int ilo,							/* check i in the range [ilo,ihi] */
-	int ihi,
-	int j1,								/* check pixels (i,j1) and(i,j2) ilo & ihi are usually edges of image */
-	int j2,
-	point_xyz wire,						/* last wire position (xyz) of wire scan (in beam line coords relative to the Si) */
-	BOOLEAN use_leading_wire_edge)		/* true=used leading endge of wire, false=use trailing edge of wire */
-{
-	int i;							/* index to a row in the image */
-	double	d;						/* computed depth from either j1 or j2 */
-	point_ccd pixel_edge;			/* pixel indicies for the edge of a pixel (e.g. [117,90.5]) */
-	point_xyz front_edge;			/* xyz postition of the leading edge of the pixel (in beam line coords relative to the Si) */
-	double depth_end = user_preferences.depth_end;							/* max depth of a reconstructed image */
-
-	for (i=ihi; i>=ilo; i--) {
-		pixel_edge.i = -0.5 + (double)i;
-		pixel_edge.j = (double)j1;
-		front_edge = pixel_to_point_xyz(pixel_edge);						/* the front (low) edge of this pixel, using j1 */
-		d = pixel_xyz_to_depth(front_edge, wire, use_leading_wire_edge);
-		/* change d by depth offset DDDDDDDDDDDDDD ?????*/
-		if (user_preferences.depth_start <= d && d <= depth_end) return i;	/* this d lies in our depth range, so i is OK */
-		if (i==ihi && d > depth_end) return i;								/* limiting i is past end of detector */
-
-		pixel_edge.j = (double)j2;
-		front_edge = pixel_to_point_xyz(pixel_edge);						/* the front (low) edge of this pixel, using j2 */
-		d = pixel_xyz_to_depth(front_edge, wire, use_leading_wire_edge);
-		/* change d by depth offset DDDDDDDDDDDDDD ?????*/
-		if (user_preferences.depth_start <= d && d <= depth_end) return i;	/* this d lies in our depth range, so i is OK */
-		if (i==ihi && d > depth_end) return i;								/* limiting i is past end of detector */
-	}
-	return -1;																/* none of the i were acceptable */
-}
-
-
-
-/* convert PM500 {x,y,z} to beam line {x,y,z} */
-point_xyz wirePosition2beamLine(
-	point_xyz wire_pos)								/* PM500 {x,y,z} values */
-{
-	double x,y,z;
-
-	x = X2corrected(wire_pos.x);				/* do PM500 distortion correction for wire */
-	y = Y2corrected(wire_pos.y);
-	z = Z2corrected(wire_pos.z);
-	x -= calibration.wire.centre_at_si_xyz.x;	/* offset wire to origin (the Si position) */
-	y -= calibration.wire.centre_at_si_xyz.y;
-	z -= calibration.wire.centre_at_si_xyz.z;
-
-	/* rotate by the orientation of the positioner, this does not make the wire axis parallel to beam-line x-axis */
-	wire_pos.x = calibration.wire.rotation[0][0]*x + calibration.wire.rotation[0][1]*y + calibration.wire.rotation[0][2]*z;	/* {X2,Y2,Z2} = w.Rij x {x,y,z},   rotate by R (a small rotation) */
-	wire_pos.y = calibration.wire.rotation[1][0]*x + calibration.wire.rotation[1][1]*y + calibration.wire.rotation[1][2]*z;
-	wire_pos.z = calibration.wire.rotation[2][0]*x + calibration.wire.rotation[2][1]*y + calibration.wire.rotation[2][2]*z;
-
-	/* #warning "what should I do about the rotation to put wire axis parallel to beam line axis" */
-	wire_pos = MatrixMultiply31(calibration.wire.rho,wire_pos);	/* wire_centre = rho x wire_centre, rotate wire position so wire axis lies along {1,0,0} */
-
-	return wire_pos;
-}
-
-
-
 
 
 
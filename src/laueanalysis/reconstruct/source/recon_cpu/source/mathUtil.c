@@ -30,6 +30,40 @@ int compare_double(double *a, double *b)
 }
 
 
+/* return the value that would be a[k] if a[n] were sorted, the order of a is changed.  Average time is O(n) (Hoare's select) */
+double select_kth_double(
+double	*a,						/* array to search, it is partially sorted on return */
+size_t	n,						/* length of a */
+size_t	k)						/* want k-th smallest, zero based */
+{
+	size_t	lo=0, hi=n-1;		/* a[k] is somewhere in [lo,hi] */
+	size_t	i, j;
+	double	pivot, swap;
+
+	if (n<1) return NAN;
+	k = (k<n) ? k : n-1;
+	while (lo < hi) {
+		pivot = a[lo + (hi-lo)/2];
+		i = lo;
+		j = hi;
+		while (i <= j) {					/* partition [lo,hi] about pivot */
+			while (a[i] < pivot) i++;
+			while (pivot < a[j]) j--;
+			if (i <= j) {
+				swap = a[i]; a[i] = a[j]; a[j] = swap;
+				i++;
+				if (j==0) break;
+				j--;
+			}
+		}
+		if (k <= j) hi = j;					/* [lo,j] <= pivot <= [i,hi] */
+		else if (k >= i) lo = i;
+		else break;							/* a[k] == pivot */
+	}
+	return a[k];
+}
+
+
 /* set mat to be a rotation matrix about axis with angle */
 int rotationMatFromAxis(
 point_xyz	axis,				/* axis about which to rotate (or possibly Rodriques vector lenght is angle in radian) */
@@ -55,6 +55,100 @@ herr_t get1HDF5attr_string(hid_t file_id, char *groupName, char *attrName, char
 int get1HDF5data_tagVal(hid_t file_id, char *groupName, char *dataName, char *tagName, char result1[256]);
 int get1HDF5attr_tagVal(hid_t file_id, char *groupName, char *attrName, char *tagName, char result1[256]);
 herr_t groupExists(hid_t file_id, char *groupName);
+struct HDF5_cacheEntry *HDF5cacheOpen(const char *fileName);
+hid_t chunkedDataPlist(int rank, const hsize_t *chunk, int deflate);
+
+
+
+/*******************************************************************************************
+***********************************  Open Input File Cache  ********************************
+********************************************************************************************/
+
+/* The read routines below are called for every image of every stripe, and each call used to re-open the file.
+ * When the cache is turned on with HDF5cacheSetSize(), input files stay open (read only) together with the
+ * dataset last read by HDF5ReadROIdouble() and the header found by readHDF5header().  When the cache is full,
+ * the most recently used file is closed.  Every stripe reads the files in the same order, so with more files
+ * than entries, least recently used would close each file just before it is needed again.  This way the
+ * first files stay open and only the last entry turns over.
+ * This is not thread safe, the caller must serialize all HDF5 calls. */
+struct HDF5_cacheEntry {
+	char	fileName[FILENAME_MAX];		/* full path name of an open file, empty if entry is unused */
+	hid_t	file_id;					/* opened read only */
+	hid_t	data_id;					/* data set dataName, 0 if not open */
+	char	dataName[MAX_micro_STRING_LEN+1];
+	struct HDF5_Header *head;			/* header from readHDF5header(), NULL if not yet read */
+	unsigned long lastUse;				/* value of HDF5cacheClock when this entry was last used */
+};
+static struct HDF5_cacheEntry *HDF5cache=NULL;
+static int HDF5cacheN=0;				/* number of entries in HDF5cache, 0 means no caching */
+static unsigned long HDF5cacheClock=0;
+
+
+static void HDF5cacheClose(				/* close one entry of the cache, it becomes unused */
+struct HDF5_cacheEntry *c)
+{
+	if (c->data_id>0) H5Dclose(c->data_id);
+	if (c->file_id>0) H5Fclose(c->file_id);
+	CHECK_FREE(c->head)
+	c->data_id = c->file_id = 0;
+	c->fileName[0] = c->dataName[0] = '\0';
+	c->lastUse = 0;
+}
+
+
+void HDF5cacheSetSize(					/* set the maximum number of open input files, 0 closes all of them and turns off the cache */
+int		N)
+{
+	int		i;
+	for (i=0;i<HDF5cacheN;i++) HDF5cacheClose(HDF5cache+i);
+	CHECK_FREE(HDF5cache)
+	HDF5cacheN = 0;
+	N = MIN(N,HDF5_CACHE_MAX);
+	if (N<1) return;
+	if (!(HDF5cache = (struct HDF5_cacheEntry *)calloc((size_t)N,sizeof(struct HDF5_cacheEntry)))) return;	/* no room, no caching */
+	HDF5cacheN = N;
+}
+
+
+void HDF5cacheForget(					/* close fileName if it is in the cache, call before opening it any other way */
+const char *fileName)
+{
+	int		i;
+	for (i=0;i<HDF5cacheN;i++) {
+		if (HDF5cache[i].file_id>0 && !strcmp(HDF5cache[i].fileName,fileName)) HDF5cacheClose(HDF5cache+i);
+	}
+}
+
+
+/* return the cache entry for fileName, opening the file if it is not already open.  Returns NULL if the
+ * cache is off, or the file cannot be opened.  When NULL, the caller should open and close the file itself. */
+struct HDF5_cacheEntry *HDF5cacheOpen(
+const char *fileName)
+{
+	int		i, unused=-1, mru=0;
+	hid_t	file_id;
+
+	if (HDF5cacheN<1 || strlen(fileName)>=FILENAME_MAX) return NULL;
+	for (i=0;i<HDF5cacheN;i++) {
+		if (HDF5cache[i].file_id<=0) {
+			if (unused<0) unused = i;
+			continue;
+		}
+		if (!strcmp(HDF5cache[i].fileName,fileName)) {
+			HDF5cache[i].lastUse = ++HDF5cacheClock;
+			return HDF5cache+i;
+		}
+		if (HDF5cache[i].lastUse > HDF5cache[mru].lastUse) mru = i;
+	}
+	if (unused>=0) mru = unused;						/* not full yet */
+
+	if ((file_id=H5Fopen(fileName,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) return NULL;
+	HDF5cacheClose(HDF5cache+mru);						/* re-use most recently used entry */
+	strcpy(HDF5cache[mru].fileName,fileName);
+	HDF5cache[mru].file_id = file_id;
+	HDF5cache[mru].lastUse = ++HDF5cacheClock;
+	return HDF5cache+mru;
+}
 
 
 
@@ -126,6 +220,7 @@ struct HDF5_Header *head)				/* HDF5 header information (header must be valid an
 	if (xlo>xhi || ylo>yhi || xhi>xdim-1 || yhi>ydim-1) return 2;	/* no image to write, invalid range */
 	pixels = xdim * ydim;								/* total number of pixels in the image */
 
+	HDF5cacheForget(fileName);							/* cannot have it open read only at the same time */
 	if ((file_id=H5Fopen(fileName,H5F_ACC_RDWR,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5WriteROI(), cannot open the file '%s'\n",fileName); ERROR_PATH(file_id) }
 	if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5WriteROI(), the data '%s' does not exist\n",dataName); ERROR_PATH(data_id) }
 	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)	/* dataspace identifier */
@@ -284,6 +379,7 @@ struct HDF5_Header *head)				/* HDF5 header information (header must be valid!)
 {
 	herr_t	i, err=0;
 	hid_t	file_id;
+	struct HDF5_cacheEntry *c=NULL;		/* cached open file, NULL if not cached */
 	hid_t	data_id=0;					/* location id of the data in file */
 	hid_t	dataspace=0;
 	hid_t	memspace=0; 
@@ -331,8 +427,17 @@ struct HDF5_Header *head)				/* HDF5 header information (header must be valid!)
 	if (xlo>xhi || ylo>yhi || xhi>xdim-1 || yhi>ydim-1) return 2;	/* no image to read, invalid range */
 	pixels = xdim * ydim;								/* total number of pixels in the image */
 
-	if ((file_id=H5Fopen(fileName,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROI(), cannot open the file '%s'\n",fileName); ERROR_PATH(file_id) }
-	if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROI(), the data '%s' does not exist\n",dataName); ERROR_PATH(data_id) }
+	if ((c=HDF5cacheOpen(fileName))) file_id = c->file_id;
+	else if ((file_id=H5Fopen(fileName,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROI(), cannot open the file '%s'\n",fileName); ERROR_PATH(file_id) }
+	if (c && c->data_id>0 && !strcmp(c->dataName,dataName)) data_id = c->data_id;	/* data set is already open */
+	else {
+		if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROI(), the data '%s' does not exist\n",dataName); ERROR_PATH(data_id) }
+		if (c && strlen(dataName)<=MAX_micro_STRING_LEN) {	/* keep it open with the file */
+			if (c->data_id>0) H5Dclose(c->data_id);
+			c->data_id = data_id;
+			strcpy(c->dataName,dataName);
+		}
+	}
 	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)	/* dataspace identifier */
 
 	/* check for existance of data */
@@ -374,39 +479,334 @@ struct HDF5_Header *head)				/* HDF5 header information (header must be valid!)
 	if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL))<0)			{ fprintf(stderr,"error in H5Sselect_hyperslab(dataspace)=%d\n",i); ERROR_PATH(i) }
 	if ((i=H5Dread(data_id,H5T_IEEE_F64LE,memspace,dataspace,H5P_DEFAULT,*vbuf))<0)			{ fprintf(stderr,"error in H5Dread(hyperslab)=%d\n",i); ERROR_PATH(i) }
 
+	error_path:
+	if (memspace>0) H5Sclose(memspace);
+	if (dataspace>0) H5Sclose(dataspace);
+	if (data_id>0 && !(c && data_id==c->data_id)) H5Dclose(data_id);
+	if (file_id>0 && !c) H5Fclose(file_id);
+	return err;
+}
+
+
+
+/* read an ROI of a 2D image directly into one step of a stack stored [x][y][step], i.e. vbuf[(x*memY + y)*Nsteps + step] */
+/* HDF5 converts from the type in the file to memType, and scatters the values into place, there is no intermediate buffer */
+/* region [xlo,ylo] to [xhi,yhi] of the file goes to vbuf[0...xhi-xlo][ylo...yhi][step], it must fit inside [memX][memY] */
+/* the columns keep their place so that a stripe can read just the columns it needs, the other columns of vbuf are not touched */
+int HDF5ReadROIstep(
+const char	*fileName,					/* full path name to file */
+const char	*dataName,					/* full path name to data, e.g. "entry1/data/data" */
+void	*vbuf,							/* the stack, must already be allocated as [memX][memY][Nsteps] of memType */
+hid_t	memType,						/* type of the numbers in vbuf, e.g. H5T_NATIVE_DOUBLE */
+size_t	memX,							/* dimensions of vbuf */
+size_t	memY,
+size_t	Nsteps,
+size_t	step,							/* which step of vbuf to fill */
+size_t	xlo,							/* reads region [xlo,ylo] to [xhi,yhi] */
+size_t	xhi,
+size_t	ylo,
+size_t	yhi,
+struct HDF5_Header *head)				/* HDF5 header information (header must be valid!) */
+{
+	herr_t	i, err=0;
+	hid_t	file_id=0;
+	hid_t	data_id=0;					/* location id of the data in file */
+	hid_t	dataspace=0;
+	hid_t	memspace=0;
+	struct HDF5_cacheEntry *c=NULL;		/* cached open file, NULL if not cached */
+	hsize_t	dims_out[5];				/* dataset dimensions, 5 is larger than necessary, we should only need 2 */
+	int		rank=0;
+
+	hsize_t	dimsm[3];					/* memory space dimensions */
+	hsize_t	count[2]={0,0};				/* size of the hyperslab in the file */
+	hsize_t	offset[2]={0,0};			/* hyperslab offset in the file */
+	hsize_t	count_out[3];				/* size of the hyperslab in memory */
+	hsize_t	offset_out[3];				/* hyperslab offset in memory */
+	size_t	nx, ny;						/* number of points in x and y */
+
+	if (!vbuf || !head) return -1;
+	if (strlen(fileName)<1 || strlen(dataName)<1) return -1;	/* need valid file and data name */
+	xhi = (xhi>(head->xdim-1)) ? head->xdim-1 : xhi;	/* xhi is now actual to use */
+	yhi = (yhi>(head->ydim-1)) ? head->ydim-1 : yhi;
+	if (xlo>xhi || ylo>yhi) return 2;					/* no image to read, invalid range */
+	nx = xhi - xlo + 1;									/* number of pixels in ROI along X and Y */
+	ny = yhi - ylo + 1;
+	if (step>=Nsteps) return 2;							/* no room in vbuf */
+
+	if ((c=HDF5cacheOpen(fileName))) file_id = c->file_id;
+	else if ((file_id=H5Fopen(fileName,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROIstep(), cannot open the file '%s'\n",fileName); ERROR_PATH(file_id) }
+	if (c && c->data_id>0 && !strcmp(c->dataName,dataName)) data_id = c->data_id;	/* data set is already open */
+	else {
+		if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROIstep(), the data '%s' does not exist\n",dataName); ERROR_PATH(data_id) }
+		if (c && strlen(dataName)<=MAX_micro_STRING_LEN) {	/* keep it open with the file */
+			if (c->data_id>0) H5Dclose(c->data_id);
+			c->data_id = data_id;
+			strcpy(c->dataName,dataName);
+		}
+	}
+	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)	/* dataspace identifier */
+	if ((rank=H5Sget_simple_extent_dims(dataspace,dims_out,NULL))<0) ERROR_PATH(rank)
+	if (rank != 2) ERROR_PATH(rank)						/* only understand rank==2 data here */
+
+#ifdef RECONSTRUCT_BACKWARDS							/* this is the way it used to be */
+	if (nx>memX || yhi>=memY) ERROR_PATH(2)				/* ROI does not fit in vbuf */
+	offset[0]=xlo;		offset[1]=ylo;					/* define which part of the data in the file to read */
+	count[0]=nx;		count[1]=ny;
+	count_out[0]=nx;	count_out[1]=ny;
+	offset_out[0]=0;	offset_out[1]=ylo;
+#else
+/* HDF stores transpose of what I expect */
+	if (yhi>=memX || nx>memY) ERROR_PATH(2)
+	offset[1]=xlo;		offset[0]=ylo;
+	count[1]=nx;		count[0]=ny;
+	count_out[1]=nx;	count_out[0]=ny;
+	offset_out[1]=0;	offset_out[0]=ylo;
+#endif
+	dimsm[0] = memX;	dimsm[1] = memY;	dimsm[2] = Nsteps;
+	offset_out[2] = step;
+	count_out[2] = 1;
+	if ((memspace=H5Screate_simple(3,dimsm,NULL))<0) ERROR_PATH(memspace)	/* all of vbuf */
+
+	if ((i=H5Sselect_hyperslab(memspace,H5S_SELECT_SET,offset_out,NULL,count_out,NULL))<0)	{ fprintf(stderr,"error in H5Sselect_hyperslab(memspace)=%d\n",i); ERROR_PATH(i) }
+	if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL))<0)			{ fprintf(stderr,"error in H5Sselect_hyperslab(dataspace)=%d\n",i); ERROR_PATH(i) }
+	if ((i=H5Dread(data_id,memType,memspace,dataspace,H5P_DEFAULT,vbuf))<0)					{ fprintf(stderr,"error in H5Dread(hyperslab)=%d\n",i); ERROR_PATH(i) }
+
+	error_path:
+	if (memspace>0) H5Sclose(memspace);
+	if (dataspace>0) H5Sclose(dataspace);
+	if (data_id>0 && !(c && data_id==c->data_id)) H5Dclose(data_id);
+	if (file_id>0 && !c) H5Fclose(file_id);
+	return err;
+}
+
+
+
+/* read an ROI of frames [frame, frame+Nframes-1] of a stack of images [Nimages][x][y] into steps [step, step+Nframes-1] of a stack stored [x][y][step] */
+/* all of the frames are read with one H5Dread into a temporary buffer, then scattered into place, HDF5 cannot do this transpose itself */
+/* apart from taking many frames, the placement in vbuf is the same as HDF5ReadROIstep(), so Nframes=1 of a 2D image works like it */
+int HDF5ReadROIframes(
+const char	*fileName,					/* full path name to file */
+const char	*dataName,					/* full path name to data, e.g. "entry1/data/data" */
+void	*vbuf,							/* the stack, must already be allocated as [memX][memY][Nsteps] of memType */
+hid_t	memType,						/* type of the numbers in vbuf, e.g. H5T_NATIVE_DOUBLE */
+size_t	memX,							/* dimensions of vbuf */
+size_t	memY,
+size_t	Nsteps,
+size_t	step,							/* first step of vbuf to fill */
+size_t	frame,							/* first frame in the file to read */
+size_t	Nframes,						/* number of frames to read */
+size_t	xlo,							/* reads region [xlo,ylo] to [xhi,yhi] of each frame */
+size_t	xhi,
+size_t	ylo,
+size_t	yhi,
+struct HDF5_Header *head)				/* HDF5 header information (header must be valid!) */
+{
+	herr_t	i, err=0;
+	hid_t	file_id=0;
+	hid_t	data_id=0;					/* location id of the data in file */
+	hid_t	dataspace=0;
+	hid_t	memspace=0;
+	struct HDF5_cacheEntry *c=NULL;		/* cached open file, NULL if not cached */
+	hsize_t	dims_out[5];				/* dataset dimensions, 5 is larger than necessary, we should only need 3 */
+	int		rank=0;
+
+	hsize_t	count[3]={1,0,0};			/* size of the hyperslab in the file, [frame][a][b] */
+	hsize_t	offset[3]={0,0,0};			/* hyperslab offset in the file */
+	size_t	off_a, off_b;				/* where [0][0] of a frame goes in [memX][memY] */
+	size_t	na, nb;						/* size of one frame in the file */
+	size_t	a, b, f, sz;
+	char	*tmp=NULL;					/* the frames as they are in the file [Nframes][na][nb] */
+	char	*dst;
+
+	if (!vbuf || !head || Nframes<1) return -1;
+	if (strlen(fileName)<1 || strlen(dataName)<1) return -1;	/* need valid file and data name */
+	xhi = (xhi>(head->xdim-1)) ? head->xdim-1 : xhi;	/* xhi is now actual to use */
+	yhi = (yhi>(head->ydim-1)) ? head->ydim-1 : yhi;
+	if (xlo>xhi || ylo>yhi) return 2;					/* no image to read, invalid range */
+	if (step+Nframes>Nsteps) return 2;					/* no room in vbuf */
+	if (!(sz=H5Tget_size(memType))) return -1;
+
+#ifdef RECONSTRUCT_BACKWARDS							/* this is the way it used to be */
+	na = xhi - xlo + 1;		nb = yhi - ylo + 1;
+	offset[1]=xlo;			offset[2]=ylo;
+	off_a = 0;				off_b = ylo;
+#else
+/* HDF stores transpose of what I expect */
+	na = yhi - ylo + 1;		nb = xhi - xlo + 1;
+	offset[1]=ylo;			offset[2]=xlo;
+	off_a = ylo;			off_b = 0;
+#endif
+	if (off_a+na>memX || off_b+nb>memY) return 2;		/* ROI does not fit in vbuf */
+	count[1] = na;			count[2] = nb;
+	offset[0] = frame;		count[0] = Nframes;
+
+	if ((c=HDF5cacheOpen(fileName))) file_id = c->file_id;
+	else if ((file_id=H5Fopen(fileName,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROIframes(), cannot open the file '%s'\n",fileName); ERROR_PATH(file_id) }
+	if (c && c->data_id>0 && !strcmp(c->dataName,dataName)) data_id = c->data_id;	/* data set is already open */
+	else {
+		if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- HDF5ReadROIframes(), the data '%s' does not exist\n",dataName); ERROR_PATH(data_id) }
+		if (c && strlen(dataName)<=MAX_micro_STRING_LEN) {	/* keep it open with the file */
+			if (c->data_id>0) H5Dclose(c->data_id);
+			c->data_id = data_id;
+			strcpy(c->dataName,dataName);
+		}
+	}
+	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)	/* dataspace identifier */
+	if ((rank=H5Sget_simple_extent_dims(dataspace,dims_out,NULL))<0) ERROR_PATH(rank)
+	if (rank==2) {										/* a single image, treat it as a stack of one */
+		if (frame || Nframes>1) ERROR_PATH(2)
+		if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset+1,NULL,count+1,NULL))<0)	{ fprintf(stderr,"error in H5Sselect_hyperslab(dataspace)=%d\n",i); ERROR_PATH(i) }
+	}
+	else if (rank==3) {
+		if (frame+Nframes>dims_out[0]) { fprintf(stderr,"ERROR -- HDF5ReadROIframes(), frames [%lu, %lu] not in '%s', it has %llu\n",frame,frame+Nframes-1,fileName,dims_out[0]); ERROR_PATH(2) }
+		if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL))<0)			{ fprintf(stderr,"error in H5Sselect_hyperslab(dataspace)=%d\n",i); ERROR_PATH(i) }
+	}
+	else ERROR_PATH(rank)								/* only understand rank 2 or 3 data here */
+	if ((memspace=H5Screate_simple(3,count,NULL))<0) ERROR_PATH(memspace)	/* all of tmp */
+
+	if (!(tmp=(char*)malloc(Nframes*na*nb*sz))) { fprintf(stderr,"ERROR -- HDF5ReadROIframes(), cannot allocate %lu bytes\n",Nframes*na*nb*sz); ERROR_PATH(5) }
+	if ((i=H5Dread(data_id,memType,memspace,dataspace,H5P_DEFAULT,tmp))<0)					{ fprintf(stderr,"error in H5Dread(hyperslab)=%d\n",i); ERROR_PATH(i) }
+
+	/* scatter into [x][y][step], the frames of one pixel are contiguous in vbuf */
+	for (a=0; a<na; a++) {
+		for (b=0; b<nb; b++) {
+			dst = (char*)vbuf + (((off_a+a)*memY + off_b+b)*Nsteps + step)*sz;
+			if (sz==sizeof(double)) {
+				for (f=0; f<Nframes; f++) ((double*)dst)[f] = ((double*)tmp)[(f*na + a)*nb + b];
+			}
+			else if (sz==sizeof(float)) {
+				for (f=0; f<Nframes; f++) ((float*)dst)[f] = ((float*)tmp)[(f*na + a)*nb + b];
+			}
+			else {
+				for (f=0; f<Nframes; f++) memcpy(dst+f*sz, tmp+((f*na + a)*nb + b)*sz, sz);
+			}
+		}
+	}
+
+	error_path:
+	if (tmp) free(tmp);
+	if (memspace>0) H5Sclose(memspace);
+	if (dataspace>0) H5Sclose(dataspace);
+	if (data_id>0 && !(c && data_id==c->data_id)) H5Dclose(data_id);
+	if (file_id>0 && !c) H5Fclose(file_id);
+	return err;
+}
+
+
+/* read values [frame, frame+N-1] of a vector that has one value for each frame in a stack of images, e.g. "entry1/wireX" */
+/* a single value (a scalar or a vector of length 1) is the same for every frame, so it is copied into all N */
+/* returns 0 if OK, non-zero if the data does not exist or is too short */
+int readHDF5frameVector(
+const char	*fileName,					/* full path name to file */
+const char	*dataName,					/* full path name to data */
+double	*v,								/* put the N values here */
+size_t	frame,							/* first frame */
+size_t	N)								/* number of values to read */
+{
+	herr_t	i, err=0;
+	hid_t	file_id=0;
+	hid_t	data_id=0;
+	hid_t	dataspace=0;
+	hid_t	memspace=0;
+	struct HDF5_cacheEntry *c=NULL;		/* cached open file, NULL if not cached */
+	hsize_t	dims_out[5]={0,0,0,0,0};
+	hsize_t	offset[1], count[1];
+	int		rank=0;
+	size_t	m;
+
+	if (!v || N<1 || strlen(fileName)<1 || strlen(dataName)<1) return -1;
+	if ((c=HDF5cacheOpen(fileName))) file_id = c->file_id;
+	else if ((file_id=H5Fopen(fileName,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) ERROR_PATH(file_id)
+	if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<=0) ERROR_PATH(data_id)
+	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)
+	if ((rank=H5Sget_simple_extent_dims(dataspace,dims_out,NULL))<0 || rank>1) ERROR_PATH(-1)	/* only scalars and vectors */
+
+	if (rank==0 || dims_out[0]==1) {					/* one value for all frames */
+		if ((i=H5Dread(data_id,H5T_NATIVE_DOUBLE,H5S_ALL,H5S_ALL,H5P_DEFAULT,v))<0) ERROR_PATH(i)
+		for (m=1; m<N; m++) v[m] = v[0];
+	}
+	else {
+		if (frame+N>dims_out[0]) { fprintf(stderr,"ERROR -- readHDF5frameVector(), '%s' has %llu values, need [%lu, %lu]\n",dataName,dims_out[0],frame,frame+N-1); ERROR_PATH(2) }
+		offset[0] = frame;		count[0] = N;
+		if ((memspace=H5Screate_simple(1,count,NULL))<0) ERROR_PATH(memspace)
+		if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL))<0) ERROR_PATH(i)
+		if ((i=H5Dread(data_id,H5T_NATIVE_DOUBLE,memspace,dataspace,H5P_DEFAULT,v))<0) ERROR_PATH(i)
+	}
+
 	error_path:
 	if (memspace>0) H5Sclose(memspace);
 	if (dataspace>0) H5Sclose(dataspace);
 	if (data_id>0) H5Dclose(data_id);
-	if (file_id>0) H5Fclose(file_id);
+	if (file_id>0 && !c) H5Fclose(file_id);
 	return err;
 }
 
 
 
+/* property list to create a chunked data set whose chunks are only stored once something is written to them, */
+/* parts never written read as zero.  If deflate>0 the chunks are compressed with shuffle+deflate at that level, */
+/* shuffle puts the bytes of the same significance together which makes the mostly zero images compress well */
+/* returns the property list, the caller must H5Pclose() it, returns <=0 on error */
+hid_t chunkedDataPlist(
+int		rank,								/* rank of the data set */
+const hsize_t *chunk,						/* dimensions of one chunk */
+int		deflate)							/* deflate level [1,9], 0 is no compression */
+{
+	hid_t	plist=0;
+	double	zero=0.;
+	herr_t	err=0;
+
+	if ((plist=H5Pcreate(H5P_DATASET_CREATE))<=0) ERROR_PATH(plist)
+	if ((err=H5Pset_chunk(plist,rank,chunk))<0) ERROR_PATH(err)
+	if ((err=H5Pset_fill_value(plist,H5T_NATIVE_DOUBLE,&zero))<0) ERROR_PATH(err)
+	if ((err=H5Pset_alloc_time(plist,H5D_ALLOC_TIME_INCR))<0) ERROR_PATH(err)	/* a chunk is stored when first written */
+	if ((err=H5Pset_fill_time(plist,H5D_FILL_TIME_IFSET))<0) ERROR_PATH(err)
+	if (deflate>0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE)>0) {
+		if ((err=H5Pset_shuffle(plist))<0) ERROR_PATH(err)
+		if ((err=H5Pset_deflate(plist,(unsigned)MIN(deflate,9)))<0) ERROR_PATH(err)
+	}
+	return plist;
+
+	error_path:
+	if (plist>0) H5Pclose(plist);
+	return (err<0 ? err : -1);
+}
+
+
 /* Create the data space for the dataset. */
 /*	e.g.	dims[2]={4,6};	 for rank=2 */
+/* if chunk is not NULL, the data is chunked (see chunkedDataPlist()), otherwise it is contiguous */
 int createNewData(
 const char *fileName,						/* name of file to use */
 const char *dataName,						/* FULL name of data set, e.g. "entry1/data/data" */
 int		rank,								/* rank of new data */
 int		*dims,								/* inidvidual dimensions (dims must be of length rank) */
-int		dataType)							/* HDF5 data type, e.g. H5T_NATIVE_INT32,  	dataType = getHDFtype(itype); */
+hid_t	dataType,							/* HDF5 data type, e.g. H5T_NATIVE_INT32,  	dataType = getHDFtype(itype); */
+int		*chunk,								/* dimensions of one chunk (length rank), or NULL for contiguous data */
+int		deflate)							/* deflate level for chunked data, 0 is no compression */
 {
 	hid_t	file_id, dataset_id, dataspace_id;  /* identifiers */
 	hid_t	attribute_id;
 	hid_t	attr_dataspace_id;
+	hid_t	plist=H5P_DEFAULT;
 	herr_t	status;
 	hsize_t	dimsHDF5[rank];
+	hsize_t	chunkHDF5[rank];
 	int		signal=1;
 	int		i;
 	for (i=0;i<rank;i++) dimsHDF5[i] = dims[i];
+	if (chunk) {
+		for (i=0;i<rank;i++) chunkHDF5[i] = MAX(MIN(chunk[i],dims[i]),1);
+		if ((plist=chunkedDataPlist(rank,chunkHDF5,deflate))<=0) return -1;
+	}
 
+	HDF5cacheForget(fileName);
 	file_id = H5Fopen(fileName,H5F_ACC_RDWR,H5P_DEFAULT);	/* Open an existing file */
 	dataspace_id = H5Screate_simple(rank,dimsHDF5,NULL);	/* create the data space */
 
 	/* Create the dataset. */
-	dataset_id = H5Dcreate(file_id,dataName,dataType,dataspace_id,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+	dataset_id = H5Dcreate(file_id,dataName,dataType,dataspace_id,H5P_DEFAULT,plist,H5P_DEFAULT);
+	if (plist!=H5P_DEFAULT) H5Pclose(plist);
 
 	attr_dataspace_id = H5Screate(H5S_SCALAR);
 	attribute_id = H5Acreate(dataset_id,"signal",H5T_STD_I32LE,attr_dataspace_id,H5P_DEFAULT,H5P_DEFAULT);	/* Create a dataset attribute. */
@@ -422,6 +822,137 @@ int		dataType)							/* HDF5 data type, e.g. H5T_NATIVE_INT32,  	dataType = getH
 }
 
 
+/* Create a 3D data set [Nslices][xdim][ydim] in an open file, e.g. a stack of images, one for each depth. */
+/* Each chunk is chunk_rows x ydim of one slice, see chunkedDataPlist(), slices (or parts) never written read as zero. */
+/* In a file opened with the MPI-IO driver every rank must call this with the same arguments, then the chunks are all */
+/* allocated (and zeroed) now, since a collective write cannot allocate them, and deflate must be 0 unless HDF5_PARALLEL_DEFLATE */
+/* returns the id of the open data set, the caller must H5Dclose() it, returns <=0 on error */
+hid_t createNewStack(
+hid_t	file_id,							/* an open file */
+const char *dataName,						/* FULL name of data set, e.g. "entry1/data/data" */
+size_t	Nslices,							/* number of images in the stack */
+size_t	xdim,								/* dimensions of one image */
+size_t	ydim,
+hid_t	dataType,							/* HDF5 data type, e.g. H5T_NATIVE_INT32,  	dataType = getHDFtype(itype); */
+size_t	chunk_rows,							/* rows (along x) in one chunk, 0 is all of them */
+int		deflate)							/* deflate level, 0 is no compression */
+{
+	hid_t	data_id=0, dataspace_id=0, plist=0, fapl=0;
+	hid_t	attribute_id=0, attr_dataspace_id=0;
+	hsize_t	dims[3], chunk[3];
+	int		signal=1;
+	herr_t	err=0;
+
+	chunk_rows = (chunk_rows<1 || chunk_rows>xdim) ? xdim : chunk_rows;
+	dims[0] = Nslices;	dims[1] = xdim;			dims[2] = ydim;
+	chunk[0] = 1;		chunk[1] = chunk_rows;	chunk[2] = ydim;	/* a chunk never spans two slices */
+	if ((dataspace_id=H5Screate_simple(3,dims,NULL))<=0) ERROR_PATH(dataspace_id)
+	if ((plist=chunkedDataPlist(3,chunk,deflate))<=0) ERROR_PATH(plist)
+#ifdef H5_HAVE_PARALLEL
+	if ((fapl=H5Fget_access_plist(file_id))>0 && H5Pget_driver(fapl)==H5FD_MPIO) {
+		if ((err=H5Pset_alloc_time(plist,H5D_ALLOC_TIME_EARLY))<0) ERROR_PATH(err)
+	}
+#endif
+	if ((data_id=H5Dcreate(file_id,dataName,dataType,dataspace_id,H5P_DEFAULT,plist,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- createNewStack(), cannot create '%s'\n",dataName); ERROR_PATH(data_id) }
+
+	attr_dataspace_id = H5Screate(H5S_SCALAR);
+	attribute_id = H5Acreate(data_id,"signal",H5T_STD_I32LE,attr_dataspace_id,H5P_DEFAULT,H5P_DEFAULT);	/* same attribute as createNewData() */
+	H5Awrite(attribute_id,H5T_STD_I32LE,&signal);
+
+	error_path:
+	if (attribute_id>0) H5Aclose(attribute_id);
+	if (attr_dataspace_id>0) H5Sclose(attr_dataspace_id);
+	if (fapl>0) H5Pclose(fapl);
+	if (plist>0) H5Pclose(plist);
+	if (dataspace_id>0) H5Sclose(dataspace_id);
+	return (err<0 ? err : data_id);
+}
+
+
+/* write the ROI [xlo,ylo] to [xhi,yhi] of one slice of a 3D data set made by createNewStack(), the data set is already open */
+/* the image is in vbuf, it is ordered with y moving fastest (same as HDF5WriteROI() with RECONSTRUCT_BACKWARDS) */
+int HDF5WriteSlice(
+hid_t	data_id,						/* an open 3D data set */
+size_t	slice,							/* index of the slice to write into */
+void	*vbuf,							/* pointer to existing data, contains what I will write */
+size_t	xlo,							/* writes region [xlo,ylo] to [xhi,yhi] */
+size_t	xhi,
+size_t	ylo,
+size_t	yhi,
+hid_t	memType)						/* hdf5 data type of the numbers in vbuf, it is converted to the type in the file */
+{
+	herr_t	i, err=0;
+	hid_t	dataspace=0;
+	hid_t	memspace=0;
+	hsize_t	dimsm[2];					/* memory space dimensions */
+	hsize_t	offset[3], count[3];		/* hyperslab in the file */
+
+	if (!vbuf || xlo>xhi || ylo>yhi) return -1;
+	dimsm[0] = xhi - xlo + 1;		dimsm[1] = yhi - ylo + 1;
+	offset[0] = slice;	offset[1] = xlo;		offset[2] = ylo;
+	count[0] = 1;		count[1] = dimsm[0];	count[2] = dimsm[1];
+
+	if ((memspace=H5Screate_simple(2,dimsm,NULL))<0) ERROR_PATH(memspace)
+	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)
+	if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL))<0)	{ fprintf(stderr,"error in H5Sselect_hyperslab(dataspace)=%d\n",i); ERROR_PATH(i) }
+	if ((i=H5Dwrite(data_id,memType,memspace,dataspace,H5P_DEFAULT,vbuf))<0)			{ fprintf(stderr,"error in H5Dwrite(slice %lu)=%d\n",slice,i); ERROR_PATH(i) }
+
+	error_path:
+	if (memspace>0) H5Sclose(memspace);
+	if (dataspace>0) H5Sclose(dataspace);
+	return err;
+}
+
+
+#ifdef H5_HAVE_PARALLEL
+/* collective version of HDF5WriteSlice(), for a data set in a file opened with the MPI-IO driver (needed for chunked & compressed data) */
+/* every rank must call this for each slice, a rank with nothing to write passes vbuf=NULL and selects nothing */
+int HDF5WriteSliceCollective(
+hid_t	data_id,						/* an open 3D data set */
+size_t	slice,							/* index of the slice to write into */
+void	*vbuf,							/* pointer to existing data, contains what I will write, NULL to write nothing */
+size_t	xlo,							/* writes region [xlo,ylo] to [xhi,yhi] */
+size_t	xhi,
+size_t	ylo,
+size_t	yhi,
+hid_t	memType)						/* hdf5 data type of the numbers in vbuf, it is converted to the type in the file */
+{
+	herr_t	i, err=0;
+	hid_t	dataspace=0;
+	hid_t	memspace=0;
+	hid_t	xfer=0;						/* transfer property list, set to collective */
+	hsize_t	dimsm[2]={1,1};				/* memory space dimensions */
+	hsize_t	offset[3], count[3];		/* hyperslab in the file */
+	double	nothing=0;					/* a valid buffer for an empty selection */
+
+	if (vbuf && (xlo>xhi || ylo>yhi)) return -1;
+	if ((xfer=H5Pcreate(H5P_DATASET_XFER))<0) ERROR_PATH(xfer)
+	if ((i=H5Pset_dxpl_mpio(xfer,H5FD_MPIO_COLLECTIVE))<0) ERROR_PATH(i)
+	if ((dataspace=H5Dget_space(data_id))<=0) ERROR_PATH(-1)
+	if (vbuf) {
+		dimsm[0] = xhi - xlo + 1;		dimsm[1] = yhi - ylo + 1;
+		offset[0] = slice;	offset[1] = xlo;		offset[2] = ylo;
+		count[0] = 1;		count[1] = dimsm[0];	count[2] = dimsm[1];
+		if ((memspace=H5Screate_simple(2,dimsm,NULL))<0) ERROR_PATH(memspace)
+		if ((i=H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL))<0)	{ fprintf(stderr,"error in H5Sselect_hyperslab(dataspace)=%d\n",i); ERROR_PATH(i) }
+	}
+	else {
+		if ((memspace=H5Screate_simple(2,dimsm,NULL))<0) ERROR_PATH(memspace)
+		H5Sselect_none(memspace);
+		H5Sselect_none(dataspace);
+		vbuf = &nothing;
+	}
+	if ((i=H5Dwrite(data_id,memType,memspace,dataspace,xfer,vbuf))<0)					{ fprintf(stderr,"error in collective H5Dwrite(slice %lu)=%d\n",slice,i); ERROR_PATH(i) }
+
+	error_path:
+	if (memspace>0) H5Sclose(memspace);
+	if (dataspace>0) H5Sclose(dataspace);
+	if (xfer>0) H5Pclose(xfer);
+	return err;
+}
+#endif
+
+
 herr_t writeDepthInFile(
 const char *fileName,
 double	depth)
@@ -435,6 +966,7 @@ double	depth)
 	herr_t	tempErr, err=0;
 
 	dataBuf[0] = depth;
+	HDF5cacheForget(fileName);
 	if ((file_id=H5Fopen(fileName, H5F_ACC_RDWR, H5P_DEFAULT))<=0) { fprintf(stderr,"after file open, file_id = %d\n",file_id); ERROR_PATH(file_id) }
 	if ((grp=H5Gopen(file_id, "entry1",H5P_DEFAULT))<=0) ERROR_PATH(grp)
 
@@ -486,6 +1018,152 @@ char	*dataName)
 }
 
 
+struct copyMetadataOptions {				/* what copyHDF5metadata() leaves behind */
+	const char **skip;						/* NULL terminated list of FULL data set names, e.g. "entry1/data/data" */
+	hsize_t	Nframes;						/* if >1, also skip 1D data sets of this length (one value per input frame) */
+};
+
+/* H5Aiterate2() callback, copy one attribute from the object loc to the object *(hid_t*)op_data */
+static herr_t copyOneAttribute(
+hid_t	loc,
+const char *name,
+const H5A_info_t *info,
+void	*op_data)
+{
+	hid_t	dest = *(hid_t*)op_data;
+	hid_t	attr=0, attrOut=0, type=0, space=0;
+	void	*buf=NULL;
+	size_t	len;
+	herr_t	err=0;
+
+	if ((attr=H5Aopen(loc,name,H5P_DEFAULT))<=0) ERROR_PATH(attr)
+	if ((type=H5Aget_type(attr))<=0) ERROR_PATH(type)
+	if ((space=H5Aget_space(attr))<=0) ERROR_PATH(space)
+	len = H5Tget_size(type) * (size_t)MAX(H5Sget_simple_extent_npoints(space),1);
+	if (!(buf=calloc(len,1))) { err = -1; goto error_path; }
+	if ((err=H5Aread(attr,type,buf))<0) ERROR_PATH(err)
+	if ((attrOut=H5Acreate(dest,name,type,space,H5P_DEFAULT,H5P_DEFAULT))<=0) ERROR_PATH(attrOut)
+	err = H5Awrite(attrOut,type,buf);
+	if (H5Tdetect_class(type,H5T_VLEN)>0 || H5Tis_variable_str(type)>0) H5Dvlen_reclaim(type,space,H5P_DEFAULT,buf);
+
+	error_path:
+	if (err<0) fprintf(stderr,"ERROR -- copyOneAttribute(), cannot copy attribute '%s'\n",name);
+	free(buf);
+	if (attrOut>0) H5Aclose(attrOut);
+	if (space>0) H5Sclose(space);
+	if (type>0) H5Tclose(type);
+	if (attr>0) H5Aclose(attr);
+	return (err<0 ? err : 0);
+}
+
+/* is the data set data_id (whose FULL name is path) one that copyHDF5metadata() should leave out */
+static int skipThisData(
+hid_t	data_id,
+const char *path,
+struct copyMetadataOptions *opt)
+{
+	hid_t	space;
+	hsize_t	dims[1];
+	int		i, skip=0;
+
+	for (i=0; opt->skip && opt->skip[i]; i++) {
+		if (!strcmp(path,opt->skip[i])) return 1;
+	}
+	if (opt->Nframes>1 && (space=H5Dget_space(data_id))>0) {
+		skip = (H5Sget_simple_extent_ndims(space)==1 && H5Sget_simple_extent_dims(space,dims,NULL)==1 && dims[0]==opt->Nframes);
+		H5Sclose(space);
+	}
+	return skip;
+}
+
+/* copy the contents of group src into group dest, recursing into sub-groups, path is the FULL name of src ("" for root) */
+static herr_t copyGroupMetadata(
+hid_t	src,
+hid_t	dest,
+const char *path,
+struct copyMetadataOptions *opt)
+{
+	H5G_info_t	ginfo;
+	H5L_info_t	linfo;
+	H5I_type_t	otype;
+	hid_t	obj=0, grpOut=0;
+	char	name[FILENAME_MAX], full[FILENAME_MAX], *val=NULL;
+	hsize_t	i;
+	herr_t	err=0;
+
+	if ((err=H5Aiterate2(src,H5_INDEX_NAME,H5_ITER_NATIVE,NULL,copyOneAttribute,&dest))<0) ERROR_PATH(err)
+	if ((err=H5Gget_info(src,&ginfo))<0) ERROR_PATH(err)
+	for (i=0;i<ginfo.nlinks;i++) {
+		if (H5Lget_name_by_idx(src,".",H5_INDEX_NAME,H5_ITER_NATIVE,i,name,FILENAME_MAX,H5P_DEFAULT)<0) { err = -1; goto error_path; }
+		snprintf(full,FILENAME_MAX,"%s%s%s",path,(path[0] ? "/" : ""),name);
+		if ((err=H5Lget_info(src,name,&linfo,H5P_DEFAULT))<0) ERROR_PATH(err)
+		if (linfo.type==H5L_TYPE_SOFT) {					/* re-make soft links, they point into the new file */
+			if (!(val=(char*)calloc(linfo.u.val_size+1,1))) { err = -1; goto error_path; }
+			if ((err=H5Lget_val(src,name,val,linfo.u.val_size,H5P_DEFAULT))>=0) err = H5Lcreate_soft(val,dest,name,H5P_DEFAULT,H5P_DEFAULT);
+			free(val);
+			val = NULL;
+			if (err<0) ERROR_PATH(err)
+			continue;
+		}
+		else if (linfo.type!=H5L_TYPE_HARD) continue;		/* external links are not copied */
+
+		if ((obj=H5Oopen(src,name,H5P_DEFAULT))<=0) ERROR_PATH(obj)
+		otype = H5Iget_type(obj);
+		if (otype==H5I_GROUP) {
+			if ((grpOut=H5Gcreate(dest,name,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT))<=0) ERROR_PATH(grpOut)
+			if ((err=copyGroupMetadata(obj,grpOut,full,opt))<0) ERROR_PATH(err)
+			H5Gclose(grpOut);
+			grpOut = 0;
+		}
+		else if (otype!=H5I_DATASET || !skipThisData(obj,full,opt)) {
+			if ((err=H5Ocopy(src,name,dest,name,H5P_DEFAULT,H5P_DEFAULT))<0) ERROR_PATH(err)
+		}
+		H5Oclose(obj);
+		obj = 0;
+	}
+
+	error_path:
+	if (err<0) fprintf(stderr,"ERROR -- copyGroupMetadata(), failed copying '%s'\n",path[0] ? path : "/");
+	if (grpOut>0) H5Gclose(grpOut);
+	if (obj>0) H5Oclose(obj);
+	return (err<0 ? err : 0);
+}
+
+
+/* Make a new file dest that holds everything in source except the listed data sets (and the per-frame vectors). */
+/* Unlike copying the file and deleting the image data, the new file never contains the (possibly huge) input images, */
+/* so it does not need a repack to get small.  Groups, attributes, header data sets and soft links are all copied. */
+/* returns 0 on success */
+int copyHDF5metadata(
+const char *source,						/* path to source file */
+const char *dest,						/* path to destination file, it is overwritten */
+const char **skip,						/* NULL terminated list of FULL data set names to leave out, e.g. "entry1/data/data", may be NULL */
+size_t	Nframes)						/* number of frames in source, if >1 1D data sets of this length are left out too */
+{
+	struct copyMetadataOptions opt;
+	hid_t	fin=0, fout=0, rootIn=0, rootOut=0;
+	herr_t	tempErr, err=0;
+
+	opt.skip = skip;
+	opt.Nframes = Nframes;
+	HDF5cacheForget(dest);
+	if ((fin=H5Fopen(source,H5F_ACC_RDONLY,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- copyHDF5metadata(), cannot open '%s'\n",source); ERROR_PATH(fin) }
+	if ((fout=H5Fcreate(dest,H5F_ACC_TRUNC,H5P_DEFAULT,H5P_DEFAULT))<=0) { fprintf(stderr,"ERROR -- copyHDF5metadata(), cannot create '%s'\n",dest); ERROR_PATH(fout) }
+	if ((rootIn=H5Gopen(fin,"/",H5P_DEFAULT))<=0) ERROR_PATH(rootIn)
+	if ((rootOut=H5Gopen(fout,"/",H5P_DEFAULT))<=0) ERROR_PATH(rootOut)
+	err = copyGroupMetadata(rootIn,rootOut,"",&opt);
+
+	error_path:
+	if (rootOut>0) H5Gclose(rootOut);
+	if (rootIn>0) H5Gclose(rootIn);
+	if (fout>0) {
+		if (tempErr=H5Fclose(fout)) { fprintf(stderr,"ERROR -- copyHDF5metadata(), file close error = %d\n",tempErr); err = err ? err : tempErr; }
+	}
+	if (fin>0) H5Fclose(fin);
+	return (err<0 ? err : 0);
+}
+
+
 
 int readHDF5header(
 const char *fileName,		/* full path name of file to use */
@@ -506,6 +1184,7 @@ struct HDF5_Header *head)	/* HDF5 header information (header must be valid!) */
 	int		ivalue;
 	int		oldStyleExposure;				/* old way of doing exposure time */
 	int		wireFolder;						/* flag, TRUE means 'entry1/wire' exists */
+	struct HDF5_cacheEntry *c=NULL;			/* cached open file, NULL if not cached */
 
 	if (!head) { fprintf(stderr,"readHDF5header called with header=NULL\n"); return 1; }
 
@@ -516,6 +1195,7 @@ struct HDF5_Header *head)	/* HDF5 header information (header must be valid!) */
 	head->startx = head->endx = 0;
 	head->starty = head->endy = 0;
 	head->groupx = head->groupy = 1;
+	head->Nimages = 1;
 	head->xSample = head->ySample = head->zSample = NAN;
 	head->xWire = head->yWire = head->zWire = NAN;
 	head->AerotechH = NAN;
@@ -535,7 +1215,11 @@ struct HDF5_Header *head)	/* HDF5 header information (header must be valid!) */
 		head->VO2_epoch = head->VO2_current = head->VO2_Temperature = head->VO2_Volt = head->VO2_Resistance = NAN;
 	#endif
 
-	if ((file_id=H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT))<=0) ERROR_PATH(file_id)
+	if ((c=HDF5cacheOpen(fileName))) {
+		if (c->head) { *head = *(c->head); return 0; }	/* already read this header */
+		file_id = c->file_id;
+	}
+	else if ((file_id=H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT))<=0) ERROR_PATH(file_id)
 
 	wireFolder = groupExists(file_id,"entry1/wire");
 	if (!get1HDF5attr_string(file_id,".","file_name",str)) strncpy(head->fileName,str,MAX_micro_STRING_LEN);
@@ -646,11 +1330,17 @@ struct HDF5_Header *head)	/* HDF5 header information (header must be valid!) */
 	else if (H5class == H5T_FLOAT && sz==8) itype = 5;		/* float (8 byte) */
 	else itype = -1;										/* what is this */
 
-	if ((rank=H5Sget_simple_extent_dims(dataspace,dims_out,NULL))!=2) ERROR_PATH(rank)		/* only understand rank 2 data */
+	rank = H5Sget_simple_extent_dims(dataspace,dims_out,NULL);
+	if (!(rank==2 || rank==3)) ERROR_PATH(rank)			/* only understand one image, or a stack of images [frame][x][y] */
 	#ifdef VERBOSE
 	printf("		data type = %d,  size of one element = %ld bytes\n",dataType,sz);
-	printf("		rank %d, dimensions %llu x %llu \n", rank, dims_out[0],dims_out[1]);
+	printf("		rank %d, dimensions %llu x %llu x %llu\n", rank, dims_out[0],dims_out[1],dims_out[2]);
 	#endif
+	if (rank==3) {											/* a stack of images, the image dimensions follow the frame number */
+		head->Nimages = (size_t)dims_out[0];
+		dims_out[0] = dims_out[1];
+		dims_out[1] = dims_out[2];
+	}
 
 	head->itype	= itype;									/* Old WinView types */
 	head->isize	= (int)sz;									/* length of one element (one pixel in bytes) */
@@ -678,9 +1368,10 @@ struct HDF5_Header *head)	/* HDF5 header information (header must be valid!) */
 	if (data_id>0) {
 		if (tempErr=H5Dclose(data_id)) { fprintf(stderr,"ERROR -- readHDF5header(), data close error = %d\n",tempErr); err = err ? err : tempErr; }
 	}
-	if (file_id>0) {
+	if (file_id>0 && !c) {
 		if (tempErr = H5Fclose(file_id)) { fprintf(stderr,"ERROR -- readHDF5header(), file close error = %d\n",err); err = err ? err : tempErr; }
 	}
+	if (c && !err && (c->head = (struct HDF5_Header *)malloc(sizeof(struct HDF5_Header)))) *(c->head) = *head;	/* save for next time */
 	return err;
 }
 
@@ -696,7 +1387,9 @@ struct HDF5_Header *h)		/* HDF5 header information (header must be valid!) */
 	printf("	itype = %d,  %s\n",h->itype,getFileTypeString(h->itype,str));
 	printf("	length of one pixel %d bytes\n",h->isize);								/* number of bytes in each pixel */
 	printf("	full un-binned detector is %lu x %lu pixels\n",h->xDimDet,h->yDimDet);	/* x-y dimension of detector (pixels) */
-	printf("	image in file is %ld x %ld binned pixels\n",h->xdim,h->ydim);			/* x,y dimensions of image (after any internal binning) */
+	printf("	image in file is %ld x %ld binned pixels",h->xdim,h->ydim);			/* x,y dimensions of image (after any internal binning) */
+	if (h->Nimages > 1) printf(",	file contains %lu images",h->Nimages);		/* number of images in file */
+	printf("\n");
 	printf("	binned region X=[%ld, %ld], group=%ld\n",h->startx,h->endx,h->groupx);	/* ROI (unbinned pixels) */
 	printf("	binned region Y=[%ld, %ld], group=%ld\n",h->starty,h->endy,h->groupy);
 	if (!isnan(h->exposure)) printf("	exposure time = %g sec",h->exposure);		/* exposure time (seconds) */
@@ -772,9 +1465,11 @@ const char *dataName)				/* full data name, e.g. "entry1/wireX" */
 	size_t	size;
 	int		un_signed=0;
 	hid_t	scalarSpace=0;			/* set scalarSpace to H5S_ALL to read the whole vector or array, here we only want just the first value */
+	struct HDF5_cacheEntry *c=NULL;	/* cached open file, NULL if not cached */
 
 	if (strlen(fileName)<1 || strlen(dataName)<1) ERROR_PATH(-1);
-	if ((file_id=H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT))<=0) ERROR_PATH(file_id)
+	if ((c=HDF5cacheOpen(fileName))) file_id = c->file_id;
+	else if ((file_id=H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT))<=0) ERROR_PATH(file_id)
 	if ((data_id=H5Dopen(file_id,dataName,H5P_DEFAULT))<0) ERROR_PATH(data_id)	/* probably not there, failure, but not a real error */
 	if ((dataType=H5Dget_type(data_id))<0) { fprintf(stderr,"ERROR -- readHDF5oneValue cannot get dataType\n"); ERROR_PATH(dataType) }
 
@@ -843,7 +1538,7 @@ const char *dataName)				/* full data name, e.g. "entry1/wireX" */
 	if (data_id>0) {
 		if (tempErr=H5Dclose(data_id)) { fprintf(stderr,"ERROR -- readHDF5oneValue(), data close error = %d\n",err); err = err ? err : tempErr; }
 	}
-	if (file_id>0) {
+	if (file_id>0 && !c) {
 		if (tempErr = H5Fclose(file_id)) { fprintf(stderr,"ERROR -- readHDF5oneValue(), file close error = %d\n",err); err = err ? err : tempErr; }
 	}
 	return value;
@@ -922,6 +1617,7 @@ struct HDF5_Header *in)							/* input structure */
 	dest->starty	= in->starty;
 	dest->endy		= in->endy;
 	dest->groupy	= in->groupy;
+	dest->Nimages	= in->Nimages;
 	dest->gain		= in->gain;
 	dest->sampleDistance = in->sampleDistance;
 	#ifdef VO2
@@ -982,7 +1678,7 @@ struct HDF5_Header *h)				/* destination header structure */
 	h->endx = h->endy = 0;			/* highest x pixel value (unbinned pixels) */
 	h->groupx = h->groupy = 1;		/* amount x is binned/grouped in hardware */
 /*	h->geo_rotate = h->geo_reverse = h->geo_flip = 0;		// geometric effect applied */
-/*	h->Nimages = 1;					// number of images stored together */
+	h->Nimages = 1;					/* number of images stored together */
 	h->gain = NAN;					/* actually capacitance (pF) */
 
 	h->exposure = NAN;				/* exposure time (seconds) */
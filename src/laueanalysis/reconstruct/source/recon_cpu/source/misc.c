@@ -13,6 +13,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #ifdef __linux__
 #include <wait.h>
 #endif
@@ -82,7 +87,12 @@ char distortionFilePath[FILENAME_MAX])
 	if (!strFromTagBuf(buf,"ws_percentOfPixels",line,250))	percent = (float)atof(line);						/* % of pixels used */
 	if (!strFromTagBuf(buf,"ws_wireEdge",line,250))			*wireEdge = atoi(line);								/* edge of wire used (1=leading, 0=trailing, -1=both) */
 	if (!strFromTagBuf(buf,"ws_outputPixelType",line,250))	*out_pixel_type = atoi(line);						/* nunmber type of output pixels */
-	if (!strFromTagBuf(buf,"ws_MiB_RAM",line,250))			AVAILABLE_RAM_MiB = atoi(line);						/* MiB of RAM used */
+	if (!strFromTagBuf(buf,"ws_MiB_RAM",line,250))			AVAILABLE_RAM_MiB = MAX(atoi(line),0);				/* MiB of RAM used, 0 is automatic */
+	if (!strFromTagBuf(buf,"ws_threads",line,250))			NUM_THREADS = threadCount(atoi(line));			/* number of threads used for depth resolving, <=0 is all but one */
+	if (!strFromTagBuf(buf,"ws_pipeline",line,250))			PIPELINE_IO = atoi(line) ? 1 : 0;				/* read & write stripes while depth resolving */
+	if (!strFromTagBuf(buf,"ws_singleFile",line,250))		SINGLE_OUTPUT_FILE = atoi(line) ? 1 : 0;		/* all depths in one output file */
+	if (!strFromTagBuf(buf,"ws_compress",line,250))		COMPRESS_LEVEL = MIN(MAX(atoi(line),0),9);		/* deflate level of the output images, 0 is no compression */
+	if (!strFromTagBuf(buf,"ws_edgeCache",line,250))		strncpy(edgeCachePath,line,250);					/* file to cache the pixel edges, not required */
 	if (!strFromTagBuf(buf,"ws_verbose",line,250))			verbose = atoi(line);								/* verbose flag */
 	if (n != (1<<6)-1) {
 		error("-F when reading file, some of the required program parameters were missing\n   must have {ws_infile, ws_outfile, ws_depthStart, ws_depthEnd, ws_depthResolution, ws_detectorNumber}\n");
@@ -277,7 +287,7 @@ int wireEdge,						/* 1=leading edge of wire, 0=trailing edge of wire, -1=both e
 char *normalization,				/* optional tag for normalization */
 char *depthCorrectStr)					/* optional name of file with depth corrections for each pixel */
 {
-	/* globals printed here:	percent, AVAILABLE_RAM_MiB, verbose, distortionPath */
+	/* globals printed here:	percent, AVAILABLE_RAM_MiB, NUM_THREADS, PIPELINE_IO, SINGLE_OUTPUT_FILE, verbose, distortionPath */
 	if (!f) return;
 
 	fprintf(f,"$filetype	geometryFileN;depthSortedInfo\n");
@@ -288,6 +298,7 @@ char *depthCorrectStr)					/* optional name of file with depth corrections for e
 	fprintf(f,"$ws_outfile				%s\n",outfile);
 	fprintf(f,"$ws_geofile				%s\n",geofile);
 	fprintf(f,"$ws_fileExtension		%s\n","h5");
+	if (SINGLE_OUTPUT_FILE) fprintf(f,"$ws_singleFile			%d				// all depths are in the one file %s.h5\n",SINGLE_OUTPUT_FILE,outfile);
 	if (strlen(distortionPath)) fprintf(f,"$ws_distortionMap		%s\n",distortionPath);
 	fprintf(f,"$ws_detectorNumber		%d				// detector number used for this reconstruction\n",detNum);
 	fprintf(f,"$ws_depthStart			%g				// first depth relative to Si (micron)\n",depth_start);
@@ -299,8 +310,13 @@ char *depthCorrectStr)					/* optional name of file with depth corrections for e
 	fprintf(f,"$ws_wireEdge			%d				// edge of wire to use, 1=leading, 0=trailing, -1=both\n",wireEdge);
 	if (out_pixel_type>=0) fprintf(f,"$ws_outputPixelType		%d				// nunmber type of output pixels (1=long)\n",out_pixel_type);
 	if (strlen(depthCorrectStr)) fprintf(f,"$ws_depthCorrectMap		%s\n",depthCorrectStr);
+	if (edgeCachePath[0]) fprintf(f,"$ws_edgeCache			%s				// file used to cache the pixel edges\n",edgeCachePath);
 	fprintf(f,"$ws_percentOfPixels		%g				// %% of pixels used\n",percent);
-	fprintf(f,"$ws_MiB_RAM				%d				// MiB of RAM used\n",AVAILABLE_RAM_MiB);
+	fprintf(f,"$ws_MiB_RAM				%d				// MiB of RAM used, 0 is automatic\n",AVAILABLE_RAM_MiB);
+	fprintf(f,"$ws_threads				%d				// number of threads used for depth resolving\n",NUM_THREADS);
+	fprintf(f,"$ws_stripeBytes			%d				// bytes used for each value in the stripes, 4 is float32, 8 is double\n",(int)sizeof(stripe_real));
+	fprintf(f,"$ws_pipeline			%d				// true if stripes were read & written while depth resolving\n",PIPELINE_IO);
+	fprintf(f,"$ws_compress			%d				// deflate level of the output images, 0 is no compression\n",COMPRESS_LEVEL);
 	fprintf(f,"$ws_verbose				%d				// verbose flag\n",verbose);
 }
 
@@ -343,6 +359,9 @@ double	seconds)					/* execution time (seconds) */
 	}
 	if (keV==keV) fprintf(f,"$keV					%g			// energy of monochromator (keV)\n",keV);
 	fprintf(f,"$rows_at_one_time		%lu			// rows to process at one time (out of %lu)\n", imaging_parameters.rows_at_one_time,in_header.ydim);
+	fprintf(f,"$ws_memoryBudget		%lu			// MiB of RAM the stripes were sized for\n", imaging_parameters.memory_budget>>20);
+	fprintf(f,"$ws_stripes				%d				// number of stripes processed\n", imaging_parameters.Nstripes);
+	fprintf(f,"$ws_stripeMemory		%lu			// bytes allocated for the stripes\n", imaging_parameters.stripe_bytes);
 
 	if (seconds > 2.) fprintf(f,"$executionTime			%.1f			// execution time (sec)\n",seconds);
 	else fprintf(f,"$executionTime			%.3f			// execution time (sec)\n",seconds);
@@ -366,6 +385,105 @@ double	seconds)					/* execution time (seconds) */
 
 
 
+/* seconds from a monotonic clock, only differences are meaningful, unlike clock() this counts all of the wall time of all threads once */
+double monotonicSeconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+}
+
+
+/* user and system CPU seconds used so far by this process (all threads), only differences are meaningful for one scan of a batch */
+void cpuSeconds(
+double	cpu[2])						/* returns {user, system} */
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	cpu[0] = usage.ru_utime.tv_sec + 1e-6*usage.ru_utime.tv_usec;
+	cpu[1] = usage.ru_stime.tv_sec + 1e-6*usage.ru_stime.tv_usec;
+}
+
+
+/* write a string as a JSON string, with the quotes */
+static void fprintJSONstring(FILE *f, const char *str)
+{
+	fputc('"',f);
+	for (; str && *str; str++) {
+		if (*str=='"' || *str=='\\') fprintf(f,"\\%c",*str);
+		else if ((unsigned char)*str < 0x20) fprintf(f,"\\u%04x",(unsigned char)*str);
+		else fputc(*str,f);
+	}
+	fputc('"',f);
+}
+
+
+/* write the run_metrics of the last processAll(), and the settings that produced them, as JSON to fileName, returns 0 if OK */
+/*	globals printed here:	run_metrics, imaging_parameters, user_preferences, and the command line settings */
+/*	the CPU times are for this scan only, but the peak resident memory can only be had for the whole process (all scans of a batch so far) */
+int writeMetricsFile(
+char	*fileName,
+char	*infile,
+char	*outfile,
+char	*geofile,
+double	seconds,					/* wall time of the whole reconstruction (seconds) */
+double	cpu0[2])					/* cpuSeconds() at the start of the reconstruction */
+{
+	FILE	*f;
+	struct rusage usage;
+	double	cpu[2];
+	double	read=0, difference=0, resolve=0, write=0;
+	size_t	differences=0, deposits=0;
+	int		k;
+
+	if (!(f=fopen(fileName,"w"))) return 1;
+	for (k=0; k<run_metrics.Nstripes; k++) {
+		read += run_metrics.stripe[k].read;
+		difference += run_metrics.stripe[k].difference;
+		resolve += run_metrics.stripe[k].resolve;
+		write += run_metrics.stripe[k].write;
+		differences += run_metrics.stripe[k].differences;
+		deposits += run_metrics.stripe[k].deposits;
+	}
+	getrusage(RUSAGE_SELF, &usage);
+	cpuSeconds(cpu);
+
+	fprintf(f,"{\n");
+	fprintf(f,"\"infile\": ");	fprintJSONstring(f,infile);		fprintf(f,",\n");
+	fprintf(f,"\"outfile\": ");	fprintJSONstring(f,outfile);	fprintf(f,",\n");
+	fprintf(f,"\"geofile\": ");	fprintJSONstring(f,geofile);	fprintf(f,",\n");
+	fprintf(f,"\"settings\": {\"depth_start\": %g, \"depth_end\": %g, \"resolution\": %g, \"wire_edge\": %d, \"percent\": %g, \"cutoff\": %d,\n",
+		user_preferences.depth_start, user_preferences.depth_end, user_preferences.depth_resolution, user_preferences.wireEdge, percent, cutoff);
+	fprintf(f,"\t\"mpi_rank\": %d, \"mpi_ranks\": %d,\n", RANK, NRANKS);
+	fprintf(f,"\t\"memory_MiB\": %d, \"memory_budget_MiB\": %lu, \"threads\": %d, \"pipeline\": %d, \"single_file\": %d, \"compress\": %d, \"multi_frame_file\": %d, \"stripe_real_bytes\": %d, \"kernel\": ",
+		AVAILABLE_RAM_MiB, imaging_parameters.memory_budget>>20, NUM_THREADS, PIPELINE_IO, SINGLE_OUTPUT_FILE, COMPRESS_LEVEL, MULTI_FRAME_FILE, (int)sizeof(stripe_real));
+	fprintJSONstring(f,run_metrics.kernel ? run_metrics.kernel : "");
+	fprintf(f,"},\n");
+	fprintf(f,"\"image\": {\"rows\": %d, \"cols\": %d, \"input_images\": %d, \"input_pixel_bytes\": %d, \"output_depths\": %d},\n",
+		imaging_parameters.nROI_i, imaging_parameters.nROI_j, imaging_parameters.NinputImages, imaging_parameters.in_pixel_bytes, user_preferences.NoutputDepths);
+	fprintf(f,"\"layout\": {\"rows_at_one_time\": %lu, \"chunk_rows\": %lu, \"stripe_bytes\": %lu, \"stripes\": %d, \"stripes_resumed\": %d},\n",
+		imaging_parameters.rows_at_one_time, imaging_parameters.chunk_rows, imaging_parameters.stripe_bytes, run_metrics.Nstripes, run_metrics.Nresumed);
+	fprintf(f,"\"pixels\": {\"total\": %lu, \"above_cutoff\": %lu, \"skipped_by_cutoff\": %lu, \"active\": %lu},\n",
+		run_metrics.pixels_total, run_metrics.pixels_above_cutoff, run_metrics.pixels_total-run_metrics.pixels_above_cutoff, run_metrics.pixels_active);
+	fprintf(f,"\"seconds\": {\"run\": %.6f, \"process_all\": %.6f, \"image_info\": %.6f, \"intensity_map\": %.6f, \"pixel_edges\": %.6f, \"metadata\": %.6f, \"create_output\": %.6f,\n",
+		seconds, run_metrics.total, run_metrics.image_info, run_metrics.intensity_map, run_metrics.pixel_edges, run_metrics.metadata, run_metrics.create_output);
+	fprintf(f,"\t\"stripes\": %.6f, \"read\": %.6f, \"difference\": %.6f, \"resolve\": %.6f, \"write\": %.6f,\n", run_metrics.stripes, read, difference, resolve, write);
+	fprintf(f,"\t\"user_cpu\": %.6f, \"system_cpu\": %.6f},\n", cpu[0]-cpu0[0], cpu[1]-cpu0[1]);
+	fprintf(f,"\"bytes_read\": %lu, \"bytes_written\": %lu, \"differences\": %lu, \"deposits\": %lu, \"process_max_rss_MiB\": %.1f,\n",
+		run_metrics.bytes_read, run_metrics.bytes_written, differences, deposits, usage.ru_maxrss/1024.);	/* ru_maxrss is in KiB, and the peak since the process started */
+	fprintf(f,"\"stripes\": [");
+	for (k=0; k<run_metrics.Nstripes; k++) {
+		ws_stripe_metrics *m = run_metrics.stripe + k;
+		fprintf(f,"%s\n\t{\"rows\": [%d, %d], \"cols\": [%d, %d], \"read\": %.6f, \"difference\": %.6f, \"resolve\": %.6f, \"write\": %.6f, ",
+			k ? "," : "", m->ilo, m->ihi, m->jlo, m->jhi, m->read, m->difference, m->resolve, m->write);
+		fprintf(f,"\"bytes_read\": %lu, \"bytes_written\": %lu, \"pixels\": %lu, \"differences\": %lu, \"deposits\": %lu}",
+			m->bytes_read, m->bytes_written, m->pixels, m->differences, m->deposits);
+	}
+	fprintf(f,"\n]\n}\n");
+	return fclose(f) ? 1 : 0;
+}
+
+
 int getParentPath(				/* make a duplicate of a file, but re-pack it.  This will reclaim lost space & it always overwites existing file.  Sends a system call */
 char *path)
 {
@@ -407,6 +525,81 @@ char *path)
 }
 
 
+/* number of threads to use for -N or ws_threads, n<=0 means all of the processors but one, which leaves 1 processor free for the OS */
+int threadCount(
+int		n)							/* number of threads asked for */
+{
+#ifdef _OPENMP
+	return n < 1 ? MAX(omp_get_num_procs()-1,1) : n;
+#else
+	return 1;						/* not compiled with OpenMP, always single threaded */
+#endif
+}
+
+
+/* bytes of RAM that can be used without crowding the machine, the smaller of MemAvailable and the */
+/* room left under the cgroup memory limit (v2 or v1), less headroom.  Returns 0 if neither can be read */
+#define MEMORY_HEADROOM_MIN (256<<20)		/* always leave at least 256 MiB for everyone else */
+size_t autoMemoryBudget(void)
+{
+	char	line[FILENAME_MAX], path[FILENAME_MAX+64], group[FILENAME_MAX];
+	char	*p;
+	FILE	*f;
+	long long	kB;
+	long long	avail=-1;					/* usable bytes, -1 is not known yet */
+	long long	limit, used;
+	long long	headroom;
+	int		i;
+
+	if ((f=fopen("/proc/meminfo","r"))) {	/* MemAvailable counts reclaimable cache, it is better than MemFree */
+		while (fgets(line,FILENAME_MAX,f)) {
+			if (sscanf(line,"MemAvailable: %lld kB",&kB)==1) { avail = kB<<10; break; }
+			if (sscanf(line,"MemFree: %lld kB",&kB)==1) avail = kB<<10;
+		}
+		fclose(f);
+	}
+
+	group[0] = '\0';						/* find our cgroup, "0::/path" for v2, "N:...memory...:/path" for v1 */
+	if ((f=fopen("/proc/self/cgroup","r"))) {
+		while (fgets(line,FILENAME_MAX,f)) {
+			line[strcspn(line,"\n")] = '\0';
+			if (!strncmp(line,"0::",3) && !group[0]) { strncpy(group,line+3,FILENAME_MAX-1); group[FILENAME_MAX-1]='\0'; }
+			else if ((p=strchr(line,':')) && strstr(p,"memory") && (p=strchr(p+1,':'))) {
+				strncpy(group,p+1,FILENAME_MAX-1);
+				group[FILENAME_MAX-1] = '\0';
+				break;
+			}
+		}
+		fclose(f);
+	}
+	char *limitFiles[4][2] = {				/* {limit,usage}, our own group first, then the root of the mount inside a container */
+		{"/sys/fs/cgroup%s/memory.max","/sys/fs/cgroup%s/memory.current"},
+		{"/sys/fs/cgroup/memory%s/memory.limit_in_bytes","/sys/fs/cgroup/memory%s/memory.usage_in_bytes"},
+		{"/sys/fs/cgroup/memory.max","/sys/fs/cgroup/memory.current"},
+		{"/sys/fs/cgroup/memory/memory.limit_in_bytes","/sys/fs/cgroup/memory/memory.usage_in_bytes"}};
+	for (i=0;i<4;i++) {
+		snprintf(path,sizeof(path),limitFiles[i][0],group);
+		if (!(f=fopen(path,"r"))) continue;
+		limit = (fscanf(f,"%lld",&limit)==1) ? limit : -1;	/* "max" means no limit */
+		fclose(f);
+		if (limit<0) break;
+		snprintf(path,sizeof(path),limitFiles[i][1],group);
+		used = 0;
+		if ((f=fopen(path,"r"))) {
+			if (fscanf(f,"%lld",&used)!=1) used = 0;
+			fclose(f);
+		}
+		limit = MAX(limit-used,0);
+		avail = (avail<0) ? limit : MIN(avail,limit);	/* an unlimited v1 group gives a huge number, which is ignored here */
+		break;
+	}
+
+	if (avail<=0) return 0;
+	headroom = MAX(avail/10,MEMORY_HEADROOM_MIN);	/* 10% but at least 256 MiB */
+	return (size_t)((avail > 2*headroom) ? avail-headroom : avail/2);
+}
+
+
 void error(char *error) {
 	fprintf(stderr,"\nERROR -- ");
 	if (error) fprintf(stderr,"%s",error);
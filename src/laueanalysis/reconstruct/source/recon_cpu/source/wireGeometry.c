@@ -0,0 +1,169 @@
+/*
+ *  wireGeometry.c
+ *  reconstruct
+ *
+ *  the geometry of the wire scan, where a pixel is in beam line coordinates, where the wire is,
+ *  and the depth along the incident beam of the ray from a pixel that is tangent to the wire.
+ *  Used by the reconstruction and by the wire scan simulator in bench/.
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "mathUtil.h"
+#include "WireScanDataTypesN.h"
+#include "readGeoN.h"
+#include "WireScan.h"
+#include "wireGeometry.h"
+
+#ifdef DEBUG_1_PIXEL
+extern int verbosePixel;
+#endif
+
+
+
+/* Take the indicies to a detector pixel and returns an 3vector point in beam-line coordinates of the pixel centre
+ * Here is the only place where the corrections for a ROI (binning & sub-region of detector) has been used.  Hopefully it is the only place needed.
+ * All pixel values (binned & un-binned) are zero based.
+ * This routine uses the same conventions a used in Igor
+ */
+point_xyz pixel_to_point_xyz(
+	point_ccd pixel)					/* input, binned ROI (zero-based) pixel value on detector, can be non-integer, and can lie outside range (e.g. -05 is acceptable) */
+{
+	point_xyz coordinates;								/* point with coordinates in R3 to return */
+	point_ccd corrected_pixel;							/* pixel data to be filled by the peak_correction method */
+	double	x,y,z;										/* 3d coordinates */
+
+#warning "here is the only place where the pixel is swapped for the transpose in an HDF5 file"
+	corrected_pixel.i = pixel.j;						/* the transpose swap needed with the HDF5 files */
+	corrected_pixel.j = pixel.i;
+
+	/* convert pixel from binned ROI value to full frame un-binned pixels, both binned and un-binned are zero based. */
+	corrected_pixel.i = corrected_pixel.i * imaging_parameters.bini + imaging_parameters.starti;		/* convert from binned ROI to full chip un-binned pixel */
+	corrected_pixel.j = corrected_pixel.j * imaging_parameters.binj + imaging_parameters.startj;
+	corrected_pixel.i += (imaging_parameters.bini-1)/2.;	/* move from leading edge of pixel to the pixel center(e) */
+	corrected_pixel.j += (imaging_parameters.binj-1)/2.;	/*	this is needed because the center of a pixel changes with binning */
+
+#ifdef DEBUG_1_PIXEL
+	if (verbosePixel) printf("\nin pixel_to_point_xyz(), pixel = [%g, %g] (binned ROI, on input),   size is (%g, %g) (micron)",pixel.i,pixel.j,calibration.pixel_size_i,calibration.pixel_size_j);
+	if (verbosePixel) printf("\n   corrected_pixel = [%g, %g] (un-binned full chip pixels)",corrected_pixel.i,corrected_pixel.j);
+#endif
+	corrected_pixel = PEAKCORRECTION(corrected_pixel);		/* do the distortion correction */
+
+#if defined(DEBUG_ALL) && defined(USE_DISTORTION_CORRECTION)
+	if (verbosePixel) printf("\n   distortion corrected_pixel = [%g, %g] (un-binned full chip pixels)",corrected_pixel.i,corrected_pixel.j);
+#endif
+
+	/* get 3D coordinates in detector frame of the pixel */
+	x = (corrected_pixel.i - 0.5*(calibration.ccd_pixels_i - 1)) * calibration.pixel_size_i;	/* (x', y', z') position of pixel (detector frame) */
+	y = (corrected_pixel.j - 0.5*(calibration.ccd_pixels_j - 1)) * calibration.pixel_size_j;	/* note, in detector frame all points on detector have z'=0 */
+	/*if (REVERSE_X_AXIS) x = -x; */
+
+	x += calibration.P.x;									/* translate by P (P is from geoN.detector.P) */
+	y += calibration.P.y;
+	z  = calibration.P.z;
+
+	/* finally, rotate (x,y,z) by rotation vector geo.detector.R using precomputed matrix calibration.detector_rotation[3][3] */
+	coordinates.x = calibration.detector_rotation[0][0] * x + calibration.detector_rotation[0][1] * y + calibration.detector_rotation[0][2] * z;
+	coordinates.y = calibration.detector_rotation[1][0] * x + calibration.detector_rotation[1][1] * y + calibration.detector_rotation[1][2] * z;
+	coordinates.z = calibration.detector_rotation[2][0] * x + calibration.detector_rotation[2][1] * y + calibration.detector_rotation[2][2] * z;
+#ifdef DEBUG_1_PIXEL
+	if (verbosePixel) printf("\n   pixel xyz coordinates = (%g, %g, %g)\n",coordinates.x,coordinates.y,coordinates.z);
+#endif
+	return coordinates;									/* return point_xyz coordinates */
+}
+
+
+
+/* Returns depth (starting point of ray with one end point at point_on_ccd_xyz that is tangent */
+/* to leading (or trailing) edge of the wire and intersects the incident beam.  The returned depth is relative to the Si position (origin) */
+/* depth is measured along the incident beam from the origin, not just the z value. */
+double pixel_xyz_to_depth(
+	point_xyz point_on_ccd_xyz,			/* end point of ray, an xyz location on the detector */
+	point_xyz wire_position,			/* wire center, used to find the tangent point, has been PM500 corrected, origin subtracted, rotated by rho */
+	BOOLEAN use_leading_wire_edge)		/* which edge of wire are using here, TRUE for leading edge */
+{
+	point_xyz	pixelPos;								/* current pixel position */
+
+	/* change coordinate system so that wire axis lies along {1,0,0}, a rotated system */
+	pixelPos = MatrixMultiply31(calibration.wire.rho,point_on_ccd_xyz);	/* pixelPos = rho x point_on_ccd_xyz, rotate pxiel center to new coordinate system */
+	return edge_yz_to_depth(pixelPos.y, pixelPos.z, wire_position, use_leading_wire_edge);
+}
+
+
+/* Same as pixel_xyz_to_depth(), but the point on the detector has already been rotated by calibration.wire.rho, only its y & z are needed. */
+/* This is the part that depends upon the wire position, the pixel edges are all rotated once in make_pixel_edges() */
+double edge_yz_to_depth(
+	double	pixel_y,					/* y & z of end point of ray, an xyz location on the detector rotated by calibration.wire.rho */
+	double	pixel_z,
+	point_xyz wire_position,			/* wire center, used to find the tangent point, has been PM500 corrected, origin subtracted, rotated by rho */
+	BOOLEAN use_leading_wire_edge)		/* which edge of wire are using here, TRUE for leading edge */
+{
+	point_xyz	ki;										/* incident beam direction */
+	point_xyz	S;										/* point where rays intersects incident beam */
+	double		pixel_to_wireCenter_y;					/* vector from pixel to wire center, y,z coordinates */
+	double		pixel_to_wireCenter_z;
+	double		pixel_to_wireCenter_len;				/* length of vector pixel_to_wireCenter (only y & z components) */
+	double		wire_radius;							/* wire radius */
+	double		phi0;									/* angle from yhat to wireCenter (measured at the pixel) */
+	double		dphi;									/* angle between line from detector to centre of wire and to tangent of wire */
+	double		tanphi;									/* phi is angle from yhat to tangent point on wire */
+	double		b_reflected;
+	double		depth;									/* the result */
+
+	ki.x = calibration.wire.ki.x;						/* ki = rho x {0,0,1} */
+	ki.y = calibration.wire.ki.y;
+	ki.z = calibration.wire.ki.z;
+
+	pixel_to_wireCenter_y = wire_position.y - pixel_y;	/* vector from point on detector to wire centre. */
+	pixel_to_wireCenter_z = wire_position.z - pixel_z;
+	pixel_to_wireCenter_len = sqrt(pixel_to_wireCenter_y*pixel_to_wireCenter_y + pixel_to_wireCenter_z*pixel_to_wireCenter_z);/* length of vector pixel_to_wireCenter */
+
+	wire_radius = calibration.wire.diameter / 2;		/* wire radius */
+	phi0 = atan2(pixel_to_wireCenter_z , pixel_to_wireCenter_y);	/* angle from yhat to wireCenter (measured at the pixel) */
+	dphi = asin(wire_radius / pixel_to_wireCenter_len);	/* angle between line from detector to centre of wire and line to tangent of wire */
+	tanphi = tan(phi0+(use_leading_wire_edge ? -dphi : dphi));	/* phi is angle from yhat to V (measured at the pixel) */
+
+	b_reflected = pixel_z - pixel_y * tanphi;		/* line from pixel to tangent point is:   z = y*tan(phio±dphi) + b */
+	/* line of incident beam is:   y = kiy/kiz * z		Thiis line goes through origin, so intercept is 0 */
+	/* find intersection of this line and line from pixel to tangent point */
+	S.z = b_reflected / (1-tanphi * ki.y / ki.z);		/* intersection of two lines at this z value */
+	S.y = ki.y / ki.z * S.z;							/* corresponding y of point on incident beam */
+	S.x = ki.x / ki.z * S.z;							/* corresponding z of point on incident beam */
+	depth = DOT3(ki,S);
+
+	/*	if (verbosePixel) {
+	 *		printf("\n    -- rotated pixel on detector = {%.3f, %.3f}",pixel_y,pixel_z);
+	 *		printf("\n       wire center = {%.3f, %.3f, %.3f} relative to Si (micron)",wire_position.x,wire_position.y,wire_position.z);
+	 *		printf("\n       pixel_to_wireCenter = {%.9lf, %.9lf}µm,  |v|=%.9f",pixel_to_wireCenter_y,pixel_to_wireCenter_z,pixel_to_wireCenter_len);
+	 *		printf("\n       phi0 = %g (rad),   dphi = %g (rad),   tanphi = %g,   depth = %.2f (micron)\n",phi0,dphi,tanphi,DOT3(ki,S));
+	 *	}
+	 */
+	return depth;										/* depth measured along incident beam (remember that ki is normalized) */
+}
+
+
+
+/* convert PM500 {x,y,z} to beam line {x,y,z} */
+point_xyz wirePosition2beamLine(
+	point_xyz wire_pos)								/* PM500 {x,y,z} values */
+{
+	double x,y,z;
+
+	x = X2corrected(wire_pos.x);				/* do PM500 distortion correction for wire */
+	y = Y2corrected(wire_pos.y);
+	z = Z2corrected(wire_pos.z);
+	x -= calibration.wire.centre_at_si_xyz.x;	/* offset wire to origin (the Si position) */
+	y -= calibration.wire.centre_at_si_xyz.y;
+	z -= calibration.wire.centre_at_si_xyz.z;
+
+	/* rotate by the orientation of the positioner, this does not make the wire axis parallel to beam-line x-axis */
+	wire_pos.x = calibration.wire.rotation[0][0]*x + calibration.wire.rotation[0][1]*y + calibration.wire.rotation[0][2]*z;	/* {X2,Y2,Z2} = w.Rij x {x,y,z},   rotate by R (a small rotation) */
+	wire_pos.y = calibration.wire.rotation[1][0]*x + calibration.wire.rotation[1][1]*y + calibration.wire.rotation[1][2]*z;
+	wire_pos.z = calibration.wire.rotation[2][0]*x + calibration.wire.rotation[2][1]*y + calibration.wire.rotation[2][2]*z;
+
+	/* #warning "what should I do about the rotation to put wire axis parallel to beam line axis" */
+	wire_pos = MatrixMultiply31(calibration.wire.rho,wire_pos);	/* wire_centre = rho x wire_centre, rotate wire position so wire axis lies along {1,0,0} */
+
+	return wire_pos;
+}
@@ -0,0 +1,143 @@
+/*
+ *  wireScanMPI.c
+ *  reconstruct
+ *
+ *  Sharing the rows of one wire scan among MPI ranks.  Every rank works out the same list of stripes,
+ *  then each rank depth resolves a contiguous block of them, reading only the rows of its own stripes.
+ *  The stripes are written in rounds, in round r each rank writes its r-th stripe.  With serial HDF5 the
+ *  ranks take turns (rank order) within a round, since only one process at a time may write to a file.
+ *  So the reading and depth resolving scale with the ranks, but the writing only does for the single output
+ *  file (-S) with a parallel HDF5, where all of the ranks write each round together (collective MPI-IO).
+ *  Only compiled into the MPI build (-DUSE_MPI), everything here is called from WireScan.c.
+ *
+ */
+
+#ifdef USE_MPI
+#include <stdio.h>
+#include <stdlib.h>
+#include "WireScanDataTypesN.h"
+#include "readGeoN.h"
+#include "WireScan.h"
+#include "wireScanMPI.h"
+
+#define WRITE_TURN_TAG 2701					/* tag of the messages that pass the turn to write */
+
+static int	turns=0;						/* number of write turns this rank has finished */
+
+
+/* start MPI and set RANK & NRANKS, the OpenMP threads never call MPI so MPI_THREAD_FUNNELED is enough */
+void mpiStartup(
+	int		*argc,
+	char	***argv)
+{
+	int		provided;
+	MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &RANK);
+	MPI_Comm_size(MPI_COMM_WORLD, &NRANKS);
+}
+
+
+void mpiShutdown(void)
+{
+	MPI_Finalize();
+}
+
+
+/* number of ranks running on this node, they share its free memory */
+int mpiRanksOnNode(void)
+{
+	MPI_Comm node;
+	int		n=1;
+
+	if (MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, RANK, MPI_INFO_NULL, &node) == MPI_SUCCESS) {
+		MPI_Comm_size(node, &n);
+		MPI_Comm_free(&node);
+	}
+	return n>0 ? n : 1;
+}
+
+
+/* give this rank the stripes [kfirst, klast), a contiguous block with about 1/NRANKS of the active pixels */
+/* a stripe belongs to the rank whose share of the pixels holds the middle of the stripe, so the blocks are disjoint and in order */
+void mpiAssignStripes(
+	int		Nstripes,					/* number of stripes */
+	int		*lo,						/* first and last row of each stripe */
+	int		*hi,
+	size_t	*row_start,					/* active_pixels.row_start, pixels of row i are [row_start[i], row_start[i+1]) */
+	int		*kfirst,					/* first stripe of this rank */
+	int		*klast)						/* one after the last stripe of this rank, kfirst==klast when it has none */
+{
+	double	total, before, middle;
+	int		k, owner;
+
+	total = (double)(row_start[hi[Nstripes>0 ? Nstripes-1 : 0]+1] - row_start[lo[0]]);
+	*kfirst = *klast = -1;
+	for (k=0, before=0; k < Nstripes; k++) {
+		middle = before + (double)(row_start[hi[k]+1] - row_start[lo[k]]) / 2;
+		owner = total > 0 ? (int)(middle / total * NRANKS) : k * NRANKS / Nstripes;
+		owner = MIN(MAX(owner,0),NRANKS-1);
+		if (owner == RANK) {
+			if (*kfirst < 0) *kfirst = k;
+			*klast = k + 1;
+		}
+		before += (double)(row_start[hi[k]+1] - row_start[lo[k]]);
+	}
+	if (*kfirst < 0) *kfirst = *klast = 0;
+}
+
+
+/* largest n of all the ranks */
+int mpiMaxInt(
+	int		n)
+{
+	int		nmax=n;
+	MPI_Allreduce(&n, &nmax, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	return nmax;
+}
+
+
+void mpiBarrier(void)
+{
+	MPI_Barrier(MPI_COMM_WORLD);
+}
+
+
+/* wait until it is this rank's turn to write, the turn goes around the ranks in order, once each round */
+/* rank 0 waits for the last rank to finish the previous round, so no two ranks ever write at once */
+void mpiWriteTurnBegin(void)
+{
+	int		token;
+	if (NRANKS < 2 || (RANK == 0 && turns == 0)) return;
+	MPI_Recv(&token, 1, MPI_INT, (RANK + NRANKS - 1) % NRANKS, WRITE_TURN_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+
+/* done writing, pass the turn to the next rank */
+void mpiWriteTurnEnd(void)
+{
+	int		token=turns;
+	if (NRANKS < 2) return;
+	MPI_Send(&token, 1, MPI_INT, (RANK + 1) % NRANKS, WRITE_TURN_TAG, MPI_COMM_WORLD);
+	turns++;
+}
+
+
+/* after the last round, rank 0 collects the turn from the last rank, then all of the writing is done */
+void mpiWriteTurnsDone(void)
+{
+	int		token;
+	if (NRANKS > 1 && RANK == 0 && turns > 0) MPI_Recv(&token, 1, MPI_INT, NRANKS - 1, WRITE_TURN_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	turns = 0;
+}
+
+
+/* add the depth_intensity of all of the ranks, the total ends up on rank 0 which writes the summary */
+void mpiSumDepthIntensity(
+	double	*v,							/* image_set.depth_intensity.v */
+	int		N)							/* number of depths */
+{
+	if (NRANKS < 2 || N < 1) return;
+	if (RANK == 0) MPI_Reduce(MPI_IN_PLACE, v, N, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	else MPI_Reduce(v, NULL, N, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+}
+#endif
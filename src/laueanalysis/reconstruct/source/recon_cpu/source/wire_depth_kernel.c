@@ -0,0 +1,212 @@
+/*
+ *  wire_depth_kernel.c
+ *  reconstruct
+ *
+ *  depth of the ray tangent to the wire, for one pixel edge and all of the wire positions of a scan
+ *
+ *  This is the same calculation as edge_yz_to_depth() in wireGeometry.c, but without any trig.
+ *  With d = (wire - pixel) in the (y,z) plane, r the wire radius, and s = sqrt(|d|^2 - r^2),
+ *	tan(phi0 -+ dphi) = N/D,  N = dz*s + rs*dy,  D = dy*s - rs*dz,  where rs = -r for the leading edge and +r for the trailing edge
+ *  and the intersection of that tangent line with the incident beam gives
+ *	depth = (ki.ki) * (pz*D - py*N) / (kiz*D - kiy*N)
+ *  so each depth needs one sqrt and one divide.  All of the wire steps are done at once, using AVX2 when the cpu has it.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "wire_depth_kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WIRE_DEPTH_AVX2 1
+#include <immintrin.h>
+#endif
+
+typedef void (*edge_depths_func)(double py, double pz, const double *wy, const double *wz, size_t N, double rs, double kiy, double kiz, double ki2, double *depth);
+typedef void (*edge_depths_both_func)(double py, double pz, const double *wy, const double *wz, size_t N, double r, double kiy, double kiz, double ki2, double *lead, double *trail);
+static edge_depths_func edge_depths_impl = NULL;			/* set by edge_depths_init() */
+static edge_depths_both_func edge_depths_both_impl = NULL;
+static const char *edge_depths_name = "scalar";
+
+
+static void edge_depths_scalar(
+	double	py,						/* rotated y & z of the pixel edge */
+	double	pz,
+	const double *wy,				/* rotated y & z of the wire centers, N of each */
+	const double *wz,
+	size_t	N,
+	double	rs,						/* -radius for the leading edge, +radius for the trailing edge */
+	double	kiy,					/* y & z of rotated incident beam, calibration.wire.ki */
+	double	kiz,
+	double	ki2,					/* ki.ki */
+	double	*depth)					/* result, N depths (micron) */
+{
+	double	dy, dz, s, num, den;
+	size_t	m;
+
+	for (m=0; m<N; m++) {
+		dy = wy[m] - py;
+		dz = wz[m] - pz;
+		s = sqrt(dy*dy + dz*dz - rs*rs);				/* distance from pixel to the tangent point */
+		num = dz*s + rs*dy;
+		den = dy*s - rs*dz;
+		depth[m] = ki2 * (pz*den - py*num) / (kiz*den - kiy*num);
+	}
+}
+
+
+/* both edges of the wire at once, the two only differ in the sign of rs, so dy, dz, and s are shared */
+/* each depth is computed with exactly the same operations as edge_depths_scalar(), so the results are identical */
+static void edge_depths_both_scalar(
+	double	py,						/* rotated y & z of the pixel edge */
+	double	pz,
+	const double *wy,				/* rotated y & z of the wire centers, N of each */
+	const double *wz,
+	size_t	N,
+	double	r,						/* wire radius */
+	double	kiy,					/* y & z of rotated incident beam, calibration.wire.ki */
+	double	kiz,
+	double	ki2,					/* ki.ki */
+	double	*lead,					/* result, N depths for the leading edge, rs = -r (micron) */
+	double	*trail)					/* result, N depths for the trailing edge, rs = +r (micron) */
+{
+	double	dy, dz, s, num, den, rs;
+	size_t	m;
+
+	for (m=0; m<N; m++) {
+		dy = wy[m] - py;
+		dz = wz[m] - pz;
+		s = sqrt(dy*dy + dz*dz - r*r);
+		rs = -r;
+		num = dz*s + rs*dy;
+		den = dy*s - rs*dz;
+		lead[m] = ki2 * (pz*den - py*num) / (kiz*den - kiy*num);
+		rs = r;
+		num = dz*s + rs*dy;
+		den = dy*s - rs*dz;
+		trail[m] = ki2 * (pz*den - py*num) / (kiz*den - kiy*num);
+	}
+}
+
+
+#ifdef WIRE_DEPTH_AVX2
+__attribute__((target("avx2,fma")))
+static void edge_depths_avx2(
+	double	py,
+	double	pz,
+	const double *wy,
+	const double *wz,
+	size_t	N,
+	double	rs,
+	double	kiy,
+	double	kiz,
+	double	ki2,
+	double	*depth)
+{
+	__m256d	vpy=_mm256_set1_pd(py), vpz=_mm256_set1_pd(pz), vrs=_mm256_set1_pd(rs), vrs2=_mm256_set1_pd(rs*rs);
+	__m256d	vkiy=_mm256_set1_pd(kiy), vkiz=_mm256_set1_pd(kiz), vki2=_mm256_set1_pd(ki2);
+	__m256d	dy, dz, s, num, den;
+	size_t	m;
+
+	for (m=0; m+4<=N; m+=4) {
+		dy = _mm256_sub_pd(_mm256_loadu_pd(wy+m), vpy);
+		dz = _mm256_sub_pd(_mm256_loadu_pd(wz+m), vpz);
+		s = _mm256_sqrt_pd(_mm256_sub_pd(_mm256_fmadd_pd(dy,dy,_mm256_mul_pd(dz,dz)), vrs2));
+		num = _mm256_fmadd_pd(dz,s,_mm256_mul_pd(vrs,dy));
+		den = _mm256_fnmadd_pd(vrs,dz,_mm256_mul_pd(dy,s));
+		_mm256_storeu_pd(depth+m, _mm256_div_pd(_mm256_mul_pd(vki2,_mm256_fmsub_pd(vpz,den,_mm256_mul_pd(vpy,num))),
+			_mm256_fmsub_pd(vkiz,den,_mm256_mul_pd(vkiy,num))));
+	}
+	if (m<N) edge_depths_scalar(py,pz,wy+m,wz+m,N-m,rs,kiy,kiz,ki2,depth+m);	/* the last few */
+}
+
+
+__attribute__((target("avx2,fma")))
+static void edge_depths_both_avx2(
+	double	py,
+	double	pz,
+	const double *wy,
+	const double *wz,
+	size_t	N,
+	double	r,
+	double	kiy,
+	double	kiz,
+	double	ki2,
+	double	*lead,
+	double	*trail)
+{
+	__m256d	vpy=_mm256_set1_pd(py), vpz=_mm256_set1_pd(pz), vlead=_mm256_set1_pd(-r), vtrail=_mm256_set1_pd(r), vrs2=_mm256_set1_pd(r*r);
+	__m256d	vkiy=_mm256_set1_pd(kiy), vkiz=_mm256_set1_pd(kiz), vki2=_mm256_set1_pd(ki2);
+	__m256d	dy, dz, s, num, den;
+	size_t	m;
+
+	for (m=0; m+4<=N; m+=4) {
+		dy = _mm256_sub_pd(_mm256_loadu_pd(wy+m), vpy);
+		dz = _mm256_sub_pd(_mm256_loadu_pd(wz+m), vpz);
+		s = _mm256_sqrt_pd(_mm256_sub_pd(_mm256_fmadd_pd(dy,dy,_mm256_mul_pd(dz,dz)), vrs2));
+		num = _mm256_fmadd_pd(dz,s,_mm256_mul_pd(vlead,dy));
+		den = _mm256_fnmadd_pd(vlead,dz,_mm256_mul_pd(dy,s));
+		_mm256_storeu_pd(lead+m, _mm256_div_pd(_mm256_mul_pd(vki2,_mm256_fmsub_pd(vpz,den,_mm256_mul_pd(vpy,num))),
+			_mm256_fmsub_pd(vkiz,den,_mm256_mul_pd(vkiy,num))));
+		num = _mm256_fmadd_pd(dz,s,_mm256_mul_pd(vtrail,dy));
+		den = _mm256_fnmadd_pd(vtrail,dz,_mm256_mul_pd(dy,s));
+		_mm256_storeu_pd(trail+m, _mm256_div_pd(_mm256_mul_pd(vki2,_mm256_fmsub_pd(vpz,den,_mm256_mul_pd(vpy,num))),
+			_mm256_fmsub_pd(vkiz,den,_mm256_mul_pd(vkiy,num))));
+	}
+	if (m<N) edge_depths_both_scalar(py,pz,wy+m,wz+m,N-m,r,kiy,kiz,ki2,lead+m,trail+m);	/* the last few */
+}
+#endif
+
+
+/* choose the version of the kernel for this cpu, call this before starting any threads, returns name of the version being used */
+const char *edge_depths_init(void)
+{
+	edge_depths_impl = edge_depths_scalar;
+	edge_depths_both_impl = edge_depths_both_scalar;
+	edge_depths_name = "scalar";
+#ifdef WIRE_DEPTH_AVX2
+	if (getenv("WIRE_DEPTH_SCALAR")) return edge_depths_name;	/* allows forcing the scalar version for comparison */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		edge_depths_impl = edge_depths_avx2;
+		edge_depths_both_impl = edge_depths_both_avx2;
+		edge_depths_name = "avx2";
+	}
+#endif
+	return edge_depths_name;
+}
+
+
+/* depth[m] is the depth of the ray from the pixel edge tangent to the wire at position m, for m=0..N-1,
+ * same as edge_yz_to_depth(pixel_y, pixel_z, {*,wire_y[m],wire_z[m]}, use_leading_wire_edge) */
+void edge_depths_all_steps(
+	double	pixel_y,				/* y & z of the pixel edge, rotated by calibration.wire.rho */
+	double	pixel_z,
+	const double *wire_y,			/* y & z of the wire centers, rotated by rho, one for each wire step */
+	const double *wire_z,
+	size_t	N,						/* number of wire steps */
+	double	radius,					/* wire radius (micron) */
+	point_xyz ki,					/* incident beam direction rotated by rho, calibration.wire.ki */
+	int		use_leading_wire_edge,	/* which edge of wire are using here, TRUE for leading edge */
+	double	*depth)					/* result, N depths measured along the incident beam (micron) */
+{
+	if (!edge_depths_impl) edge_depths_init();				/* only happens if edge_depths_init() was not called first */
+	edge_depths_impl(pixel_y, pixel_z, wire_y, wire_z, N, use_leading_wire_edge ? -radius : radius, ki.y, ki.z, ki.x*ki.x + ki.y*ki.y + ki.z*ki.z, depth);
+}
+
+
+/* both edges of the wire in one pass, lead[m] and trail[m] are the same as edge_depths_all_steps() with use_leading_wire_edge true and false */
+void edge_depths_both_all_steps(
+	double	pixel_y,				/* y & z of the pixel edge, rotated by calibration.wire.rho */
+	double	pixel_z,
+	const double *wire_y,			/* y & z of the wire centers, rotated by rho, one for each wire step */
+	const double *wire_z,
+	size_t	N,						/* number of wire steps */
+	double	radius,					/* wire radius (micron) */
+	point_xyz ki,					/* incident beam direction rotated by rho, calibration.wire.ki */
+	double	*lead,					/* result, N depths for the leading edge of the wire (micron) */
+	double	*trail)					/* result, N depths for the trailing edge of the wire (micron) */
+{
+	if (!edge_depths_both_impl) edge_depths_init();
+	edge_depths_both_impl(pixel_y, pixel_z, wire_y, wire_z, N, radius, ki.y, ki.z, ki.x*ki.x + ki.y*ki.y + ki.z*ki.z, lead, trail);
+}